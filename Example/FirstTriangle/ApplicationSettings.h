@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+//Startup options of the application,
+//	parsed once from the command line in main()
+//	and handed to HelloTriangleApplication.
+//
+//	--headless		render into offscreen images, no window, surface or swap chain
+//	--frames=N		stop after N frames (0 = until the window is closed)
+//	--pipeline-cache=PATH	where the pipeline cache is loaded from and saved to
+//	--no-pipeline-cache	start with an empty pipeline cache and don't save it
+//	--profile=PATH		record GPU timestamps and CPU scopes, write a Chrome trace to PATH on exit
+//	--record=MODE		how command buffers are recorded, see RecordMode
+//	--benchmark-record	run every RecordMode for --frames frames (default 500) and compare them
+//	--threads=N		worker threads for --record=threaded (0 = one per core)
+//	--draws=N		objects in the scene, one draw call each, to give the recording paths some work
+//	--pipeline-threads=N	compile pipelines on N background threads, drawing with a fallback pipeline meanwhile
+//	--shader-dir=PATH	load the SPIR-V modules from PATH/spv instead of the ones embedded in the executable
+//	--validation=MODE	off, errors, full or performance, see ValidationMode.
+//				LEARNVULKAN_VALIDATION=MODE in the environment does the same, the option wins.
+//	--validation-log=PATH	write validation layer messages to PATH instead of stderr
+//	--hot-reload		rebuild shaders when their sources change and swap in the new pipelines while running
+//	--benchmark-pipelines	create a set of material variants with and without pipeline derivatives and compare them
+//	--device-profile=PATH	where the capabilities of the chosen physical device are cached between runs
+//	--no-device-profile	query every physical device at startup and don't save a profile
+//	--device=INDEX|UUID	use this physical device instead of the highest ranked one
+//	--msaa=N		samples per pixel (1, 2, 4 or 8), lowered to what the device supports
+//	--gpu-culling		cull the objects in a compute shader and draw the visible ones with one indirect draw
+//	--verify-culling	--gpu-culling, and compare the GPU's draw commands with a CPU reference every frame
+struct ApplicationSettings
+{
+	enum class RecordMode
+	{
+		//static: primary command buffers recorded once at startup and resubmitted every frame
+		Static,
+		//per-frame: one ONE_TIME_SUBMIT primary per frame,
+		//	recorded on the main thread from a transient pool of the frame slot
+		PerFrame,
+		//threaded: every frame, worker threads record secondary command buffers
+		//	that the main thread executes from one primary
+		Threaded
+	};
+
+	enum class ValidationMode
+	{
+		//off: no validation layer and no debug messenger, nothing is checked
+		Off,
+		//errors: only VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT messages
+		Errors,
+		//full: verbose messages, warnings and errors of every type
+		Full,
+		//performance: only VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT messages,
+		//	with the layer's best practices checks enabled where available
+		Performance
+	};
+
+	bool		headless = false;
+	uint64_t	frameCount = 0;
+	std::string	pipelineCachePath = "pipeline_cache.bin";
+	std::string	profilePath;
+	RecordMode	recordMode = RecordMode::Static;
+	uint32_t	recordThreads = 0;
+	uint32_t	drawCount = 1;
+	bool		benchmarkRecord = false;
+	//0: pipelines are created on the main thread when they are needed
+	uint32_t	pipelineThreads = 0;
+	//Empty: the embedded modules, or Shaders/ when the executable has none
+	std::string	shaderDir;
+	bool		benchmarkPipelines = false;
+	bool		hotReload = false;
+	//Empty: stderr
+	std::string	validationLogPath;
+	//Empty: no device profile is loaded or saved
+	std::string	deviceProfilePath = "device_profile.bin";
+	//Empty: the highest ranked device
+	std::string	deviceOverride;
+	//1: no multisampling, the scene is drawn into the swap chain image directly
+	uint32_t	msaaSamples = 4;
+	//Needs the multiDrawIndirect and drawIndirectFirstInstance features
+	bool		gpuCulling = false;
+	bool		verifyCulling = false;
+#ifdef NODEBUG
+	ValidationMode	validationMode = ValidationMode::Off;
+#else
+	ValidationMode	validationMode = ValidationMode::Full;
+#endif
+
+	//Without a window there is nothing that could close the application
+	static const uint64_t DEFAULT_HEADLESS_FRAMES = 1000;
+
+	static ApplicationSettings fromCommandLine(int argc, char** argv)
+	{
+		ApplicationSettings settings;
+		bool frameCountGiven = false;
+
+		//Lets a release build be validated without changing how it is launched
+		const char* validation = std::getenv("LEARNVULKAN_VALIDATION");
+		if (validation != nullptr && !parseValidationMode(validation, settings.validationMode))
+		{
+			std::cerr << "ignoring unknown LEARNVULKAN_VALIDATION: " << validation << std::endl;
+		}
+
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "--headless")
+			{
+				settings.headless = true;
+			}
+			else if (arg.compare(0, 9, "--frames=") == 0)
+			{
+				settings.frameCount = std::strtoull(arg.c_str() + 9, nullptr, 10);
+				frameCountGiven = true;
+			}
+			else if (arg.compare(0, 17, "--pipeline-cache=") == 0)
+			{
+				settings.pipelineCachePath = arg.substr(17);
+			}
+			else if (arg == "--no-pipeline-cache")
+			{
+				settings.pipelineCachePath.clear();
+			}
+			else if (arg.compare(0, 10, "--profile=") == 0)
+			{
+				settings.profilePath = arg.substr(10);
+			}
+			else if (arg == "--record=static")
+			{
+				settings.recordMode = RecordMode::Static;
+			}
+			else if (arg == "--record=per-frame")
+			{
+				settings.recordMode = RecordMode::PerFrame;
+			}
+			else if (arg == "--record=threaded")
+			{
+				settings.recordMode = RecordMode::Threaded;
+			}
+			else if (arg == "--benchmark-record")
+			{
+				settings.benchmarkRecord = true;
+			}
+			else if (arg.compare(0, 10, "--threads=") == 0)
+			{
+				settings.recordThreads = static_cast<uint32_t>(std::strtoul(arg.c_str() + 10, nullptr, 10));
+			}
+			else if (arg.compare(0, 8, "--draws=") == 0)
+			{
+				settings.drawCount = static_cast<uint32_t>(std::strtoul(arg.c_str() + 8, nullptr, 10));
+				if (settings.drawCount == 0)
+				{
+					settings.drawCount = 1;
+				}
+			}
+			else if (arg.compare(0, 19, "--pipeline-threads=") == 0)
+			{
+				settings.pipelineThreads = static_cast<uint32_t>(std::strtoul(arg.c_str() + 19, nullptr, 10));
+			}
+			else if (arg.compare(0, 13, "--shader-dir=") == 0)
+			{
+				settings.shaderDir = arg.substr(13);
+			}
+			else if (arg.compare(0, 13, "--validation=") == 0)
+			{
+				if (!parseValidationMode(arg.substr(13), settings.validationMode))
+				{
+					std::cerr << "ignoring unknown option: " << arg << std::endl;
+				}
+			}
+			else if (arg.compare(0, 17, "--validation-log=") == 0)
+			{
+				settings.validationLogPath = arg.substr(17);
+			}
+			else if (arg == "--hot-reload")
+			{
+				settings.hotReload = true;
+			}
+			else if (arg == "--benchmark-pipelines")
+			{
+				settings.benchmarkPipelines = true;
+			}
+			else if (arg.compare(0, 17, "--device-profile=") == 0)
+			{
+				settings.deviceProfilePath = arg.substr(17);
+			}
+			else if (arg == "--no-device-profile")
+			{
+				settings.deviceProfilePath.clear();
+			}
+			else if (arg.compare(0, 9, "--device=") == 0)
+			{
+				settings.deviceOverride = arg.substr(9);
+			}
+			else if (arg.compare(0, 7, "--msaa=") == 0)
+			{
+				uint32_t samples = static_cast<uint32_t>(std::strtoul(arg.c_str() + 7, nullptr, 10));
+				if (samples == 1 || samples == 2 || samples == 4 || samples == 8)
+				{
+					settings.msaaSamples = samples;
+				}
+				else
+				{
+					std::cerr << "ignoring unknown option: " << arg << std::endl;
+				}
+			}
+			else if (arg == "--gpu-culling")
+			{
+				settings.gpuCulling = true;
+			}
+			else if (arg == "--verify-culling")
+			{
+				settings.gpuCulling = true;
+				settings.verifyCulling = true;
+			}
+			else
+			{
+				std::cerr << "ignoring unknown option: " << arg << std::endl;
+			}
+		}
+
+		if (settings.headless && !frameCountGiven)
+		{
+			settings.frameCount = DEFAULT_HEADLESS_FRAMES;
+		}
+		return settings;
+	}
+
+	static bool parseValidationMode(const std::string &name, ValidationMode &mode)
+	{
+		if (name == "off")
+			mode = ValidationMode::Off;
+		else if (name == "errors")
+			mode = ValidationMode::Errors;
+		else if (name == "full")
+			mode = ValidationMode::Full;
+		else if (name == "performance")
+			mode = ValidationMode::Performance;
+		else
+			return false;
+		return true;
+	}
+};
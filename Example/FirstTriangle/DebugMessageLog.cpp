@@ -0,0 +1,275 @@
+#include "DebugMessageLog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+//How often the drain thread wakes up when the ring is empty
+static const int DRAIN_INTERVAL_MS = 20;
+
+static const char* severityName(VkDebugUtilsMessageSeverityFlagBitsEXT severity)
+{
+	switch (severity)
+	{
+	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:		return "error";
+	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:	return "warning";
+	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT:		return "info";
+	default:												return "verbose";
+	}
+}
+
+static const char* typeName(VkDebugUtilsMessageTypeFlagsEXT type)
+{
+	if (type & VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT)
+		return "validation";
+	if (type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT)
+		return "performance";
+	return "general";
+}
+
+//strncpy that always terminates and tolerates nullptr
+static void copyString(char* destination, size_t size, const char* source)
+{
+	size_t length = source != nullptr ? std::min(std::strlen(source), size - 1) : 0;
+	std::memcpy(destination, source, length);
+	destination[length] = '\0';
+}
+
+DebugMessageLog::DebugMessageLog()
+	: mEnqueue(0)
+	, mDequeue(0)
+	, mDropped(0)
+	, mTotal(0)
+	, mFile(nullptr)
+	, mQuit(false)
+{
+}
+
+DebugMessageLog::~DebugMessageLog()
+{
+	destroy();
+}
+
+void DebugMessageLog::create(const std::string &path)
+{
+	mSlots.reset(new Slot[RING_SIZE]);
+	for (size_t i = 0; i < RING_SIZE; ++i)
+	{
+		mSlots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	mIds.reset(new IdCounter[ID_TABLE_SIZE]);
+	for (size_t i = 0; i < ID_TABLE_SIZE; ++i)
+	{
+		mIds[i].id.store(0, std::memory_order_relaxed);
+		mIds[i].count.store(0, std::memory_order_relaxed);
+		mIds[i].queued.store(false, std::memory_order_relaxed);
+		mIds[i].reported = 0;
+	}
+	mEnqueue = 0;
+	mDequeue = 0;
+	mDropped = 0;
+	mTotal = 0;
+
+	mFile = stderr;
+	if (!path.empty())
+	{
+		mFile = std::fopen(path.c_str(), "w");
+		if (mFile == nullptr)
+		{
+			std::cerr << "debug message log: failed to open " << path << ", using stderr" << std::endl;
+			mFile = stderr;
+		}
+	}
+
+	mQuit = false;
+	mThread = std::thread(&DebugMessageLog::drainMain, this);
+}
+
+void DebugMessageLog::destroy()
+{
+	if (!mThread.joinable())
+		return;
+
+	//The drain thread empties the ring once more before it returns
+	mQuit = true;
+	mThread.join();
+
+	reportRepeats();
+	std::fprintf(mFile, "debug messages: %u total, %u dropped because the log fell behind\n",
+		mTotal.load(), mDropped.load());
+	if (mFile != stderr)
+	{
+		std::fclose(mFile);
+	}
+	std::fflush(stderr);
+	mFile = nullptr;
+}
+
+void DebugMessageLog::push(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type,
+	const VkDebugUtilsMessengerCallbackDataEXT* data)
+{
+	mTotal.fetch_add(1, std::memory_order_relaxed);
+	IdCounter* counter = nullptr;
+	if (data->messageIdNumber != 0)
+	{
+		//Claimed before the slot, so only one thread queues the first message of an ID
+		counter = countId(data->messageIdNumber);
+		bool queued = false;
+		if (counter != nullptr && !counter->queued.compare_exchange_strong(queued, true, std::memory_order_relaxed))
+			return;
+	}
+
+	//Claim a position: the slot there is free if its sequence has come round to it
+	size_t position = mEnqueue.load(std::memory_order_relaxed);
+	Slot* slot;
+	for (;;)
+	{
+		slot = &mSlots[position & (RING_SIZE - 1)];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+		if (difference == 0)
+		{
+			if (mEnqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (difference < 0)
+		{
+			//Still holds a message from the last round, the ring is full
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+			//Unclaimed again, the next message of this ID is queued in full
+			if (counter != nullptr)
+			{
+				counter->queued.store(false, std::memory_order_relaxed);
+			}
+			return;
+		}
+		else
+		{
+			position = mEnqueue.load(std::memory_order_relaxed);
+		}
+	}
+
+	Message &message = slot->message;
+	message.severity = severity;
+	message.type = type;
+	message.id = data->messageIdNumber;
+	message.objectCount = std::min(data->objectCount, static_cast<uint32_t>(MAX_OBJECTS));
+	for (uint32_t i = 0; i < message.objectCount; ++i)
+	{
+		message.objectTypes[i] = data->pObjects[i].objectType;
+		message.objectHandles[i] = data->pObjects[i].objectHandle;
+	}
+	copyString(message.idName, ID_NAME_SIZE, data->pMessageIdName);
+	copyString(message.text, MESSAGE_SIZE, data->pMessage);
+
+	//Hands the slot to the consumer
+	slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+DebugMessageLog::IdCounter* DebugMessageLog::countId(int32_t id)
+{
+	size_t start = static_cast<uint32_t>(id) * 2654435761u;
+	for (size_t i = 0; i < ID_TABLE_SIZE; ++i)
+	{
+		IdCounter &counter = mIds[(start + i) & (ID_TABLE_SIZE - 1)];
+		int32_t current = counter.id.load(std::memory_order_acquire);
+		if (current == 0)
+		{
+			//Claim the empty entry, or find out which ID another thread put there
+			if (!counter.id.compare_exchange_strong(current, id, std::memory_order_acq_rel))
+			{
+				if (current != id)
+					continue;
+			}
+		}
+		else if (current != id)
+		{
+			continue;
+		}
+		counter.count.fetch_add(1, std::memory_order_relaxed);
+		return &counter;
+	}
+	//Table full: no deduplication for new IDs
+	return nullptr;
+}
+
+bool DebugMessageLog::tryPop(Message &message)
+{
+	Slot &slot = mSlots[mDequeue & (RING_SIZE - 1)];
+	if (slot.sequence.load(std::memory_order_acquire) != mDequeue + 1)
+		return false;
+
+	message = slot.message;
+	//Free for the producer one round later
+	slot.sequence.store(mDequeue + RING_SIZE, std::memory_order_release);
+	++mDequeue;
+	return true;
+}
+
+void DebugMessageLog::drainMain()
+{
+	auto lastReport = Clock::now();
+	Message message;
+	for (;;)
+	{
+		//Read before draining, so nothing pushed before destroy is missed
+		bool quit = mQuit;
+
+		bool wrote = false;
+		while (tryPop(message))
+		{
+			write(message);
+			wrote = true;
+		}
+
+		if (Clock::now() - lastReport >= std::chrono::seconds(1))
+		{
+			reportRepeats();
+			lastReport = Clock::now();
+			wrote = true;
+		}
+
+		//One flush per batch instead of one per message
+		if (wrote)
+		{
+			std::fflush(mFile);
+		}
+		if (quit)
+			return;
+		std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_INTERVAL_MS));
+	}
+}
+
+void DebugMessageLog::write(const Message &message)
+{
+	std::fprintf(mFile, "validation layer [%s, %s] %s (0x%08x): %s\n",
+		severityName(message.severity), typeName(message.type),
+		message.idName[0] != '\0' ? message.idName : "-", static_cast<uint32_t>(message.id), message.text);
+	for (uint32_t i = 0; i < message.objectCount; ++i)
+	{
+		std::fprintf(mFile, "\tobject %u: type %d, handle 0x%llx\n", i, static_cast<int>(message.objectTypes[i]),
+			static_cast<unsigned long long>(message.objectHandles[i]));
+	}
+}
+
+void DebugMessageLog::reportRepeats()
+{
+	for (size_t i = 0; i < ID_TABLE_SIZE; ++i)
+	{
+		IdCounter &counter = mIds[i];
+		int32_t id = counter.id.load(std::memory_order_acquire);
+		//Every message of an ID that never got into the ring is counted as dropped
+		if (id == 0 || !counter.queued.load(std::memory_order_relaxed))
+			continue;
+
+		//The first message of an ID was written in full
+		uint32_t count = counter.count.load(std::memory_order_relaxed);
+		uint32_t repeats = count > 0 ? count - 1 : 0;
+		if (repeats > counter.reported)
+		{
+			std::fprintf(mFile, "validation layer: message 0x%08x repeated %u more time(s), %u in total\n",
+				static_cast<uint32_t>(id), repeats - counter.reported, count);
+			counter.reported = repeats;
+		}
+	}
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+//Sink for the messages of the validation layers.
+//
+//The debug callback runs on whichever thread made the Vulkan call,
+//	often inside the render loop, and can fire thousands of times per frame.
+//Writing each message with std::endl there flushes the stream every time
+//	and serializes all threads on it.
+//
+//push instead copies the message into a fixed-size slot of a lock-free ring
+//	(multiple producers, one consumer), without allocating or taking a lock.
+//A background thread drains the ring and writes to a file or stderr.
+//
+//Messages are deduplicated by messageIdNumber:
+//	only the first message of an ID goes through the ring,
+//	later ones just increment its counter,
+//	a first message dropped because the ring was full leaves the next one its turn,
+//	and the drain thread reports how often each ID repeated once per second.
+//Messages without an ID (0, e.g. from the loader) are never deduplicated.
+//When the ring is full the message is dropped and counted.
+class DebugMessageLog
+{
+public:
+	DebugMessageLog();
+	//Calls destroy, so messages of a failed run still reach the log
+	~DebugMessageLog();
+
+	//An empty path writes to stderr
+	void create(const std::string &path);
+
+	//Drains everything still queued and prints the totals
+	void destroy();
+
+	//Called from the debug callback, on any thread
+	void push(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type,
+		const VkDebugUtilsMessengerCallbackDataEXT* data);
+
+private:
+	//Longer messages and ID names are truncated
+	static const size_t MESSAGE_SIZE = 512;
+	static const size_t ID_NAME_SIZE = 96;
+	static const size_t MAX_OBJECTS = 4;
+	//Both powers of two
+	static const size_t RING_SIZE = 1024;
+	static const size_t ID_TABLE_SIZE = 512;
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Message
+	{
+		VkDebugUtilsMessageSeverityFlagBitsEXT	severity;
+		VkDebugUtilsMessageTypeFlagsEXT			type;
+		int32_t									id;
+		uint32_t								objectCount;
+		VkObjectType							objectTypes[MAX_OBJECTS];
+		uint64_t								objectHandles[MAX_OBJECTS];
+		char									idName[ID_NAME_SIZE];
+		char									text[MESSAGE_SIZE];
+	};
+
+	//A slot is free for the producer at position p when sequence == p,
+	//	and holds a message for the consumer at position p when sequence == p + 1.
+	struct Slot
+	{
+		std::atomic<size_t>	sequence;
+		Message				message;
+	};
+
+	//Open addressing, an entry's id never changes once claimed
+	struct IdCounter
+	{
+		std::atomic<int32_t>	id;
+		std::atomic<uint32_t>	count;
+		//A message of this ID is in the ring or was written
+		std::atomic<bool>		queued;
+		//Only used by the drain thread
+		uint32_t				reported;
+	};
+
+	//Counts the message, returns nullptr when the table is full
+	IdCounter* countId(int32_t id);
+
+	bool tryPop(Message &message);
+	void drainMain();
+	void write(const Message &message);
+	void reportRepeats();
+
+private:
+	std::unique_ptr<Slot[]>			mSlots;
+	std::unique_ptr<IdCounter[]>	mIds;
+	//Own cache lines, producers and the consumer would otherwise share one
+	alignas(64) std::atomic<size_t>	mEnqueue;
+	alignas(64) size_t				mDequeue;
+
+	std::atomic<uint32_t>			mDropped;
+	std::atomic<uint32_t>			mTotal;
+
+	FILE*							mFile;
+	std::thread						mThread;
+	std::atomic<bool>				mQuit;
+};
@@ -0,0 +1,425 @@
+#include "DeviceAllocator.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+//Default size of a VkDeviceMemory block.
+//Resources bigger than half a block get a dedicated block of their own.
+const VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	//Vulkan alignments are always powers of two
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+DeviceAllocator::DeviceAllocator()
+	: mDevice(VK_NULL_HANDLE)
+	, mMemoryProperties()
+	, mBufferImageGranularity(1)
+	, mBlockSize(DEFAULT_BLOCK_SIZE)
+	, mFramesInFlight(1)
+	, mCurrentFrame(0)
+{
+}
+
+void DeviceAllocator::create(VkDevice device, const VkPhysicalDeviceProperties &properties,
+	const VkPhysicalDeviceMemoryProperties &memoryProperties, uint32_t framesInFlight)
+{
+	mDevice = device;
+	mFramesInFlight = framesInFlight;
+	mCurrentFrame = 0;
+	mMemoryProperties = memoryProperties;
+	mBufferImageGranularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+}
+
+void DeviceAllocator::destroy()
+{
+	Stats stats = getStats();
+	if (stats.allocationCount > 0)
+	{
+		std::cerr << "allocator: " << stats.allocationCount << " allocations still alive at destroy" << std::endl;
+	}
+
+	for (uint32_t i = 0; i < mBlocks.size(); ++i)
+	{
+		releaseBlock(i);
+	}
+	mBlocks.clear();
+}
+
+uint32_t DeviceAllocator::findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) const
+{
+	//memoryTypeBits is a bit field of the memory types that are suitable for the resource
+	for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; ++i)
+	{
+		if ((memoryTypeBits & (1 << i))
+			&& (mMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+bool DeviceAllocator::hasMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; ++i)
+	{
+		if ((memoryTypeBits & (1 << i))
+			&& (mMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+VkDeviceSize DeviceAllocator::blockSizeFor(uint32_t memoryType) const
+{
+	//Don't let a single block take more than an eighth of a small heap (e.g. the 256MB BAR heap)
+	VkDeviceSize heapSize = mMemoryProperties.memoryHeaps[mMemoryProperties.memoryTypes[memoryType].heapIndex].size;
+	return std::min(mBlockSize, std::max<VkDeviceSize>(heapSize / 8, 1024 * 1024));
+}
+
+DeviceAllocation DeviceAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+	bool isImage, Strategy strategy)
+{
+	uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+
+	VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+	VkDeviceSize size = requirements.size;
+	if (isImage)
+	{
+		alignment = std::max(alignment, mBufferImageGranularity);
+		size = alignUp(size, mBufferImageGranularity);
+	}
+
+	bool linear = strategy == Strategy::Linear;
+	VkDeviceSize blockSize = blockSizeFor(memoryType);
+	//Sharing a lazily allocated block would commit memory for every image in it
+	bool lazy = (mMemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+
+	DeviceAllocation allocation;
+	VkDeviceSize offset = 0;
+	uint32_t blockIndex = static_cast<uint32_t>(mBlocks.size());
+
+	//First fit over the existing blocks of this memory type
+	if (!lazy && size <= blockSize / 2)
+	{
+		for (uint32_t i = 0; i < mBlocks.size(); ++i)
+		{
+			Block &block = mBlocks[i];
+			if (block.memory == VK_NULL_HANDLE || block.memoryType != memoryType
+				|| block.linear != linear || block.dedicated)
+				continue;
+
+			bool found = linear
+				? block.frame == mCurrentFrame && allocateFromLinear(block, size, alignment, offset)
+				: allocateFromFreeList(block, size, alignment, offset);
+			if (found)
+			{
+				blockIndex = i;
+				break;
+			}
+		}
+	}
+
+	if (blockIndex == mBlocks.size())
+	{
+		bool dedicated = lazy || size > blockSize / 2;
+		blockIndex = allocateBlock(memoryType, dedicated ? size : blockSize, linear, mCurrentFrame);
+		mBlocks[blockIndex].dedicated = dedicated;
+
+		Block &block = mBlocks[blockIndex];
+		bool found = linear
+			? allocateFromLinear(block, size, alignment, offset)
+			: allocateFromFreeList(block, size, alignment, offset);
+		if (!found)
+		{
+			throw std::runtime_error("failed to sub-allocate from a new memory block!");
+		}
+	}
+
+	Block &block = mBlocks[blockIndex];
+	block.bytesUsed += size;
+	++block.allocationCount;
+
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.size = size;
+	allocation.block = blockIndex;
+	allocation.mapped = block.mapped != nullptr ? block.mapped + offset : nullptr;
+	return allocation;
+}
+
+bool DeviceAllocator::allocateFromFreeList(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset)
+{
+	for (auto range = block.freeRanges.begin(); range != block.freeRanges.end(); ++range)
+	{
+		VkDeviceSize rangeStart = range->first;
+		VkDeviceSize rangeEnd = range->first + range->second;
+		VkDeviceSize start = alignUp(rangeStart, alignment);
+		if (start + size > rangeEnd)
+			continue;
+
+		//Split the range, the padding in front and the rest behind stay free
+		block.freeRanges.erase(range);
+		if (start > rangeStart)
+		{
+			block.freeRanges[rangeStart] = start - rangeStart;
+		}
+		if (start + size < rangeEnd)
+		{
+			block.freeRanges[start + size] = rangeEnd - (start + size);
+		}
+
+		offset = start;
+		return true;
+	}
+	return false;
+}
+
+bool DeviceAllocator::allocateFromLinear(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset)
+{
+	VkDeviceSize start = alignUp(block.linearOffset, alignment);
+	if (start + size > block.size)
+		return false;
+
+	block.linearOffset = start + size;
+	offset = start;
+	return true;
+}
+
+void DeviceAllocator::free(const DeviceAllocation &allocation)
+{
+	if (!allocation.isValid())
+		return;
+
+	Block &block = mBlocks[allocation.block];
+	block.bytesUsed -= allocation.size;
+	--block.allocationCount;
+
+	if (block.dedicated && block.allocationCount == 0)
+	{
+		releaseBlock(allocation.block);
+		return;
+	}
+
+	//Linear memory comes back all at once in beginFrame
+	if (block.linear)
+		return;
+
+	//Merge with the free range behind and in front of it
+	VkDeviceSize start = allocation.offset;
+	VkDeviceSize end = allocation.offset + allocation.size;
+
+	auto next = block.freeRanges.lower_bound(start);
+	if (next != block.freeRanges.end() && next->first == end)
+	{
+		end += next->second;
+		next = block.freeRanges.erase(next);
+	}
+	if (next != block.freeRanges.begin())
+	{
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == start)
+		{
+			start = previous->first;
+			block.freeRanges.erase(previous);
+		}
+	}
+	block.freeRanges[start] = end - start;
+}
+
+VkBuffer DeviceAllocator::createBuffer(const VkBufferCreateInfo &bufferInfo, VkMemoryPropertyFlags properties,
+	DeviceAllocation &allocation, Strategy strategy)
+{
+	VkBuffer buffer;
+	if (vkCreateBuffer(mDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create buffer!");
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(mDevice, buffer, &requirements);
+
+	allocation = allocate(requirements, properties, false, strategy);
+	vkBindBufferMemory(mDevice, buffer, allocation.memory, allocation.offset);
+	return buffer;
+}
+
+VkImage DeviceAllocator::createImage(const VkImageCreateInfo &imageInfo, VkMemoryPropertyFlags properties,
+	DeviceAllocation &allocation, Strategy strategy)
+{
+	VkImage image;
+	if (vkCreateImage(mDevice, &imageInfo, nullptr, &image) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create image!");
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(mDevice, image, &requirements);
+
+	//Linear-tiling images follow the same rules as buffers
+	bool isImage = imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL;
+	allocation = allocate(requirements, properties, isImage, strategy);
+	vkBindImageMemory(mDevice, image, allocation.memory, allocation.offset);
+	return image;
+}
+
+VkImage DeviceAllocator::createTransientImage(const VkImageCreateInfo &imageInfo, DeviceAllocation &allocation)
+{
+	VkImage image;
+	if (vkCreateImage(mDevice, &imageInfo, nullptr, &image) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create image!");
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(mDevice, image, &requirements);
+
+	//Desktop GPUs have no lazily allocated memory, the attachment then costs its full size
+	VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	if (hasMemoryType(requirements.memoryTypeBits, properties | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+	{
+		properties |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+	}
+	allocation = allocate(requirements, properties, imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL);
+	vkBindImageMemory(mDevice, image, allocation.memory, allocation.offset);
+	return image;
+}
+
+void DeviceAllocator::destroyBuffer(VkBuffer buffer, const DeviceAllocation &allocation)
+{
+	vkDestroyBuffer(mDevice, buffer, nullptr);
+	free(allocation);
+}
+
+void DeviceAllocator::destroyImage(VkImage image, const DeviceAllocation &allocation)
+{
+	vkDestroyImage(mDevice, image, nullptr);
+	free(allocation);
+}
+
+void DeviceAllocator::beginFrame(uint32_t frameIndex)
+{
+	mCurrentFrame = frameIndex % mFramesInFlight;
+	for (uint32_t i = 0; i < mBlocks.size(); ++i)
+	{
+		Block &block = mBlocks[i];
+		if (block.memory == VK_NULL_HANDLE || !block.linear || block.frame != mCurrentFrame)
+			continue;
+
+		//allocate never puts anything else into a dedicated block, it would stay empty forever
+		if (block.dedicated)
+		{
+			releaseBlock(i);
+			continue;
+		}
+		block.linearOffset = 0;
+		block.bytesUsed = 0;
+		block.allocationCount = 0;
+	}
+}
+
+uint32_t DeviceAllocator::allocateBlock(uint32_t memoryType, VkDeviceSize size, bool linear, uint32_t frame)
+{
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	Block block;
+	if (vkAllocateMemory(mDevice, &allocInfo, nullptr, &block.memory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate device memory block!");
+	}
+	block.size = size;
+	block.memoryType = memoryType;
+	block.linear = linear;
+	block.frame = frame;
+	if (!linear)
+	{
+		block.freeRanges[0] = size;
+	}
+
+	//Host visible blocks stay mapped for their whole lifetime,
+	//	mapping and unmapping per resource is expensive and not needed.
+	if (mMemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		void* mapped = nullptr;
+		if (vkMapMemory(mDevice, block.memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+		{
+			vkFreeMemory(mDevice, block.memory, nullptr);
+			throw std::runtime_error("failed to map device memory block!");
+		}
+		block.mapped = static_cast<char*>(mapped);
+	}
+
+	for (uint32_t i = 0; i < mBlocks.size(); ++i)
+	{
+		if (mBlocks[i].memory == VK_NULL_HANDLE)
+		{
+			mBlocks[i] = block;
+			return i;
+		}
+	}
+	mBlocks.push_back(block);
+	return static_cast<uint32_t>(mBlocks.size() - 1);
+}
+
+void DeviceAllocator::releaseBlock(uint32_t index)
+{
+	Block &block = mBlocks[index];
+	if (block.memory == VK_NULL_HANDLE)
+		return;
+
+	//Freeing the memory implicitly unmaps it
+	vkFreeMemory(mDevice, block.memory, nullptr);
+	block = Block();
+}
+
+DeviceAllocator::Stats DeviceAllocator::getStats() const
+{
+	Stats stats;
+	for (const auto &block : mBlocks)
+	{
+		if (block.memory == VK_NULL_HANDLE)
+			continue;
+
+		++stats.blockCount;
+		stats.allocationCount += block.allocationCount;
+		stats.bytesAllocated += block.size;
+		stats.bytesUsed += block.bytesUsed;
+		if (mMemoryProperties.memoryTypes[block.memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+		{
+			stats.bytesLazilyAllocated += block.size;
+		}
+
+		for (const auto &range : block.freeRanges)
+		{
+			++stats.freeRangeCount;
+			stats.bytesFree += range.second;
+			stats.largestFreeRange = std::max(stats.largestFreeRange, range.second);
+		}
+	}
+	return stats;
+}
+
+void DeviceAllocator::printStats() const
+{
+	Stats stats = getStats();
+	std::cout << "allocator: " << stats.allocationCount << " allocations in "
+		<< stats.blockCount << " blocks, "
+		<< stats.bytesUsed / 1024 << " / " << stats.bytesAllocated / 1024 << " KiB used, "
+		<< stats.freeRangeCount << " free ranges, fragmentation " << stats.fragmentation();
+	if (stats.bytesLazilyAllocated > 0)
+	{
+		std::cout << ", " << stats.bytesLazilyAllocated / 1024 << " KiB lazily allocated";
+	}
+	std::cout << std::endl;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+//A piece of a VkDeviceMemory block handed out by DeviceAllocator
+struct DeviceAllocation
+{
+	VkDeviceMemory	memory = VK_NULL_HANDLE;
+	VkDeviceSize	offset = 0;
+	VkDeviceSize	size = 0;
+	//Host pointer to offset, only set for HOST_VISIBLE memory
+	void*			mapped = nullptr;
+	uint32_t		block = 0;
+
+	bool isValid() const { return memory != VK_NULL_HANDLE; }
+};
+
+//Sub-allocates buffers and images from a few large VkDeviceMemory blocks.
+//
+//Drivers only guarantee maxMemoryAllocationCount (often 4096) allocations
+//	and vkAllocateMemory is slow, so one allocation per resource doesn't scale.
+//Instead the allocator grabs blocks of mBlockSize per memory type
+//	and places resources inside them at their required alignment.
+//
+//Two strategies:
+//	FreeList: long-lived resources (vertex buffers, render targets).
+//		Each block keeps its free ranges in a map sorted by offset,
+//		freeing merges a range with its neighbours again.
+//	Linear: transient per-frame data (staging, uniforms, readbacks).
+//		A bump pointer per frame in flight,
+//		beginFrame resets all of a frame's allocations at once.
+//		free only has to be called for resources destroyed before that, and never after it.
+//
+//Lazily allocated memory (tile-based GPUs) gets one block per image,
+//	its physical pages are only committed when a tile is actually written out to memory.
+//
+//bufferImageGranularity: a linear resource (buffer) and an optimal-tiling resource (image)
+//	must not share a "page" of that size inside one VkDeviceMemory.
+//Images are therefore placed at, and padded to, a multiple of the granularity,
+//	so no buffer can ever end up on one of their pages.
+class DeviceAllocator
+{
+public:
+	enum class Strategy
+	{
+		FreeList,
+		Linear
+	};
+
+	struct Stats
+	{
+		uint32_t		blockCount = 0;
+		uint32_t		allocationCount = 0;
+		//Sum of all VkDeviceMemory blocks
+		VkDeviceSize	bytesAllocated = 0;
+		//Bytes handed out to resources, including alignment padding
+		VkDeviceSize	bytesUsed = 0;
+		//Free-list blocks only
+		VkDeviceSize	bytesFree = 0;
+		VkDeviceSize	largestFreeRange = 0;
+		uint32_t		freeRangeCount = 0;
+		//Part of bytesAllocated that may never be backed by physical memory
+		VkDeviceSize	bytesLazilyAllocated = 0;
+
+		//0: all free memory is one range, close to 1: free memory is scattered in small holes
+		double fragmentation() const
+		{
+			return bytesFree == 0 ? 0.0 : 1.0 - double(largestFreeRange) / double(bytesFree);
+		}
+	};
+
+	DeviceAllocator();
+
+	//The properties of the physical device of device, see DeviceProfile
+	void create(VkDevice device, const VkPhysicalDeviceProperties &properties,
+		const VkPhysicalDeviceMemoryProperties &memoryProperties, uint32_t framesInFlight);
+
+	//All resources have to be destroyed before
+	void destroy();
+
+	//Throws if no memory type matches memoryTypeBits and properties
+	uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) const;
+	bool hasMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) const;
+
+	//isImage: optimal-tiling image, see bufferImageGranularity above
+	DeviceAllocation allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+		bool isImage, Strategy strategy = Strategy::FreeList);
+	void free(const DeviceAllocation &allocation);
+
+	//Create the resource, allocate memory for it and bind it
+	VkBuffer createBuffer(const VkBufferCreateInfo &bufferInfo, VkMemoryPropertyFlags properties,
+		DeviceAllocation &allocation, Strategy strategy = Strategy::FreeList);
+	VkImage createImage(const VkImageCreateInfo &imageInfo, VkMemoryPropertyFlags properties,
+		DeviceAllocation &allocation, Strategy strategy = Strategy::FreeList);
+	//Attachments created with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT:
+	//	lazily allocated memory where the device has it for the image, device local memory otherwise
+	VkImage createTransientImage(const VkImageCreateInfo &imageInfo, DeviceAllocation &allocation);
+	void destroyBuffer(VkBuffer buffer, const DeviceAllocation &allocation);
+	void destroyImage(VkImage image, const DeviceAllocation &allocation);
+
+	//Call after the frame's fence has signaled,
+	//	all Linear allocations made during that frame become invalid.
+	//Its dedicated Linear blocks are released, the others are reused.
+	void beginFrame(uint32_t frameIndex);
+
+	Stats getStats() const;
+	void printStats() const;
+
+private:
+	struct Block
+	{
+		VkDeviceMemory		memory = VK_NULL_HANDLE;
+		VkDeviceSize		size = 0;
+		uint32_t			memoryType = 0;
+		char*				mapped = nullptr;
+		bool				linear = false;
+		//Linear blocks: the frame they belong to and the bump pointer
+		uint32_t			frame = 0;
+		VkDeviceSize		linearOffset = 0;
+		//FreeList blocks: offset -> size of every free range
+		std::map<VkDeviceSize, VkDeviceSize>	freeRanges;
+		VkDeviceSize		bytesUsed = 0;
+		uint32_t			allocationCount = 0;
+		//Bigger than mBlockSize, released as soon as it is empty
+		bool				dedicated = false;
+	};
+
+	uint32_t allocateBlock(uint32_t memoryType, VkDeviceSize size, bool linear, uint32_t frame);
+	void releaseBlock(uint32_t index);
+
+	bool allocateFromFreeList(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset);
+	bool allocateFromLinear(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset);
+
+	//Block size used for a memory type, smaller heaps get smaller blocks
+	VkDeviceSize blockSizeFor(uint32_t memoryType) const;
+
+private:
+	VkDevice							mDevice;
+	VkPhysicalDeviceMemoryProperties	mMemoryProperties;
+	VkDeviceSize						mBufferImageGranularity;
+	VkDeviceSize						mBlockSize;
+	uint32_t							mFramesInFlight;
+	uint32_t							mCurrentFrame;
+	//Released blocks leave a hole (memory == VK_NULL_HANDLE) that is reused,
+	//	so the block index stored in allocations stays valid.
+	std::vector<Block>					mBlocks;
+};
@@ -0,0 +1,210 @@
+#include "DeviceProfile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+//The Vulkan structs are written as they are in memory,
+//	the sizes in the header reject files from builds where they differ.
+struct DeviceProfileHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	propertiesSize;
+	uint32_t	featuresSize;
+	uint32_t	memoryPropertiesSize;
+	uint32_t	queueFamilySize;
+};
+
+static const uint32_t PROFILE_MAGIC = 0x50444c56;	//"VLDP"
+static const uint32_t PROFILE_VERSION = 1;
+
+static DeviceProfileHeader currentHeader()
+{
+	DeviceProfileHeader header;
+	header.magic = PROFILE_MAGIC;
+	header.version = PROFILE_VERSION;
+	header.propertiesSize = sizeof(VkPhysicalDeviceProperties);
+	header.featuresSize = sizeof(VkPhysicalDeviceFeatures);
+	header.memoryPropertiesSize = sizeof(VkPhysicalDeviceMemoryProperties);
+	header.queueFamilySize = sizeof(VkQueueFamilyProperties);
+	return header;
+}
+
+DeviceProfile DeviceProfile::query(VkPhysicalDevice physicalDevice, PFN_vkGetPhysicalDeviceProperties2KHR getProperties2)
+{
+	DeviceProfile profile;
+	profile.physicalDevice = physicalDevice;
+	identify(physicalDevice, getProperties2, profile.properties, profile.deviceUUID);
+	vkGetPhysicalDeviceFeatures(physicalDevice, &profile.features);
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &profile.memoryProperties);
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	profile.queueFamilies.resize(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, profile.queueFamilies.data());
+
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+	for (const auto &extension : extensions)
+	{
+		profile.extensions.insert(extension.extensionName);
+	}
+	return profile;
+}
+
+void DeviceProfile::identify(VkPhysicalDevice physicalDevice, PFN_vkGetPhysicalDeviceProperties2KHR getProperties2,
+	VkPhysicalDeviceProperties &properties, uint8_t deviceUUID[VK_UUID_SIZE])
+{
+	std::memset(deviceUUID, 0, VK_UUID_SIZE);
+	if (getProperties2 == nullptr)
+	{
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		return;
+	}
+
+	//The UUID is the same for the device in every process and API, unlike the handle
+	VkPhysicalDeviceIDProperties idProperties = {};
+	idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+	VkPhysicalDeviceProperties2 properties2 = {};
+	properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties2.pNext = &idProperties;
+	getProperties2(physicalDevice, &properties2);
+
+	properties = properties2.properties;
+	std::memcpy(deviceUUID, idProperties.deviceUUID, VK_UUID_SIZE);
+}
+
+void DeviceProfile::querySurface(VkSurfaceKHR surface)
+{
+	presentSupport.assign(queueFamilies.size(), false);
+	for (uint32_t i = 0; i < queueFamilies.size(); ++i)
+	{
+		VkBool32 supported = VK_FALSE;
+		vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &supported);
+		presentSupport[i] = supported == VK_TRUE;
+	}
+
+	/*querying the supported surface formats*/
+	uint32_t formatCount = 0;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, nullptr);
+	surfaceFormats.resize(formatCount);
+	if (formatCount != 0)
+	{
+		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, surfaceFormats.data());
+	}
+
+	uint32_t presentModeCount = 0;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, nullptr);
+	presentModes.resize(presentModeCount);
+	if (presentModeCount != 0)
+	{
+		vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, presentModes.data());
+	}
+}
+
+std::string DeviceProfile::key(const VkPhysicalDeviceProperties &properties, const uint8_t deviceUUID[VK_UUID_SIZE])
+{
+	//pipelineCacheUUID changes with every driver build even if driverVersion doesn't
+	char ids[64];
+	snprintf(ids, sizeof(ids), "%08x:%08x:%08x:", properties.vendorID, properties.deviceID, properties.driverVersion);
+
+	return ids + uuidString(deviceUUID) + ":" + uuidString(properties.pipelineCacheUUID);
+}
+
+std::string DeviceProfile::uuidString(const uint8_t uuid[VK_UUID_SIZE])
+{
+	std::string result;
+	char byte[3];
+	for (uint32_t i = 0; i < VK_UUID_SIZE; ++i)
+	{
+		snprintf(byte, sizeof(byte), "%02x", uuid[i]);
+		result += byte;
+	}
+	return result;
+}
+
+void DeviceProfile::save(const std::string &path) const
+{
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		DeviceProfileHeader header = currentHeader();
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(&properties), sizeof(properties));
+		file.write(reinterpret_cast<const char*>(deviceUUID), VK_UUID_SIZE);
+		file.write(reinterpret_cast<const char*>(&features), sizeof(features));
+		file.write(reinterpret_cast<const char*>(&memoryProperties), sizeof(memoryProperties));
+
+		uint32_t count = static_cast<uint32_t>(queueFamilies.size());
+		file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		file.write(reinterpret_cast<const char*>(queueFamilies.data()), count * sizeof(VkQueueFamilyProperties));
+
+		//Extension names as zero terminated strings
+		count = static_cast<uint32_t>(extensions.size());
+		file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		for (const auto &extension : extensions)
+		{
+			file.write(extension.c_str(), extension.size() + 1);
+		}
+
+		if (!file)
+		{
+			std::cerr << "device profile: failed to write " << tempPath << std::endl;
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	if (error)
+	{
+		std::cerr << "device profile: failed to replace " << path << ": " << error.message() << std::endl;
+		std::filesystem::remove(tempPath, error);
+	}
+}
+
+bool DeviceProfile::load(const std::string &path, DeviceProfile &profile)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	DeviceProfileHeader header;
+	DeviceProfileHeader expected = currentHeader();
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(&header, &expected, sizeof(header)) != 0)
+	{
+		std::cout << "device profile: ignoring " << path << ", it was written by another build" << std::endl;
+		return false;
+	}
+
+	DeviceProfile loaded;
+	file.read(reinterpret_cast<char*>(&loaded.properties), sizeof(loaded.properties));
+	file.read(reinterpret_cast<char*>(loaded.deviceUUID), VK_UUID_SIZE);
+	file.read(reinterpret_cast<char*>(&loaded.features), sizeof(loaded.features));
+	file.read(reinterpret_cast<char*>(&loaded.memoryProperties), sizeof(loaded.memoryProperties));
+
+	uint32_t count = 0;
+	file.read(reinterpret_cast<char*>(&count), sizeof(count));
+	if (!file || count > 256)
+		return false;
+	loaded.queueFamilies.resize(count);
+	file.read(reinterpret_cast<char*>(loaded.queueFamilies.data()), count * sizeof(VkQueueFamilyProperties));
+
+	file.read(reinterpret_cast<char*>(&count), sizeof(count));
+	for (uint32_t i = 0; i < count && file; ++i)
+	{
+		std::string extension;
+		std::getline(file, extension, '\0');
+		loaded.extensions.insert(extension);
+	}
+	if (!file)
+		return false;
+
+	profile = loaded;
+	return true;
+}
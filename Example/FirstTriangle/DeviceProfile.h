@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+//Everything the application asks about a physical device, queried once.
+//
+//Properties, features, memory types, queue families and extensions
+//	don't change while the instance exists,
+//	so device selection, device creation, the swap chain and the command pools
+//	all read them from here instead of asking the driver again.
+//
+//The surface dependent part (presentation support, formats, present modes)
+//	is queried separately with querySurface and never saved.
+//Surface capabilities are not kept at all, currentExtent follows the window size.
+//
+//save and load persist the profile of the device that was picked,
+//	keyed by device UUID, IDs and driver version (see key),
+//	so the next start can go straight to that device
+//	instead of profiling every device in the system.
+struct DeviceProfile
+{
+	VkPhysicalDevice						physicalDevice = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties				properties = {};
+	//All zero when the instance has no VK_KHR_get_physical_device_properties2
+	uint8_t									deviceUUID[VK_UUID_SIZE] = {};
+	VkPhysicalDeviceFeatures				features = {};
+	VkPhysicalDeviceMemoryProperties		memoryProperties = {};
+	std::vector<VkQueueFamilyProperties>	queueFamilies;
+	std::set<std::string>					extensions;
+
+	//Filled by querySurface, one entry per queue family
+	std::vector<bool>						presentSupport;
+	std::vector<VkSurfaceFormatKHR>			surfaceFormats;
+	std::vector<VkPresentModeKHR>			presentModes;
+
+	//getProperties2 may be nullptr, deviceUUID then stays zero
+	static DeviceProfile query(VkPhysicalDevice physicalDevice, PFN_vkGetPhysicalDeviceProperties2KHR getProperties2);
+
+	//Only the properties and the UUID, enough to compute the key of a device
+	static void identify(VkPhysicalDevice physicalDevice, PFN_vkGetPhysicalDeviceProperties2KHR getProperties2,
+		VkPhysicalDeviceProperties &properties, uint8_t deviceUUID[VK_UUID_SIZE]);
+
+	void querySurface(VkSurfaceKHR surface);
+
+	bool hasExtension(const char* name) const { return extensions.count(name) != 0; }
+
+	//Identifies the device and the driver build:
+	//	a saved profile is only used for a device with the same key,
+	//	a driver update can change features and limits.
+	static std::string key(const VkPhysicalDeviceProperties &properties, const uint8_t deviceUUID[VK_UUID_SIZE]);
+	std::string key() const { return key(properties, deviceUUID); }
+
+	//32 lower case hex digits, without dashes
+	static std::string uuidString(const uint8_t uuid[VK_UUID_SIZE]);
+
+	//Everything but the surface part, written to a temporary file and renamed like the pipeline cache
+	void save(const std::string &path) const;
+
+	//false if there is no profile at path or it was written by another version of this struct
+	static bool load(const std::string &path, DeviceProfile &profile);
+};
@@ -1,10 +1,11 @@
 #include "HelloTriangleApplication.h"
 
-int main()
+int main(int argc, char** argv)
 {
-	HelloTriangleApplication app;
+	//Inside the try: the members join their threads while the exception unwinds
 	try
 	{
+		HelloTriangleApplication app(ApplicationSettings::fromCommandLine(argc, argv));
 		app.run();
 	}
 	catch (const std::exception& e)
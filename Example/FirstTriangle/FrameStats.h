@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+
+//Accumulates frame timings and prints a summary roughly once per second.
+//
+//cpu wait is the time the host spent blocked in vkWaitForFences
+//	before it could start on the next frame.
+//When the CPU and GPU overlap properly this should stay close to zero
+//	unless the GPU is the bottleneck.
+//
+//gpu is the time between the first and last timestamp of a frame,
+//	only reported while the GpuProfiler is enabled.
+class FrameStats
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	FrameStats()
+		: mFrameCount(0)
+		, mCpuWaitMs(0.0)
+		, mGpuFrameCount(0)
+		, mGpuMs(0.0)
+		, mLastReport(Clock::now())
+	{
+	}
+
+	void addCpuWait(Clock::time_point waitStart)
+	{
+		mCpuWaitMs += std::chrono::duration<double, std::milli>(Clock::now() - waitStart).count();
+	}
+
+	void addGpuTime(double ms)
+	{
+		++mGpuFrameCount;
+		mGpuMs += ms;
+	}
+
+	void endFrame()
+	{
+		++mFrameCount;
+
+		Clock::time_point now = Clock::now();
+		double elapsed = std::chrono::duration<double>(now - mLastReport).count();
+		if (elapsed < 1.0)
+			return;
+
+		std::cout << "fps: " << mFrameCount / elapsed
+			<< "\tframe: " << elapsed * 1000.0 / mFrameCount << " ms"
+			<< "\tcpu wait/frame: " << mCpuWaitMs / mFrameCount << " ms";
+		if (mGpuFrameCount > 0)
+		{
+			std::cout << "\tgpu/frame: " << mGpuMs / mGpuFrameCount << " ms";
+		}
+		std::cout << std::endl;
+
+		mFrameCount = 0;
+		mCpuWaitMs = 0.0;
+		mGpuFrameCount = 0;
+		mGpuMs = 0.0;
+		mLastReport = now;
+	}
+
+private:
+	uint64_t			mFrameCount;
+	double				mCpuWaitMs;
+	uint64_t			mGpuFrameCount;
+	double				mGpuMs;
+	Clock::time_point	mLastReport;
+};
@@ -0,0 +1,220 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+//Two queries per scope
+const uint32_t MAX_QUERIES_PER_FRAME = 64;
+
+//Keep the trace of long runs from growing without bound
+const size_t MAX_TRACE_EVENTS = 1000000;
+
+GpuProfiler::GpuProfiler()
+	: mDevice(VK_NULL_HANDLE)
+	, mEnabled(false)
+	, mTimestampPeriod(1.0f)
+	, mTimestampMask(0)
+{
+}
+
+void GpuProfiler::create(VkDevice device, const VkPhysicalDeviceProperties &properties, uint32_t timestampValidBits, uint32_t framesInFlight)
+{
+	mDevice = device;
+	mEnabled = true;
+	mEpoch = Clock::now();
+	mTimestampPeriod = properties.limits.timestampPeriod;
+	mTimestampMask = timestampValidBits >= 64 ? ~0ull : ((1ull << timestampValidBits) - 1);
+
+	if (timestampValidBits == 0)
+	{
+		std::cout << "profiler: the graphics queue doesn't support timestamps, recording CPU scopes only" << std::endl;
+		return;
+	}
+
+	mFrames.resize(framesInFlight);
+	for (auto &frame : mFrames)
+	{
+		VkQueryPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = MAX_QUERIES_PER_FRAME;
+
+		if (vkCreateQueryPool(mDevice, &poolInfo, nullptr, &frame.pool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create timestamp query pool!");
+		}
+		frame.nextQuery = 0;
+		frame.pending = false;
+	}
+}
+
+void GpuProfiler::destroy()
+{
+	for (auto &frame : mFrames)
+	{
+		vkDestroyQueryPool(mDevice, frame.pool, nullptr);
+	}
+	mFrames.clear();
+	mEnabled = false;
+}
+
+void GpuProfiler::resetQueries(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+	if (frameIndex >= mFrames.size())
+		return;
+
+	//Queries have to be reset before they are written again.
+	//This can't happen inside a render pass.
+	vkCmdResetQueryPool(commandBuffer, mFrames[frameIndex].pool, 0, MAX_QUERIES_PER_FRAME);
+}
+
+void GpuProfiler::beginGpuScope(VkCommandBuffer commandBuffer, uint32_t frameIndex, const std::string &name)
+{
+	if (frameIndex >= mFrames.size())
+		return;
+
+	GpuScope* scope = findOrAddScope(mFrames[frameIndex], name);
+	if (scope != nullptr)
+	{
+		//TOP_OF_PIPE: the timestamp is written as soon as all previous commands have started
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, mFrames[frameIndex].pool, scope->beginQuery);
+	}
+}
+
+void GpuProfiler::endGpuScope(VkCommandBuffer commandBuffer, uint32_t frameIndex, const std::string &name)
+{
+	if (frameIndex >= mFrames.size())
+		return;
+
+	GpuScope* scope = findOrAddScope(mFrames[frameIndex], name);
+	if (scope != nullptr)
+	{
+		//BOTTOM_OF_PIPE: written once all previous commands have completely finished
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, mFrames[frameIndex].pool, scope->endQuery);
+	}
+}
+
+GpuProfiler::GpuScope* GpuProfiler::findOrAddScope(FrameQueries &frame, const std::string &name)
+{
+	for (auto &scope : frame.scopes)
+	{
+		if (scope.name == name)
+			return &scope;
+	}
+
+	if (frame.nextQuery + 2 > MAX_QUERIES_PER_FRAME)
+	{
+		std::cerr << "profiler: too many GPU scopes, ignoring " << name << std::endl;
+		return nullptr;
+	}
+
+	GpuScope scope;
+	scope.name = name;
+	scope.beginQuery = frame.nextQuery++;
+	scope.endQuery = frame.nextQuery++;
+	frame.scopes.push_back(scope);
+	return &frame.scopes.back();
+}
+
+void GpuProfiler::frameSubmitted(uint32_t frameIndex)
+{
+	if (frameIndex >= mFrames.size())
+		return;
+
+	mFrames[frameIndex].pending = !mFrames[frameIndex].scopes.empty();
+	mFrames[frameIndex].submitTime = Clock::now();
+}
+
+double GpuProfiler::collect(uint32_t frameIndex)
+{
+	if (frameIndex >= mFrames.size() || !mFrames[frameIndex].pending)
+		return -1.0;
+
+	FrameQueries &frame = mFrames[frameIndex];
+	frame.pending = false;
+
+	//The frame's fence has signaled, so all results are available
+	//	and no VK_QUERY_RESULT_WAIT_BIT is needed.
+	std::vector<uint64_t> timestamps(frame.nextQuery);
+	VkResult result = vkGetQueryPoolResults(mDevice, frame.pool, 0, frame.nextQuery,
+		timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT);
+	if (result != VK_SUCCESS)
+		return -1.0;
+
+	uint64_t first = ~0ull;
+	uint64_t last = 0;
+	for (auto &timestamp : timestamps)
+	{
+		timestamp &= mTimestampMask;
+		first = std::min(first, timestamp);
+		last = std::max(last, timestamp);
+	}
+
+	//timestampPeriod is the number of nanoseconds per tick
+	double frameStartUs = toMicroseconds(frame.submitTime);
+	for (const auto &scope : frame.scopes)
+	{
+		double startUs = (timestamps[scope.beginQuery] - first) * mTimestampPeriod / 1000.0;
+		double endUs = (timestamps[scope.endQuery] - first) * mTimestampPeriod / 1000.0;
+		addEvent(scope.name, 1, frameStartUs + startUs, endUs - startUs);
+	}
+
+	return (last - first) * mTimestampPeriod / 1000000.0;
+}
+
+void GpuProfiler::addCpuEvent(const char* name, Clock::time_point start, Clock::time_point end)
+{
+	//Callers may time unconditionally, nothing is kept unless --profile is set
+	if (!mEnabled)
+		return;
+
+	double startUs = toMicroseconds(start);
+	addEvent(name, 0, startUs, toMicroseconds(end) - startUs);
+}
+
+double GpuProfiler::toMicroseconds(Clock::time_point time) const
+{
+	return std::chrono::duration<double, std::micro>(time - mEpoch).count();
+}
+
+void GpuProfiler::addEvent(const std::string &name, int track, double startUs, double durationUs)
+{
+	if (mEvents.size() >= MAX_TRACE_EVENTS)
+		return;
+
+	Event event;
+	event.name = name;
+	event.track = track;
+	event.startUs = startUs;
+	event.durationUs = durationUs;
+	mEvents.push_back(event);
+}
+
+void GpuProfiler::exportChromeTrace(const std::string &path) const
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cerr << "profiler: failed to open " << path << std::endl;
+		return;
+	}
+
+	//Trace Event Format: complete events ("ph":"X") with start and duration in microseconds,
+	//	one thread per timeline.
+	file << std::fixed << std::setprecision(3);
+	file << "{\"traceEvents\":[\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+	for (const auto &event : mEvents)
+	{
+		file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.track + 1
+			<< ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs << "}";
+	}
+	file << "\n]}\n";
+
+	std::cout << "profiler: wrote " << mEvents.size() << " events to " << path << std::endl;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+//Measures where the time of a frame goes, on the GPU and on the CPU.
+//
+//GPU scopes are pairs of vkCmdWriteTimestamp written into a VkQueryPool.
+//There is one pool per frame in flight:
+//	the results of a pool are read back after drawFrame waited for that frame's fence,
+//	so vkGetQueryPoolResults never has to wait for the GPU.
+//A scope is identified by its name, recording the same name again
+//	(e.g. into the command buffer of another swap chain image) reuses its queries.
+//
+//CPU scopes are plain std::chrono measurements.
+//
+//Both end up in a Chrome trace (chrome://tracing, ui.perfetto.dev) written by exportChromeTrace.
+//Timestamps from the GPU use their own clock,
+//	each GPU frame is placed on the CPU timeline at the moment it was submitted.
+class GpuProfiler
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	GpuProfiler();
+
+	//timestampValidBits of the queue family the command buffers are submitted to,
+	//	0 means the queue can't write timestamps and only CPU scopes are recorded.
+	void create(VkDevice device, const VkPhysicalDeviceProperties &properties, uint32_t timestampValidBits, uint32_t framesInFlight);
+	void destroy();
+
+	bool isEnabled() const { return mEnabled; }
+
+	//Has to be recorded outside of a render pass before any scope of the frame
+	void resetQueries(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+	void beginGpuScope(VkCommandBuffer commandBuffer, uint32_t frameIndex, const std::string &name);
+	void endGpuScope(VkCommandBuffer commandBuffer, uint32_t frameIndex, const std::string &name);
+
+	//Call right after the frame's command buffer was submitted
+	void frameSubmitted(uint32_t frameIndex);
+
+	//Reads the timestamps of the frame that last used this slot.
+	//The caller must have waited for that frame's fence.
+	//Returns the GPU time between the first and last timestamp in ms,
+	//	or a negative value if there was nothing to read.
+	double collect(uint32_t frameIndex);
+
+	//Ignored while the profiler is disabled
+	void addCpuEvent(const char* name, Clock::time_point start, Clock::time_point end);
+
+	void exportChromeTrace(const std::string &path) const;
+
+	//Records the lifetime of the object as a CPU event
+	class CpuScope
+	{
+	public:
+		CpuScope(GpuProfiler &profiler, const char* name)
+			: mProfiler(profiler)
+			, mName(name)
+		{
+			if (mProfiler.isEnabled())
+				mStart = Clock::now();
+		}
+
+		~CpuScope()
+		{
+			if (mProfiler.isEnabled())
+				mProfiler.addCpuEvent(mName, mStart, Clock::now());
+		}
+
+	private:
+		GpuProfiler&		mProfiler;
+		const char*			mName;
+		Clock::time_point	mStart;
+	};
+
+private:
+	struct GpuScope
+	{
+		std::string		name;
+		uint32_t		beginQuery;
+		uint32_t		endQuery;
+	};
+
+	struct FrameQueries
+	{
+		VkQueryPool				pool;
+		std::vector<GpuScope>	scopes;
+		uint32_t				nextQuery;
+		bool					pending;
+		Clock::time_point		submitTime;
+	};
+
+	struct Event
+	{
+		std::string		name;
+		int				track;		//0 = CPU, 1 = GPU
+		double			startUs;
+		double			durationUs;
+	};
+
+	GpuScope* findOrAddScope(FrameQueries &frame, const std::string &name);
+
+	double toMicroseconds(Clock::time_point time) const;
+
+	void addEvent(const std::string &name, int track, double startUs, double durationUs);
+
+private:
+	VkDevice					mDevice;
+	bool						mEnabled;
+	float						mTimestampPeriod;	//nanoseconds per tick
+	uint64_t					mTimestampMask;
+	std::vector<FrameQueries>	mFrames;
+	Clock::time_point			mEpoch;
+	std::vector<Event>			mEvents;
+};
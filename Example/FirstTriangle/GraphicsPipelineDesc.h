@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+
+//Everything that identifies a graphics pipeline, as a plain value.
+//
+//Two materials with equal descriptions can use the same VkPipeline,
+//	PipelineRegistry uses the hash and operator== to find it.
+//Viewport and scissor are always dynamic state, so they are not part of the description.
+//Vertex input and the pipeline layout are reflected from the shaders.
+struct GraphicsPipelineDesc
+{
+	//Shader sources as listed in the ShaderManifest, e.g. "VertexShader.vert"
+	std::string				vertexShader;
+	std::string				fragmentShader;
+
+	VkPrimitiveTopology		topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPolygonMode			polygonMode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags			cullMode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace				frontFace = VK_FRONT_FACE_CLOCKWISE;
+	VkSampleCountFlagBits	samples = VK_SAMPLE_COUNT_1_BIT;
+
+	bool					depthTest = false;
+	bool					depthWrite = false;
+	VkCompareOp				depthCompareOp = VK_COMPARE_OP_LESS;
+
+	//Blending of the single color attachment
+	bool					blendEnable = false;
+	VkBlendFactor			srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	VkBlendFactor			dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+	VkBlendOp				colorBlendOp = VK_BLEND_OP_ADD;
+	VkBlendFactor			srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	VkBlendFactor			dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	VkBlendOp				alphaBlendOp = VK_BLEND_OP_ADD;
+
+	VkRenderPass			renderPass = VK_NULL_HANDLE;
+	uint32_t				subpass = 0;
+
+	//FNV-1a 64 over the fields one by one,
+	//	so padding bytes and the string buffers' addresses never change the result.
+	uint64_t hash() const
+	{
+		uint64_t h = familyHash();
+		add(h, polygonMode);
+		add(h, cullMode);
+		add(h, frontFace);
+		add(h, blendEnable);
+		add(h, srcColorBlendFactor);
+		add(h, dstColorBlendFactor);
+		add(h, colorBlendOp);
+		add(h, srcAlphaBlendFactor);
+		add(h, dstAlphaBlendFactor);
+		add(h, alphaBlendOp);
+		return h;
+	}
+
+	//Hash of everything but the rasterizer and blend state.
+	//Descriptions with the same family hash are variants of one material,
+	//	PipelineRegistry creates them as derivatives of a common parent pipeline.
+	uint64_t familyHash() const
+	{
+		uint64_t h = 0xcbf29ce484222325ull;
+		addString(h, vertexShader);
+		addString(h, fragmentShader);
+		add(h, topology);
+		add(h, samples);
+		add(h, depthTest);
+		add(h, depthWrite);
+		add(h, depthCompareOp);
+		add(h, reinterpret_cast<uint64_t>(renderPass));
+		add(h, subpass);
+		return h;
+	}
+
+	bool operator==(const GraphicsPipelineDesc &other) const
+	{
+		return vertexShader == other.vertexShader
+			&& fragmentShader == other.fragmentShader
+			&& topology == other.topology
+			&& polygonMode == other.polygonMode
+			&& cullMode == other.cullMode
+			&& frontFace == other.frontFace
+			&& samples == other.samples
+			&& depthTest == other.depthTest
+			&& depthWrite == other.depthWrite
+			&& depthCompareOp == other.depthCompareOp
+			&& blendEnable == other.blendEnable
+			&& srcColorBlendFactor == other.srcColorBlendFactor
+			&& dstColorBlendFactor == other.dstColorBlendFactor
+			&& colorBlendOp == other.colorBlendOp
+			&& srcAlphaBlendFactor == other.srcAlphaBlendFactor
+			&& dstAlphaBlendFactor == other.dstAlphaBlendFactor
+			&& alphaBlendOp == other.alphaBlendOp
+			&& renderPass == other.renderPass
+			&& subpass == other.subpass;
+	}
+
+	bool operator!=(const GraphicsPipelineDesc &other) const
+	{
+		return !(*this == other);
+	}
+
+private:
+	static void add(uint64_t &h, uint64_t value)
+	{
+		for (int i = 0; i < 8; ++i)
+		{
+			h ^= (value >> (i * 8)) & 0xff;
+			h *= 0x100000001b3ull;
+		}
+	}
+
+	static void addString(uint64_t &h, const std::string &value)
+	{
+		add(h, value.size());
+		for (char c : value)
+			add(h, static_cast<unsigned char>(c));
+	}
+};
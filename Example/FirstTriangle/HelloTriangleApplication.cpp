@@ -3,21 +3,38 @@
 #include <set>
 #include <limits>
 #include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <chrono>
 #include "HelloTriangleApplication.h"
 #include "ReadFile.h"
 
 const int WIDTH = 800;
 const int HEIGHT = 600;
 
-const std::vector<const char*> validationLayers = {"VK_LAYER_LUNARG_standard_validation"};
+//How many frames the CPU is allowed to record and submit
+//	before it has to wait for the GPU to catch up.
+//2 lets the CPU work on one frame while the GPU renders the previous one,
+//	higher values add latency without adding much throughput.
+const int MAX_FRAMES_IN_FLIGHT = 2;
 
-const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+//The mesh that is drawn, uploaded to the GPU in createVertexBuffers
+const std::vector<Vertex> vertices = {
+	{ { 0.0f, -0.5f }, { 1.0f, 0.0f, 0.0f } },
+	{ { 0.5f, 0.5f }, { 0.0f, 1.0f, 0.0f } },
+	{ { -0.5f, 0.5f }, { 0.0f, 0.0f, 1.0f } }
+};
 
-#ifdef NODEBUG
-	const bool enableValidationLayers = false;
-#else
-	const bool enableValidationLayers = true;
-#endif
+const std::vector<uint16_t> indices = { 0, 1, 2 };
+
+//Big enough for the whole mesh, so it is uploaded with one submission
+const VkDeviceSize UPLOAD_RING_SIZE = 8 * 1024 * 1024;
+
+//Preferred first: VK_LAYER_KHRONOS_validation replaced the VK_LAYER_LUNARG_standard_validation
+//	meta layer in SDK 1.1.106, older SDKs only have the latter.
+const char* const validationLayerCandidates[] = { "VK_LAYER_KHRONOS_validation", "VK_LAYER_LUNARG_standard_validation" };
+
+const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
 #undef max
 #undef min
@@ -57,19 +74,37 @@ const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_N
 //This is normally only used to test 
 //the validation layers themselves, 
 //so you should always return VK_FALSE.
+
+//The callback runs on the thread of the Vulkan call that triggered it,
+//	so it only hands the message to the DebugMessageLog in pUserData
+//	instead of writing it out here.
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 	VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
 	VkDebugUtilsMessageTypeFlagsEXT messageType,
 	const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
 	void* pUserData) 
 {
-	std::cout << "validation layer: " << pCallbackData->pMessage << std::endl;
+	static_cast<DebugMessageLog*>(pUserData)->push(messageSeverity, messageType, pCallbackData);
 	return VK_FALSE;
 }
 
+HelloTriangleApplication::HelloTriangleApplication(const ApplicationSettings &settings)
+	: mSettings(settings)
+	, mWindow(nullptr)
+	, mSurface(VK_NULL_HANDLE)
+	, mCallback(VK_NULL_HANDLE)
+	, mSwapChain(VK_NULL_HANDLE)
+	, mRecordMode(settings.recordMode)
+{
+}
+
 void HelloTriangleApplication::run()
 {
-	initWindow();
+	if (!mSettings.headless)
+	{
+		initWindow();
+	}
+	mStartupTimer.phase("window");
 	initVulkan();
 	mainLoop();
 	cleanUp();
@@ -79,25 +114,61 @@ void HelloTriangleApplication::initWindow()
 {
 	glfwInit();
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 	mWindow = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+	glfwSetWindowUserPointer(mWindow, this);
+	glfwSetFramebufferSizeCallback(mWindow, frameBufferResizeCallback);
+}
+
+void HelloTriangleApplication::frameBufferResizeCallback(GLFWwindow* window, int width, int height)
+{
+	auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+	app->mFrameBufferResized = true;
 }
 
 void HelloTriangleApplication::initVulkan()
 {
 	createInstance();
 	setupDebugCallback();
-	CreateSurface();
+	mStartupTimer.phase("instance");
+	if (!mSettings.headless)
+	{
+		CreateSurface();
+	}
+	mStartupTimer.phase("surface");
 	pickPhysicalDevice();
+	mStartupTimer.phase("physical device");
 	createLogicalDevice();
-	createSwapChain();
+	mAllocator.create(mDevice, mDeviceProfile.properties, mDeviceProfile.memoryProperties, MAX_FRAMES_IN_FLIGHT);
+	mStartupTimer.phase("logical device");
+	if (mSettings.headless)
+	{
+		createOffscreenTargets();
+	}
+	else
+	{
+		createSwapChain();
+	}
 	createImageViews();
-	createRenderPass();
+	createRenderGraph();
+	mStartupTimer.phase("swap chain");
+	mShaders.load(mSettings.shaderDir);
+	mLayouts.create(mDevice);
+	createPipelineCache();
 	createGraphicsPipeline();
-	createFrameBuffers();
+	createShaderWatcher();
+	mStartupTimer.phase("pipelines");
+	createRenderTargets();
 	createCommandPool();
+	createVertexBuffers();
+	createObjectDescriptorSet();
+	createCulling();
+	createProfiler();
 	createCommandBuffer();
-	createSemaphore();
+	createFrameCommandBuffers();
+	createSyncObjects();
+	mStartupTimer.phase("resources");
+	mAllocator.printStats();
+	mStartupTimer.print();
 }
 
 void HelloTriangleApplication::createInstance()
@@ -117,15 +188,88 @@ void HelloTriangleApplication::createInstance()
 	//uint32_t glfwExtensionCount = 0;
 	//const char** glfwExtensions;
 	//glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	//Common operation in Validation Layer
+	//Checking the values of parameters against the specification to detect misuse
+	//Tracking creation and destruction of objects to find resource leaks
+	//Checking thread safety by tracking the threads that calls originate from
+	//Logging every call and its parameters to the standard output
+	//Tracing Vulkan calls for profiling and replaying
+	//
+	//Chosen at runtime (--validation), so the same binary can run with or without them.
+	mValidationLayer = nullptr;
+	mBestPractices = false;
+	if (mSettings.validationMode != ApplicationSettings::ValidationMode::Off)
+	{
+		mValidationLayer = findValidationLayer();
+		if (mValidationLayer == nullptr)
+		{
+			std::cerr << "validation layers requested, but not available, running without them" << std::endl;
+		}
+	}
+
 	auto instanceExtensions = getRequiredExtensions();
+
+	//The performance warnings of the Khronos layer are part of its best practices checks,
+	//	which have to be enabled through VK_EXT_validation_features (provided by the layer itself).
+	VkValidationFeatureEnableEXT bestPractices = VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT;
+	VkValidationFeaturesEXT validationFeatures = {};
+	if (mValidationLayer != nullptr && mSettings.validationMode == ApplicationSettings::ValidationMode::Performance)
+	{
+		uint32_t layerExtensionCount = 0;
+		vkEnumerateInstanceExtensionProperties(mValidationLayer, &layerExtensionCount, nullptr);
+		std::vector<VkExtensionProperties> layerExtensions(layerExtensionCount);
+		vkEnumerateInstanceExtensionProperties(mValidationLayer, &layerExtensionCount, layerExtensions.data());
+		for (const auto &extension : layerExtensions)
+		{
+			if (strcmp(extension.extensionName, VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME) == 0)
+			{
+				mBestPractices = true;
+			}
+		}
+
+		if (mBestPractices)
+		{
+			instanceExtensions.push_back(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+			validationFeatures.sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT;
+			validationFeatures.enabledValidationFeatureCount = 1;
+			validationFeatures.pEnabledValidationFeatures = &bestPractices;
+		}
+		else
+		{
+			std::cerr << mValidationLayer << " has no best practices checks, few performance warnings will be reported" << std::endl;
+		}
+	}
+
 	createInfo.enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size());
 	createInfo.ppEnabledExtensionNames = instanceExtensions.data();
-	createInfo.enabledLayerCount = 0;
+	createInfo.enabledLayerCount = mValidationLayer != nullptr ? 1 : 0;
+	createInfo.ppEnabledLayerNames = &mValidationLayer;
+
+	//The messenger created in setupDebugCallback needs an instance,
+	//	one chained here also reports what happens in vkCreateInstance and vkDestroyInstance.
+	VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = {};
+	if (mValidationLayer != nullptr)
+	{
+		mDebugLog.create(mSettings.validationLogPath);
+		fillDebugMessengerCreateInfo(debugCreateInfo);
+		debugCreateInfo.pNext = mBestPractices ? &validationFeatures : nullptr;
+		createInfo.pNext = &debugCreateInfo;
+	}
 
 	if (vkCreateInstance(&createInfo, nullptr, &mInstance) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create instance!");
 	}
 
+	//Only if getRequiredExtensions found the extension, the device UUID needs it
+	mGetProperties2 = nullptr;
+	for (const char* extension : instanceExtensions)
+	{
+		if (strcmp(extension, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+		{
+			mGetProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(mInstance, "vkGetPhysicalDeviceProperties2KHR");
+		}
+	}
+
 	uint32_t extensionCount = 0;
 	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
 	std::vector<VkExtensionProperties> extensions(extensionCount);
@@ -137,15 +281,9 @@ void HelloTriangleApplication::createInstance()
 		std::cout << "\t" << extension.extensionName << std::endl;
 	}
 
-	//Common operation in Validation Layer
-	//Checking the values of parameters against the specification to detect misuse
-	//Tracking creation and destruction of objects to find resource leaks
-	//Checking thread safety by tracking the threads that calls originate from
-	//Logging every call and its parameters to the standard output
-	//Tracing Vulkan calls for profiling and replaying
-	if (enableValidationLayers && !checkValidationLayerSupport())
+	if (mValidationLayer != nullptr)
 	{
-		throw std::runtime_error("validation layers requested,but not available!");
+		std::cout << "validation: " << mValidationLayer << (mBestPractices ? " with best practices" : "") << std::endl;
 	}
 }
 
@@ -155,6 +293,7 @@ void HelloTriangleApplication::CreateSurface()
 	//right after the instance creation, 
 	//because it can actually influence 
 	//the physical device selection.
+#ifdef _WIN32
 	VkWin32SurfaceCreateInfoKHR surfaceCreateInfo = {};
 	surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
 	surfaceCreateInfo.hwnd = glfwGetWin32Window(mWindow);
@@ -165,47 +304,241 @@ void HelloTriangleApplication::CreateSurface()
 	{
 		throw std::runtime_error("failed to create window surface!");
 	}
+#else
+	//Other platforms: let GLFW pick the right surface extension (xcb, xlib, wayland...)
+	if (glfwCreateWindowSurface(mInstance, mWindow, nullptr, &mSurface) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create window surface!");
+	}
+#endif
 }
 
 
 void HelloTriangleApplication::mainLoop()
 {
-	while(!glfwWindowShouldClose(mWindow))
+	if (mSettings.benchmarkPipelines)
+	{
+		runPipelineBenchmark();
+	}
+	else if (mSettings.benchmarkRecord)
+	{
+		runRecordBenchmark();
+	}
+	else
+	{
+		runFrames(mSettings.frameCount);
+	}
+
+	//drawFrame is asynchronous, 
+	//	wait for the last frames to finish before cleanUp destroys what they use.
+	vkDeviceWaitIdle(mDevice);
+	destroyRetiredSwapChains(true);
+}
+
+bool HelloTriangleApplication::runFrames(uint64_t count)
+{
+	uint64_t frame = 0;
+	while(mSettings.headless || !glfwWindowShouldClose(mWindow))
 	{
-		glfwPollEvents();
+		if (!mSettings.headless)
+		{
+			glfwPollEvents();
+		}
 		drawFrame();
+
+		if (count != 0 && ++frame >= count)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void HelloTriangleApplication::runRecordBenchmark()
+{
+	typedef ApplicationSettings::RecordMode RecordMode;
+	const RecordMode modes[] = { RecordMode::Static, RecordMode::PerFrame, RecordMode::Threaded };
+	const char* names[] = { "static", "per-frame", "threaded" };
+
+	//Enough frames to fill the queue before measuring
+	const uint64_t WARMUP_FRAMES = 20;
+	uint64_t frameCount = mSettings.frameCount != 0 ? mSettings.frameCount : 500;
+
+	std::cout << "benchmarking command buffer recording, " << frameCount << " frames per mode, "
+		<< mSettings.drawCount << " draws per frame" << std::endl;
+
+	double frameMs[3] = {};
+	double recordMs[3] = {};
+	for (size_t i = 0; i < 3; ++i)
+	{
+		mRecordMode = modes[i];
+		if (!runFrames(WARMUP_FRAMES))
+			return;
+
+		//Start every mode from an idle GPU, so its frame times don't include the previous mode's frames
+		vkDeviceWaitIdle(mDevice);
+		mRecordMs = 0.0;
+		auto start = std::chrono::steady_clock::now();
+		if (!runFrames(frameCount))
+			return;
+		vkDeviceWaitIdle(mDevice);
+
+		frameMs[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frameCount;
+		recordMs[i] = mRecordMs / frameCount;
+	}
+
+	std::cout << "mode\t\tframe ms\trecord ms" << std::endl;
+	for (size_t i = 0; i < 3; ++i)
+	{
+		std::cout << names[i] << "\t" << (i == 0 ? "\t" : "") << frameMs[i] << "\t\t" << recordMs[i] << std::endl;
+	}
+	mRecordMode = mSettings.recordMode;
+}
+
+void HelloTriangleApplication::runPipelineBenchmark()
+{
+	//The variants a material system typically produces from one shader pair:
+	//	opaque, alpha blended and additive, each with every cull mode and winding.
+	//LINE polygon mode would need the fillModeNonSolid feature, so it is left out.
+	std::vector<GraphicsPipelineDesc> variants;
+	const VkCullModeFlags cullModes[] = { VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_BIT };
+	const VkFrontFace frontFaces[] = { VK_FRONT_FACE_CLOCKWISE, VK_FRONT_FACE_COUNTER_CLOCKWISE };
+	for (int blend = 0; blend < 3; ++blend)
+	{
+		for (VkCullModeFlags cullMode : cullModes)
+		{
+			for (VkFrontFace frontFace : frontFaces)
+			{
+				GraphicsPipelineDesc desc = mPipelineDesc;
+				desc.cullMode = cullMode;
+				desc.frontFace = frontFace;
+				desc.blendEnable = blend != 0;
+				desc.srcColorBlendFactor = blend == 1 ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+				desc.dstColorBlendFactor = blend == 1 ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+				variants.push_back(desc);
+			}
+		}
+	}
+
+	//Every round starts from an empty in-memory pipeline cache,
+	//	otherwise the second mode would only measure cache hits.
+	//Vulkan has no query for the memory a pipeline takes,
+	//	the size of the cache data after creation is the closest portable measure.
+	const int ROUNDS = 5;
+	const char* names[] = { "independent", "derivatives" };
+	double createMs[2] = {};
+	size_t cacheBytes[2] = {};
+
+	std::cout << "benchmarking pipeline creation, " << variants.size() << " variants, "
+		<< ROUNDS << " rounds per mode" << std::endl;
+
+	for (int round = 0; round < ROUNDS; ++round)
+	{
+		for (int mode = 0; mode < 2; ++mode)
+		{
+			PipelineCache cache;
+			cache.create(mDevice, mDeviceProfile.properties, "");
+			//Shares the shader manifest and layouts, the shader modules are its own
+			PipelineRegistry registry;
+			registry.create(mDevice, cache, mShaders, mLayouts);
+			registry.setDerivatives(mode == 1);
+
+			for (auto &desc : variants)
+			{
+				registry.request(desc);
+			}
+			registry.flush();
+
+			createMs[mode] += registry.createMs();
+			cacheBytes[mode] = cache.dataSize();
+
+			registry.destroy();
+			cache.destroy();
+		}
+	}
+
+	std::cout << "mode\t\tcreate ms\tcache bytes" << std::endl;
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		std::cout << names[mode] << "\t" << createMs[mode] / ROUNDS << "\t\t" << cacheBytes[mode] << std::endl;
 	}
 }
 
 void HelloTriangleApplication::cleanUp()
 {
-	vkDestroySemaphore(mDevice, mRenderFinishedSemaphore, nullptr);
-	vkDestroySemaphore(mDevice, mImageAvailableSemaphore, nullptr);
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		vkDestroySemaphore(mDevice, mRenderFinishedSemaphores[i], nullptr);
+		vkDestroySemaphore(mDevice, mImageAvailableSemaphores[i], nullptr);
+		vkDestroyFence(mDevice, mInFlightFences[i], nullptr);
+	}
 	vkDestroyCommandPool(mDevice, mCommandPool, nullptr);
-	
-	for (auto frameBuffer : mSwapChainFrameBuffers)
+
+	if (needsRecordMode(ApplicationSettings::RecordMode::Threaded))
+	{
+		mRecorder.destroy();
+	}
+	for (auto pool : mFrameCommandPools)
+	{
+		vkDestroyCommandPool(mDevice, pool, nullptr);
+	}
+
+	mCulling.destroy();
+	vkDestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
+	mAllocator.destroyBuffer(mObjectBuffer, mObjectBufferMemory);
+	mAllocator.destroyBuffer(mIndexBuffer, mIndexBufferMemory);
+	mAllocator.destroyBuffer(mVertexBuffer, mVertexBufferMemory);
+	mUploads.destroy();
+
+	if (mProfiler.isEnabled())
 	{
-		vkDestroyFramebuffer(mDevice, frameBuffer, nullptr);
+		mProfiler.exportChromeTrace(mSettings.profilePath);
+		mProfiler.destroy();
 	}
-	vkDestroyPipeline(mDevice, mGraphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(mDevice,mPipelineLayout,nullptr);
-	vkDestroyRenderPass(mDevice, mRenderPass, nullptr);
+	
+	mShaderWatcher.destroy();
+	mPipelines.printStats();
+	mPipelines.destroy();
+	mLayouts.destroy();
+	mPipelineCache.destroy();
+	mRenderGraph.destroy();
 
 	for (auto imageView : mSwapChainImageViews) {
 		vkDestroyImageView(mDevice, imageView, nullptr);
 	}
-	if (enableValidationLayers) 
+	if (mCallback != VK_NULL_HANDLE) 
 	{
 		DestroyDebugUtilsMessengerEXT(mInstance,mCallback, nullptr);
 	}
-	vkDestroySwapchainKHR(mDevice, mSwapChain, nullptr);
+	if (mSettings.headless)
+	{
+		//The offscreen images are ours, swap chain images belong to the swap chain
+		for (size_t i = 0; i < mSwapChainImages.size(); ++i)
+		{
+			mAllocator.destroyImage(mSwapChainImages[i], mOffscreenImageMemory[i]);
+		}
+	}
+	else
+	{
+		vkDestroySwapchainKHR(mDevice, mSwapChain, nullptr);
+	}
+	mAllocator.destroy();
 	vkDestroyDevice(mDevice, nullptr);
+	if (!mSettings.headless)
+	{
+		vkDestroySurfaceKHR(mInstance, mSurface, nullptr);
+	}
 	vkDestroyInstance(mInstance, nullptr);
-	glfwDestroyWindow(mWindow);
-	glfwTerminate();
+	//After the messenger is gone nothing pushes anymore
+	mDebugLog.destroy();
+	if (!mSettings.headless)
+	{
+		glfwDestroyWindow(mWindow);
+		glfwTerminate();
+	}
 }
 
-bool HelloTriangleApplication::checkValidationLayerSupport()
+const char* HelloTriangleApplication::findValidationLayer()
 {
 	uint32_t layerCount;
 	vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
@@ -213,57 +546,106 @@ bool HelloTriangleApplication::checkValidationLayerSupport()
 	std::vector<VkLayerProperties> availableLayers(layerCount);
 	vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
 
-	for (const char* layerName : validationLayers)
+	for (const char* layerName : validationLayerCandidates)
 	{
-		bool layerFound = false;
-
 		for (const auto &layerProperties : availableLayers)
 		{
 			if(strcmp(layerName,layerProperties.layerName) == 0)
 			{
-				layerFound = true;
-				break;
+				return layerName;
 			}
 		}
-
-		if(!layerFound)
-		{
-			return false;
-		}
 	}
 
-	return true;
+	return nullptr;
+}
+
+void HelloTriangleApplication::fillDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo)
+{
+	typedef ApplicationSettings::ValidationMode ValidationMode;
+
+	createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+	switch (mSettings.validationMode)
+	{
+	case ValidationMode::Errors:
+		createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		break;
+	case ValidationMode::Performance:
+		createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT \
+			| VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT \
+			| VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		break;
+	default:
+		createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT \
+			| VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT\
+			| VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		break;
+	}
+	if (mSettings.validationMode == ValidationMode::Performance)
+	{
+		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+	}
+	else
+	{
+		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT \
+			| VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT \
+			| VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+	}
+	createInfo.pfnUserCallback = debugCallback;
+	createInfo.pUserData = &mDebugLog;
 }
 
 std::vector<const char*> HelloTriangleApplication::getRequiredExtensions()
 {
-	uint32_t glfwExtensionCount = 0;
-	const char **glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	std::vector<const char*> extensions;
 
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
-	if (enableValidationLayers)
+	//Headless rendering needs no surface extensions at all, 
+	//	so GLFW is never initialized in that mode.
+	if (!mSettings.headless)
+	{
+		uint32_t glfwExtensionCount = 0;
+		const char **glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
+
+	if (mValidationLayer != nullptr)
 	{
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 	}
 
+	//Optional: gives the device UUID that keys the saved device profile
+	uint32_t extensionCount = 0;
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> available(extensionCount);
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, available.data());
+	for (const auto &extension : available)
+	{
+		if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+		{
+			extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+		}
+	}
+
 	return extensions;
 }
 
+std::vector<const char*> HelloTriangleApplication::getRequiredDeviceExtensions()
+{
+	if (mSettings.headless)
+	{
+		return std::vector<const char*>();
+	}
+	return deviceExtensions;
+}
+
 void HelloTriangleApplication::setupDebugCallback()
 {
-	if (!enableValidationLayers)
+	if (mValidationLayer == nullptr)
 		return;
-	VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
-	createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-	createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT \
-		| VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT\
-		| VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-	createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT \
-		| VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT \
-		| VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-	createInfo.pfnUserCallback = debugCallback;
-	createInfo.pUserData = nullptr; // Optional
+	VkDebugUtilsMessengerCreateInfoEXT createInfo;
+	fillDebugMessengerCreateInfo(createInfo);
 
 	if (CreateDebugUtilsMessengerEXT(mInstance, &createInfo, nullptr, &mCallback) != VK_SUCCESS)
 	{
@@ -314,136 +696,308 @@ void HelloTriangleApplication::pickPhysicalDevice()
 	std::vector<VkPhysicalDevice> devices(deviceCount);
 	vkEnumeratePhysicalDevices(mInstance, &deviceCount, devices.data());
 
-	for (const auto &device : devices)
+	//Fast path: only the properties of each device are needed to find the saved one again.
+	//Handles change between runs, the key doesn't.
+	//The saved device won the ranking of an earlier run, so it is not ranked again.
+	DeviceProfile saved;
+	if (!mSettings.deviceProfilePath.empty() && DeviceProfile::load(mSettings.deviceProfilePath, saved))
 	{
-		if (isDeviceSuitable(device))
+		std::string savedKey = saved.key();
+		for (uint32_t i = 0; i < deviceCount; ++i)
 		{
-			mPhysicalDevice = device;
+			VkPhysicalDeviceProperties properties;
+			uint8_t deviceUUID[VK_UUID_SIZE];
+			DeviceProfile::identify(devices[i], mGetProperties2, properties, deviceUUID);
+			if (DeviceProfile::key(properties, deviceUUID) != savedKey)
+				continue;
+			if (!matchesDeviceOverride(i, deviceUUID))
+				break;
+
+			saved.physicalDevice = devices[i];
+			if (mSurface != VK_NULL_HANDLE)
+			{
+				saved.querySurface(mSurface);
+			}
+			if (isDeviceSuitable(saved))
+			{
+				mDeviceProfile = saved;
+				mPhysicalDevice = devices[i];
+			}
 			break;
 		}
+
+		if (mPhysicalDevice != VK_NULL_HANDLE)
+		{
+			std::cout << "device profile: " << mDeviceProfile.properties.deviceName
+				<< " from " << mSettings.deviceProfilePath << std::endl;
+		}
+		else
+		{
+			std::cout << "device profile: " << mSettings.deviceProfilePath
+				<< " doesn't match any device, driver or --device, ranking all devices" << std::endl;
+		}
 	}
 
-	if(mPhysicalDevice == VK_NULL_HANDLE)
+	if (mPhysicalDevice == VK_NULL_HANDLE)
 	{
-		throw std::runtime_error("Failed to find a suitable GPU!");
+		std::vector<DeviceProfile> profiles;
+		for (const auto &device : devices)
+		{
+			profiles.push_back(DeviceProfile::query(device, mGetProperties2));
+			if (mSurface != VK_NULL_HANDLE)
+			{
+				profiles.back().querySurface(mSurface);
+			}
+		}
+
+		int picked = rankPhysicalDevices(profiles);
+		mDeviceProfile = profiles[picked];
+		mPhysicalDevice = mDeviceProfile.physicalDevice;
+
+		if (!mSettings.deviceProfilePath.empty())
+		{
+			mDeviceProfile.save(mSettings.deviceProfilePath);
+		}
 	}
+
+	mQueueFamilies = findQueueFamilies(mDeviceProfile);
 }
 
-bool HelloTriangleApplication::isDeviceSuitable(const VkPhysicalDevice &device)
+int HelloTriangleApplication::rankPhysicalDevices(const std::vector<DeviceProfile> &profiles)
 {
-	VkPhysicalDeviceProperties deviceProperties;
-	vkGetPhysicalDeviceProperties(device, &deviceProperties);
-	VkPhysicalDeviceFeatures deviceFeatures;
-	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+	//One line per device, so the log shows why a host ended up on its device
+	std::cout << "physical devices:" << std::endl;
+	int best = -1;
+	int overridden = -1;
+	uint64_t bestScore = 0;
+	for (uint32_t i = 0; i < profiles.size(); ++i)
+	{
+		const DeviceProfile &profile = profiles[i];
+		QueueFamily queueFamilies = findQueueFamilies(profile);
+		std::cout << "\t[" << i << "] " << profile.properties.deviceName
+			<< " (" << deviceTypeName(profile.properties.deviceType)
+			<< ", " << deviceLocalMemory(profile) / (1024 * 1024) << " MiB device local"
+			<< (queueFamilies.transferFamily.has_value() ? ", transfer queue" : "")
+			<< ") uuid " << DeviceProfile::uuidString(profile.deviceUUID);
+
+		const char* reason = findUnsuitability(profile);
+		if (reason != nullptr)
+		{
+			std::cout << ": unsuitable, " << reason << std::endl;
+		}
+		else
+		{
+			uint64_t score = rateDeviceSuitability(profile);
+			std::cout << ": score " << score << std::endl;
+			if (score > bestScore)
+			{
+				best = i;
+				bestScore = score;
+			}
+		}
 
-	bool extensionSupported = checkDeviceExtensionSupport(device);
+		if (!mSettings.deviceOverride.empty() && matchesDeviceOverride(i, profile.deviceUUID))
+		{
+			if (reason != nullptr)
+			{
+				throw std::runtime_error("the device selected by --device is not suitable: " + std::string(reason));
+			}
+			overridden = i;
+		}
+	}
 
-	bool swapChainAdequate = false;
-	if (extensionSupported)
+	if (overridden >= 0)
+	{
+		std::cout << "picked [" << overridden << "] " << profiles[overridden].properties.deviceName
+			<< ", selected by --device=" << mSettings.deviceOverride << std::endl;
+		return overridden;
+	}
+	if (!mSettings.deviceOverride.empty())
 	{
-		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
-		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+		throw std::runtime_error("no device matches --device=" + mSettings.deviceOverride);
 	}
-	return deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU
-		&& deviceFeatures.geometryShader
-		&& findQueueFamilies(device).isComplete()
-		&& extensionSupported
-		&& swapChainAdequate;
+	if (best < 0)
+	{
+		throw std::runtime_error("Failed to find a suitable GPU!");
+	}
+	std::cout << "picked [" << best << "] " << profiles[best].properties.deviceName << ", highest score" << std::endl;
+	return best;
 }
 
-bool HelloTriangleApplication::checkDeviceExtensionSupport(const VkPhysicalDevice &device)
+bool HelloTriangleApplication::matchesDeviceOverride(uint32_t index, const uint8_t deviceUUID[VK_UUID_SIZE])
 {
-	uint32_t extensionCount;
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
-	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+	const std::string &selection = mSettings.deviceOverride;
+	if (selection.empty())
+		return true;
 
-	std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+	//A short number is an index in enumeration order, anything else a UUID
+	if (selection.size() < 2 * VK_UUID_SIZE)
+	{
+		return selection.find_first_not_of("0123456789") == std::string::npos
+			&& std::strtoul(selection.c_str(), nullptr, 10) == index;
+	}
 
-	for (const auto &extension : availableExtensions)
+	//Accepts the usual dashed form and upper case hex digits
+	std::string uuid;
+	for (char c : selection)
 	{
-		requiredExtensions.erase(extension.extensionName);
+		if (c != '-')
+		{
+			uuid += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+		}
 	}
+	return uuid == DeviceProfile::uuidString(deviceUUID);
+}
 
-	return requiredExtensions.empty();
+bool HelloTriangleApplication::isDeviceSuitable(const DeviceProfile &profile)
+{
+	return findUnsuitability(profile) == nullptr;
 }
 
-void HelloTriangleApplication::pickPhysicalDevicebyScore()
+const char* HelloTriangleApplication::findUnsuitability(const DeviceProfile &profile)
 {
-	mPhysicalDevice = VK_NULL_HANDLE;
-	uint32_t deviceCount;
-	vkEnumeratePhysicalDevices(mInstance, &deviceCount, NULL);
-	std::vector<VkPhysicalDevice> devices(deviceCount);
-	vkEnumeratePhysicalDevices(mInstance, &deviceCount, devices.data());
-	
-	std::multimap<int, VkPhysicalDevice> candidates;
-	for (const auto &device : devices)
+	//Only what the application can't run without.
+	//Device type and speed are preferences, rateDeviceSuitability weighs them,
+	//	so CPU implementations like lavapipe or SwiftShader are still usable.
+	if (!findQueueFamilies(profile).isComplete())
+		return mSurface != VK_NULL_HANDLE ? "no graphics or present queue" : "no graphics queue";
+
+	if (!checkDeviceExtensionSupport(profile))
+		return "missing device extensions";
+
+	if (!checkDeviceFeatureSupport(profile))
+		return "missing device features";
+
+	if (!mSettings.headless && (profile.surfaceFormats.empty() || profile.presentModes.empty()))
+		return "no surface formats or present modes";
+
+	return nullptr;
+}
+
+bool HelloTriangleApplication::checkDeviceExtensionSupport(const DeviceProfile &profile)
+{
+	for (const char* extension : getRequiredDeviceExtensions())
 	{
-		int score = rateDeviceSuitability(device);
-		candidates.insert(std::make_pair(score, device));
+		if (!profile.hasExtension(extension))
+			return false;
 	}
+	return true;
+}
 
-	if (candidates.rbegin()->first > 0)
+VkPhysicalDeviceFeatures HelloTriangleApplication::getRequiredDeviceFeatures()
+{
+	//The triangle needs none of the optional features
+	VkPhysicalDeviceFeatures features = {};
+	if (mSettings.gpuCulling)
 	{
-		mPhysicalDevice = candidates.rbegin()->second;
+		//One indirect draw of many commands, each selecting its object with firstInstance
+		features.multiDrawIndirect = VK_TRUE;
+		features.drawIndirectFirstInstance = VK_TRUE;
 	}
-	else
+	return features;
+}
+
+bool HelloTriangleApplication::checkDeviceFeatureSupport(const DeviceProfile &profile)
+{
+	//VkPhysicalDeviceFeatures is nothing but VkBool32 members
+	VkPhysicalDeviceFeatures required = getRequiredDeviceFeatures();
+	const VkBool32* requiredBits = reinterpret_cast<const VkBool32*>(&required);
+	const VkBool32* supportedBits = reinterpret_cast<const VkBool32*>(&profile.features);
+	for (size_t i = 0; i < sizeof(VkPhysicalDeviceFeatures) / sizeof(VkBool32); ++i)
 	{
-		throw std::runtime_error("Failed to find a suitable GPU!");
+		if (requiredBits[i] && !supportedBits[i])
+			return false;
 	}
+	return true;
 }
 
-int HelloTriangleApplication::rateDeviceSuitability(const VkPhysicalDevice &device)
+uint64_t HelloTriangleApplication::rateDeviceSuitability(const DeviceProfile &profile)
 {
-	VkPhysicalDeviceProperties deviceProperties;
-	vkGetPhysicalDeviceProperties(mPhysicalDevice, &deviceProperties);
-	VkPhysicalDeviceFeatures deviceFeatures;
-	vkGetPhysicalDeviceFeatures(mPhysicalDevice, &deviceFeatures);
+	if (!isDeviceSuitable(profile))
+		return 0;
 
-	int score = 0;
-	if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
-		score += 1000;
+	//The device type dominates: any discrete GPU is ranked above any integrated one,
+	//	and a CPU implementation is only picked when there is nothing else.
+	uint64_t score = 1;
+	switch (profile.properties.deviceType)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:		score += 4000000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:	score += 3000000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:		score += 2000000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_OTHER:				score += 1000000; break;
+	default:										break;
+	}
 
-	//Maximum possible size of textures affects graphic quality
-	score += deviceProperties.limits.maxImageDimension2D;
+	//Among devices of one type the one with more VRAM is usually the faster one,
+	//	one point per MiB, which stays below the step between two types up to ~970 GiB
+	score += deviceLocalMemory(profile) / (1024 * 1024);
 
-	//application can't function without geometry shader
-	if (!deviceFeatures.geometryShader)
-		return 0;
-	
-	if (findQueueFamilies(device).isComplete())
+	//A dedicated transfer family lets uploads run next to rendering
+	QueueFamily queueFamilies = findQueueFamilies(profile);
+	if (queueFamilies.transferFamily.has_value())
 		score += 1000;
 
 	return score;
 }
 
-HelloTriangleApplication::QueueFamily HelloTriangleApplication::findQueueFamilies(VkPhysicalDevice device)
+VkDeviceSize HelloTriangleApplication::deviceLocalMemory(const DeviceProfile &profile)
 {
-	QueueFamily indices;
-
-	uint32_t queueFamilyCount = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
-	
-	int i = 0;
-	for (const auto &familyPropery : queueFamilies)
+	VkDeviceSize size = 0;
+	for (uint32_t i = 0; i < profile.memoryProperties.memoryHeapCount; ++i)
 	{
-		if (familyPropery.queueCount > 0 && familyPropery.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		const VkMemoryHeap &heap = profile.memoryProperties.memoryHeaps[i];
+		if (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
 		{
-			indices.graphicsFamily = i;
+			size += heap.size;
 		}
+	}
+	return size;
+}
 
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, mSurface, &presentSupport);
-
-		if (familyPropery.queueCount > 0 && presentSupport)
+const char* HelloTriangleApplication::deviceTypeName(VkPhysicalDeviceType type)
+{
+	switch (type)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:		return "discrete GPU";
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:	return "integrated GPU";
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:		return "virtual GPU";
+	case VK_PHYSICAL_DEVICE_TYPE_CPU:				return "CPU";
+	default:										return "other";
+	}
+}
+
+HelloTriangleApplication::QueueFamily HelloTriangleApplication::findQueueFamilies(const DeviceProfile &profile)
+{
+	QueueFamily indices;
+	indices.requiresPresent = mSurface != VK_NULL_HANDLE;
+
+	//All families are looked at, the transfer and compute families are optional extras
+	//	that must not stop the search early.
+	uint32_t i = 0;
+	for (const auto &familyPropery : profile.queueFamilies)
+	{
+		if (familyPropery.queueCount == 0)
+		{
+			i++;
+			continue;
+		}
+
+		VkQueueFlags flags = familyPropery.queueFlags;
+		if (!indices.graphicsFamily.has_value() && (flags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			indices.graphicsFamily = i;
+		}
+
+		if (indices.requiresPresent && !indices.presentFamily.has_value()
+			&& i < profile.presentSupport.size() && profile.presentSupport[i])
 		{
 			indices.presentFamily = i;
 		}
-		if (indices.isComplete())
+
+		if (!indices.transferFamily.has_value() && (flags & VK_QUEUE_TRANSFER_BIT)
+			&& !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
 		{
-			break;
+			indices.transferFamily = i;
 		}
 		i++;
 	}
@@ -453,12 +1007,19 @@ HelloTriangleApplication::QueueFamily HelloTriangleApplication::findQueueFamilie
 void HelloTriangleApplication::createLogicalDevice()
 {
 	//Create Logical Device
-	QueueFamily queueFam = findQueueFamilies(mPhysicalDevice);
+	const QueueFamily &queueFam = mQueueFamilies;
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 
-	std::set<uint32_t> uniqueQueueFamilies = { queueFam.graphicsFamily.value()
-		,queueFam.presentFamily.value() };
+	std::set<uint32_t> uniqueQueueFamilies = { queueFam.graphicsFamily.value() };
+	if (queueFam.presentFamily.has_value())
+	{
+		uniqueQueueFamilies.insert(queueFam.presentFamily.value());
+	}
+	if (queueFam.transferFamily.has_value())
+	{
+		uniqueQueueFamilies.insert(queueFam.transferFamily.value());
+	}
 
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies)
@@ -473,19 +1034,29 @@ void HelloTriangleApplication::createLogicalDevice()
 
 
 	//Specify Device Feature
-	VkPhysicalDeviceFeatures deviceFeatures = {};
+	VkPhysicalDeviceFeatures deviceFeatures = getRequiredDeviceFeatures();
 	
+	std::vector<const char*> deviceExtensions = getRequiredDeviceExtensions();
+	//Optional: without it the culled draws are drawn with a fixed count (see ObjectCulling)
+	bool drawIndirectCount = mSettings.gpuCulling && mDeviceProfile.hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	if (drawIndirectCount)
+	{
+		deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+
 	VkDeviceCreateInfo deviceCreateInfo = {};
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
-	if (enableValidationLayers)
+	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.empty() ? nullptr : deviceExtensions.data();
+	//Device layers are ignored by current loaders,
+	//	older ones expect the same layers as the instance.
+	if (mValidationLayer != nullptr)
 	{
-		deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-		deviceCreateInfo.ppEnabledLayerNames = validationLayers.data();
+		deviceCreateInfo.enabledLayerCount = 1;
+		deviceCreateInfo.ppEnabledLayerNames = &mValidationLayer;
 	}
 	else
 	{
@@ -497,32 +1068,34 @@ void HelloTriangleApplication::createLogicalDevice()
 		throw std::runtime_error("failed to create logical device!");
 	}
 
+	//Extension commands aren't exported by the loader
+	if (drawIndirectCount)
+	{
+		mDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(mDevice, "vkCmdDrawIndexedIndirectCountKHR");
+	}
+
 	vkGetDeviceQueue(mDevice, queueFam.graphicsFamily.value(), 0, &mGraphicsQueue);
-	vkGetDeviceQueue(mDevice, queueFam.presentFamily.value(), 0, &mPresentQueue);
+	if (queueFam.presentFamily.has_value())
+	{
+		vkGetDeviceQueue(mDevice, queueFam.presentFamily.value(), 0, &mPresentQueue);
+	}
+
+	mTransferQueue = mGraphicsQueue;
+	if (queueFam.transferFamily.has_value())
+	{
+		vkGetDeviceQueue(mDevice, queueFam.transferFamily.value(), 0, &mTransferQueue);
+	}
 }
 
-HelloTriangleApplication::SwapChainSupportDetails HelloTriangleApplication::querySwapChainSupport(VkPhysicalDevice device)
+HelloTriangleApplication::SwapChainSupportDetails HelloTriangleApplication::querySwapChainSupport()
 {
 	SwapChainSupportDetails details;
 
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, mSurface, &details.capabilities);
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(mPhysicalDevice, mSurface, &details.capabilities);
 
-	/*querying the supported surface formats*/
-	uint32_t formatCount;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(device, mSurface, &formatCount, nullptr);
-	if (formatCount != 0)
-	{
-		details.formats.resize(formatCount);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, mSurface, &formatCount, details.formats.data());
-	}
-	
-	uint32_t presentModeCount;
-	vkGetPhysicalDeviceSurfacePresentModesKHR(device, mSurface, &presentModeCount, nullptr);
-	if (presentModeCount != 0)
-	{
-		details.presentModes.resize(presentModeCount);
-		vkGetPhysicalDeviceSurfacePresentModesKHR(device, mSurface, &formatCount, details.presentModes.data());
-	}
+	/*the supported surface formats and present modes were queried with the device profile*/
+	details.formats = mDeviceProfile.surfaceFormats;
+	details.presentModes = mDeviceProfile.presentModes;
 
 	return details;
 }
@@ -573,7 +1146,11 @@ VkExtent2D HelloTriangleApplication::chooseSwapExtent(const VkSurfaceCapabilitie
 	}
 	else
 	{
-		VkExtent2D actualExtent = { WIDTH,HEIGHT };
+		//The window size is in screen coordinates, 
+		//	the swap chain extent has to be in pixels.
+		int width, height;
+		glfwGetFramebufferSize(mWindow, &width, &height);
+		VkExtent2D actualExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
 		actualExtent.width  = std::max(capabilites.minImageExtent.width  ,std::min(capabilites.maxImageExtent.width, actualExtent.width));
 		actualExtent.height = std::max(capabilites.minImageExtent.height,std::min(capabilites.maxImageExtent.height, actualExtent.height));
 		return actualExtent;
@@ -583,7 +1160,7 @@ VkExtent2D HelloTriangleApplication::chooseSwapExtent(const VkSurfaceCapabilitie
 
 void HelloTriangleApplication::createSwapChain()
 {
-	SwapChainSupportDetails swapChainSupport = querySwapChainSupport(mPhysicalDevice);
+	SwapChainSupportDetails swapChainSupport = querySwapChainSupport();
 
 	VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
 	VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
@@ -604,7 +1181,7 @@ void HelloTriangleApplication::createSwapChain()
 	createInfo.imageArrayLayers = 1;
 	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
-	QueueFamily indices = findQueueFamilies(mPhysicalDevice);
+	const QueueFamily &indices = mQueueFamilies;
 	uint32_t queueFamilyIndices[] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
 
 	if (indices.graphicsFamily != indices.presentFamily) {
@@ -621,10 +1198,15 @@ void HelloTriangleApplication::createSwapChain()
 	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE;
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
-	if (vkCreateSwapchainKHR(mDevice, &createInfo, nullptr, &mSwapChain) != VK_SUCCESS) {
+	//When recreating, the old swap chain lets the driver reuse its resources
+	//	and keeps images that are still being presented valid.
+	//It is retired by this call and must be destroyed by us later.
+	createInfo.oldSwapchain = mSwapChain;
+	VkSwapchainKHR newSwapChain;
+	if (vkCreateSwapchainKHR(mDevice, &createInfo, nullptr, &newSwapChain) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create swap chain!");
 	}
+	mSwapChain = newSwapChain;
 
 	vkGetSwapchainImagesKHR(mDevice, mSwapChain, &imageCount, nullptr);
 	mSwapChainImages.resize(imageCount);
@@ -634,6 +1216,122 @@ void HelloTriangleApplication::createSwapChain()
 	mSwapChainExtent = extent;
 }
 
+void HelloTriangleApplication::recreateSwapChain()
+{
+	//A minimized window has a zero sized framebuffer,
+	//	no swap chain can be created until it is visible again.
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(mWindow, &width, &height);
+	while (width == 0 || height == 0)
+	{
+		if (glfwWindowShouldClose(mWindow))
+			return;
+		glfwWaitEvents();
+		glfwGetFramebufferSize(mWindow, &width, &height);
+	}
+
+	VkFormat oldFormat = mSwapChainFormat;
+
+	retireSwapChain();
+	createSwapChain();
+
+	//The render graph and the pipeline only depend on the format.
+	//It practically never changes on resize, 
+	//	if it does this is the one case that has to wait for the device.
+	if (mSwapChainFormat != oldFormat)
+	{
+		vkDeviceWaitIdle(mDevice);
+		destroyRetiredSwapChains(true);
+		mPipelines.releaseRenderPass(mRenderGraph.renderPass(mScenePass));
+		mRenderGraph.destroy();
+		createRenderGraph();
+		createGraphicsPipeline();
+	}
+
+	createImageViews();
+	createRenderTargets();
+	createCommandBuffer();
+
+	//The image count may have changed, 
+	//	and none of the new images is used by a frame yet.
+	mImagesInFlight.assign(mSwapChainImages.size(), VK_NULL_HANDLE);
+}
+
+void HelloTriangleApplication::retireSwapChain()
+{
+	RetiredSwapChain retired;
+	//createSwapChain still needs the handle as oldSwapchain, 
+	//	the retired entry owns it from then on.
+	retired.swapChain = mSwapChain;
+	retired.imageViews.swap(mSwapChainImageViews);
+	retired.graphTargets = mRenderGraph.releaseTargets();
+	retired.commandBuffers.swap(mCommandBuffers);
+	retired.lastFrame = mFrameNumber;
+	mRetiredSwapChains.push_back(retired);
+}
+
+void HelloTriangleApplication::destroyRetiredSwapChains(bool force)
+{
+	//drawFrame has just waited for the fence of the slot it is about to reuse,
+	//	which means every frame up to mFrameNumber - MAX_FRAMES_IN_FLIGHT has finished.
+	auto it = mRetiredSwapChains.begin();
+	while (it != mRetiredSwapChains.end())
+	{
+		if (!force && it->lastFrame + MAX_FRAMES_IN_FLIGHT > mFrameNumber + 1)
+		{
+			++it;
+			continue;
+		}
+
+		if (!it->commandBuffers.empty())
+		{
+			vkFreeCommandBuffers(mDevice, mCommandPool, static_cast<uint32_t>(it->commandBuffers.size()), it->commandBuffers.data());
+		}
+		mRenderGraph.destroyTargets(it->graphTargets);
+		for (auto imageView : it->imageViews)
+		{
+			vkDestroyImageView(mDevice, imageView, nullptr);
+		}
+		vkDestroySwapchainKHR(mDevice, it->swapChain, nullptr);
+		it = mRetiredSwapChains.erase(it);
+	}
+}
+
+void HelloTriangleApplication::createOffscreenTargets()
+{
+	//Same format and size the windowed path would most likely pick, 
+	//	so both modes do comparable amounts of work.
+	mSwapChainFormat = VK_FORMAT_B8G8R8A8_UNORM;
+	mSwapChainExtent = { WIDTH, HEIGHT };
+
+	//One image per frame in flight is enough, 
+	//	there is no presentation engine holding on to images.
+	mSwapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+	mOffscreenImageMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+	for (size_t i = 0; i < mSwapChainImages.size(); ++i)
+	{
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = mSwapChainFormat;
+		imageInfo.extent.width = mSwapChainExtent.width;
+		imageInfo.extent.height = mSwapChainExtent.height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		//TRANSFER_SRC so the rendered frames can be copied out for batch rendering
+		imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		//All images share one block instead of one vkAllocateMemory each
+		mSwapChainImages[i] = mAllocator.createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mOffscreenImageMemory[i]);
+	}
+}
+
 void HelloTriangleApplication::createImageViews()
 {
 	mSwapChainImageViews.resize(mSwapChainImages.size());
@@ -660,418 +1358,341 @@ void HelloTriangleApplication::createImageViews()
 	}
 }
 
-void HelloTriangleApplication::createGraphicsPipeline()
+void HelloTriangleApplication::createPipelineCache()
 {
-	std::vector<char> vertShaderCode = readFile("Shaders/vert.spv");
-	std::vector<char> fragShaderCode = readFile("Shaders/frag.spv");
-	
-	VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-	VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-	VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-	vertShaderStageInfo.sType	= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertShaderStageInfo.stage	= VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageInfo.module	= vertShaderModule;
-	vertShaderStageInfo.pName	= "main";
-
-	VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-	fragShaderStageInfo.sType	= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragShaderStageInfo.stage	= VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageInfo.module	= fragShaderModule;
-	fragShaderStageInfo.pName	= "main";
-
-	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo,fragShaderStageInfo };
-
-	//***************************
-	//		Vertex Input
-	//***************************
-	//
-	//Bindings: spacing between data and 
-	//			whether the data is per - vertex or per - instance(see instancing)
-	//Attribute descriptions : 
-	//			type of the attributes passed to the vertex shader, 
-	//			which binding to load them from 
-	//			and at which offset
-	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-	vertexInputInfo.sType							= VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount	= 0;
-	vertexInputInfo.pVertexBindingDescriptions		= nullptr;
-	vertexInputInfo.vertexAttributeDescriptionCount = 0;
-	vertexInputInfo.pVertexAttributeDescriptions	= nullptr;
-
-	/************************************************************************/
-	/*		Input Assembly                                                                      */
-	/************************************************************************/
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-	inputAssembly.sType						= VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	//VK_PRIMITIVE_TOPOLOGY_POINT_LIST: points from vertices
-	//VK_PRIMITIVE_TOPOLOGY_LINE_LIST : line from every 2 vertices without reuse
-	//VK_PRIMITIVE_TOPOLOGY_LINE_STRIP : the end vertex of every line is used as start vertex for the next line
-	//VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST : triangle from every 3 vertices without reuse
-	//VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP : the second and third vertex of every triangle are used as first two vertices of the next triangle
-	inputAssembly.topology					= VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	//If you set the primitiveRestartEnable member to VK_TRUE, 
-	//then it's possible to break up lines 
-	//and triangles in the _STRIP topology modes 
-	//by using a special index of 0xFFFF or 0xFFFFFFFF.
-	inputAssembly.primitiveRestartEnable	= VK_FALSE;
-	
+	mPipelineCache.create(mDevice, mDeviceProfile.properties, mSettings.pipelineCachePath);
+	//Hot reload rebuilds pipelines on a compile thread, so the render loop doesn't stall on them
+	uint32_t compileThreads = mSettings.pipelineThreads;
+	if (mSettings.hotReload && compileThreads == 0)
+	{
+		compileThreads = 1;
+	}
+	mPipelines.create(mDevice, mPipelineCache, mShaders, mLayouts, compileThreads);
+}
 
-	/************************************************************************/
-	/*		Viewports and Scissors                                                                      */
-	/************************************************************************/
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)mSwapChainExtent.width;
-	viewport.height = (float)mSwapChainExtent.height;
-	/*
-	 *	The minDepth and maxDepth values specify 
-	 *	the range of depth values to use for the framebuffer
-	 */
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
+//The vertex input state is reflected from the vertex shader,
+//	Vertex has to lay its inputs out the same way.
+//The stride alone misses members swapped for others of the same total size.
+static void checkVertexLayout(const PipelineRegistry::Pipeline &pipeline)
+{
+	struct Member
+	{
+		uint32_t	location;
+		VkFormat	format;
+		uint32_t	offset;
+	};
+	const Member members[] = {
+		{ 0, VK_FORMAT_R32G32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, pos)) },
+		{ 1, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, color)) },
+	};
 
-	//While viewports define the transformation from the image to the framebuffer,
-	//scissor rectangles define in which regions pixels will actually be stored.
-	VkRect2D scissor = {};
-	scissor.offset = { 0,0 };
-	scissor.extent = mSwapChainExtent;
+	bool matches = pipeline.vertexStride == sizeof(Vertex)
+		&& pipeline.vertexAttributes.size() == sizeof(members) / sizeof(members[0]);
+	for (size_t i = 0; matches && i < pipeline.vertexAttributes.size(); ++i)
+	{
+		const VkVertexInputAttributeDescription &attribute = pipeline.vertexAttributes[i];
+		matches = attribute.location == members[i].location && attribute.format == members[i].format
+			&& attribute.offset == members[i].offset;
+	}
+	if (!matches)
+	{
+		throw std::runtime_error("Vertex doesn't match the inputs of VertexShader.vert!");
+	}
+}
 
-	//It is possible to use multiple viewports 
-	//and scissor rectangles on some graphics cards, 
-	//so its members reference an array of them.
-	//Using multiple requires enabling a GPU feature(see logical device creation).
-	VkPipelineViewportStateCreateInfo viewportState = {};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
-	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+void HelloTriangleApplication::createGraphicsPipeline()
+{
+	//The fixed-function state lives in PipelineRegistry,
+	//	a pipeline is only described here.
+	//Most members keep their defaults, they are spelled out for the triangle anyway.
+	mPipelineDesc = GraphicsPipelineDesc();
+	mPipelineDesc.vertexShader		= "VertexShader.vert";
+	mPipelineDesc.fragmentShader	= "FragShader.frag";
+	mPipelineDesc.topology			= VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	mPipelineDesc.polygonMode		= VK_POLYGON_MODE_FILL;
+	mPipelineDesc.cullMode			= VK_CULL_MODE_BACK_BIT;
+	mPipelineDesc.frontFace			= VK_FRONT_FACE_CLOCKWISE;
+	mPipelineDesc.samples			= mSampleCount;
+	mPipelineDesc.depthTest			= true;
+	mPipelineDesc.depthWrite		= true;
+	mPipelineDesc.depthCompareOp	= VK_COMPARE_OP_LESS;
+	mPipelineDesc.blendEnable		= false;
+	mPipelineDesc.renderPass		= mRenderGraph.renderPass(mScenePass);
+	mPipelineDesc.subpass			= 0;
+
+	//With compile threads the real pipeline is built in the background
+	//	and frames are drawn with the fallback until updatePipelines picks it up.
+	//The fallback only differs in state that doesn't affect compatibility,
+	//	in a real application one generic fallback would stand in for many materials.
+	if (mSettings.pipelineThreads > 0)
+	{
+		GraphicsPipelineDesc fallbackDesc = mPipelineDesc;
+		fallbackDesc.cullMode = VK_CULL_MODE_NONE;
+		mPipelines.setFallback(fallbackDesc);
+	}
+	const PipelineRegistry::Pipeline &pipeline = mPipelines.getOrFallback(mPipelineDesc);
+	checkVertexLayout(pipeline);
 
-	/************************************************************************/
-	/*		Rasterizer                                                                      */
-	/************************************************************************/
-	VkPipelineRasterizationStateCreateInfo rasterizer = {};
-	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	//If depthClampEnable is set to VK_TRUE, then fragments that are beyond the near and far planes are clamped to them as opposed to discarding them. This is useful in some special cases like shadow maps. Using this requires enabling a GPU feature.
-	rasterizer.depthClampEnable = VK_FALSE;
-	//If rasterizerDiscardEnable is set to VK_TRUE, then geometry never passes through the rasterizer stage. This basically disables any output to the framebuffer.
-	rasterizer.rasterizerDiscardEnable = VK_FALSE;
-	//The polygonMode determines how fragments are generated for geometry.The following modes are available :
-	//			VK_POLYGON_MODE_FILL	: fill the area of the polygon with fragments
-	//			VK_POLYGON_MODE_LINE	: polygon edges are drawn as lines
-	//			VK_POLYGON_MODE_POINT : polygon vertices are drawn as points
-	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-	//The lineWidth member is straightforward, 
-	//it describes the thickness of lines 
-	//in terms of number of fragments.
-	//The maximum line width that is supported depends on the hardware and any line thicker than 1.0f requires you to enable the wideLines GPU feature.
-	rasterizer.lineWidth = 1.0f;
-	//The cullMode variable determines the type of face culling to use.You can disable culling, cull the front faces, cull the back faces or both.
-	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-	//The frontFace variable specifies the vertex order for faces to be considered front-facing and can be clockwise or counterclockwise.
-	rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-	//The rasterizer can alter the depth values by adding a constant value or biasing them based on a fragment's slope
-	rasterizer.depthBiasEnable			= VK_FALSE;
-	rasterizer.depthBiasConstantFactor	= 0.0f;//optional
-	rasterizer.depthBiasClamp			= 0.0f;//optional
-	rasterizer.depthBiasSlopeFactor		= 0.0f;//optional
+	mGraphicsPipeline = pipeline.pipeline;
+	mPipelineLayout = pipeline.layout;
+}
 
-	/************************************************************************/
-	/*		MultiSampling                                                                     */
-	/************************************************************************/
-	//The VkPipelineMultisampleStateCreateInfo struct configures multisampling, 
-	//which is one of the ways to perform anti-aliasing. 
-	VkPipelineMultisampleStateCreateInfo multisampling = {};
-	multisampling.sType					= VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable	= VK_FALSE;
-	multisampling.rasterizationSamples	= VK_SAMPLE_COUNT_1_BIT;
-	multisampling.minSampleShading		= 1.0f;//optional
-	multisampling.pSampleMask			= nullptr;//optional
-	multisampling.alphaToCoverageEnable = VK_FALSE;//optional
-	multisampling.alphaToOneEnable		= VK_FALSE;//optional
+void HelloTriangleApplication::updatePipelines()
+{
+	bool rebuilt;
+	if (mShaderWatcher.poll(rebuilt) && rebuilt)
+	{
+		reloadShaders();
+	}
 
-	/************************************************************************/
-	/*		Depth and stencil testing
-	/************************************************************************/
-	//empty
+	if (mPipelines.update(mFrameNumber))
+	{
+		const PipelineRegistry::Pipeline &pipeline = mPipelines.getOrFallback(mPipelineDesc);
+		if (pipeline.pipeline != mGraphicsPipeline)
+		{
+			//A reloaded vertex shader may have changed its inputs
+			checkVertexLayout(pipeline);
+			mGraphicsPipeline = pipeline.pipeline;
+			mPipelineLayout = pipeline.layout;
+			//The static command buffers still bind the old pipeline,
+			//	each slot is re-recorded once its fence says they are not in use.
+			mStaleCommandBufferSlots.assign(MAX_FRAMES_IN_FLIGHT, true);
+		}
+	}
 
-	/************************************************************************/
-	/*		Color Blending                                                                      */
-	/************************************************************************/
-	//After a fragment shader has returned a color, 
-	//it needs to be combined with the color 
-	//that is already in the framebuffer. 
-	//This transformation is known as color blending and there are two ways to do it:
-	//	1.Mix the old and new value to produce a final color
-	//	2.Combine the old and new value using a bitwise operation
-	VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-	colorBlendAttachment.colorWriteMask			= VK_COLOR_COMPONENT_R_BIT |
-		VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT |
-		VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachment.blendEnable			= VK_FALSE;
-	colorBlendAttachment.srcColorBlendFactor	= VK_BLEND_FACTOR_ONE;
-	colorBlendAttachment.dstColorBlendFactor	= VK_BLEND_FACTOR_ZERO;
-	colorBlendAttachment.colorBlendOp			= VK_BLEND_OP_ADD;
-	colorBlendAttachment.srcAlphaBlendFactor	= VK_BLEND_FACTOR_ONE;
-	colorBlendAttachment.dstAlphaBlendFactor	= VK_BLEND_FACTOR_ZERO;
-	colorBlendAttachment.alphaBlendOp			= VK_BLEND_OP_ADD;
-
-	//color blending follow pseudo-code:
-	//	if (blendEnable)
-	//	{
-	//		finalColor.rgb = (srcColorBlendFactor * newColor.rgb) < colorBlendOp > (dstColorBlendFactor * oldColor.rgb);
-	//		finalColor.a = (srcAlphaBlendFactor * newColor.a) < alphaBlendOp > (dstAlphaBlendFactor * oldColor.a);
-	//	}
-	//	else
-	//	{
-	//		finalColor = newColor;
-	//	}
-	//
-	//	finalColor = finalColor & colorWriteMask;
-	VkPipelineColorBlendStateCreateInfo colorBlending = {};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	//If you want to use the second method of blending(bitwise combination), 
-	//	then you should set logicOpEnable to VK_TRUE.
-	//
-	//The bitwise operation can then be specified 
-	//	in the logicOp field
-	//
-	//Note that this will automatically disable the first method, 
-	//	as if you had set blendEnable to VK_FALSE 
-	//	for every attached framebuffer!
-	//
-	//The colorWriteMask will also be used in this mode 
-	//	to determine which channels in the framebuffer will actually be affected. 
-	colorBlending.logicOpEnable		= VK_FALSE;
-	colorBlending.logicOp			= VK_LOGIC_OP_COPY;
-	colorBlending.attachmentCount	= 1;
-	colorBlending.pAttachments		= &colorBlendAttachment;
-	colorBlending.blendConstants[0] = 0.0f; //optional
-	colorBlending.blendConstants[1] = 0.0f; //optional
-	colorBlending.blendConstants[2] = 0.0f; //optional
-	colorBlending.blendConstants[3] = 0.0f; //optional
-	
-	/************************************************************************/
-	/*		Dynamic State                                                                     */
-	/************************************************************************/
-	VkDynamicState dynamicStates[] = {
-		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
-	};
+	if (mRecordMode == ApplicationSettings::RecordMode::Static && !mStaleCommandBufferSlots.empty()
+		&& mStaleCommandBufferSlots[mCurrentFrame])
+	{
+		for (uint32_t image = 0; image < mSwapChainImages.size(); ++image)
+		{
+			recordCommandBuffer(mCommandBuffers[commandBufferIndex(mCurrentFrame, image)], image, static_cast<uint32_t>(mCurrentFrame));
+		}
+		mStaleCommandBufferSlots[mCurrentFrame] = false;
+	}
+}
 
-	VkPipelineDynamicStateCreateInfo dynamicState = {};
-	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynamicState.dynamicStateCount = 2;
-	dynamicState.pDynamicStates = dynamicStates;
+void HelloTriangleApplication::createShaderWatcher()
+{
+	if (!mSettings.hotReload)
+		return;
 
-	/************************************************************************/
-	/*		Pipeline Layout                                                                     */
-	/************************************************************************/
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 0;	//optional
-	pipelineLayoutInfo.pSetLayouts = nullptr; //optional
-	pipelineLayoutInfo.pushConstantRangeCount = 0; //optional
-	pipelineLayoutInfo.pPushConstantRanges = nullptr;
-
-	if (vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mPipelineLayout) != VK_SUCCESS)
-	{
-		throw std::runtime_error("failed to create pipeline layout!");
-	}
-
-	VkGraphicsPipelineCreateInfo pipelineInfo = {};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.stageCount = 2;
-	pipelineInfo.pStages = shaderStages;
-	pipelineInfo.pVertexInputState = &vertexInputInfo;
-	pipelineInfo.pInputAssemblyState = &inputAssembly;
-	pipelineInfo.pViewportState = &viewportState;
-	pipelineInfo.pRasterizationState = &rasterizer;
-	pipelineInfo.pMultisampleState = &multisampling;
- 	pipelineInfo.pDepthStencilState = nullptr;//optional
-	pipelineInfo.pColorBlendState = &colorBlending;//optional
-	pipelineInfo.pDynamicState = nullptr;//optional
-	pipelineInfo.layout = mPipelineLayout;
-	pipelineInfo.renderPass = mRenderPass;
-	pipelineInfo.subpass = 0;
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;	//optional
-	pipelineInfo.basePipelineIndex = -1;				//optional
-
-	//The vkCreateGraphicsPipelines function 
-	//		actually has more parameters than 
-	//		the usual object creation functions in Vulkan
-
-	//It is designed to take multiple VkGraphicsPipelineCreateInfo objects 
-	//		and create multiple VkPipeline objects 
-	//		in a single call.
-	
-	//The second parameter, for which 
-	//		we've passed the VK_NULL_HANDLE argument, 
-	//		references an optional VkPipelineCache object. 
-	//A pipeline cache can be used to store and reuse data 
-	//		relevant to pipeline creation across multiple calls to vkCreateGraphicsPipelines 
-	//		and even across program executions 
-	//		if the cache is stored to a file.
-	// This makes it possible to significantly 
-	//		speed up pipeline creation at a later time.
-	if (vkCreateGraphicsPipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mGraphicsPipeline) != VK_SUCCESS )
+	//Same directory ShaderManifest falls back to, the script compiles the sources next to it
+	std::string shaderDir = mSettings.shaderDir.empty() ? "Shaders" : mSettings.shaderDir;
+#ifdef _WIN32
+	std::string command = "python \"" + shaderDir + "/CompileShaders.py\"";
+#else
+	std::string command = "python3 \"" + shaderDir + "/CompileShaders.py\"";
+#endif
+	//Without --embed the script would delete the header the next build compiles in
+	if (ShaderManifest::hasEmbeddedModules())
 	{
-		throw std::runtime_error("Failed to create graphics pipeline!");
+		command += " --embed";
 	}
-
-	vkDestroyShaderModule(mDevice, vertShaderModule, nullptr);
-	vkDestroyShaderModule(mDevice, fragShaderModule, nullptr);
+	mShaderWatcher.create(shaderDir, command);
 }
 
-VkShaderModule HelloTriangleApplication::createShaderModule(const std::vector<char>& code)
+void HelloTriangleApplication::reloadShaders()
 {
-	VkShaderModuleCreateInfo createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(mDevice, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+	//The rebuilt modules are files, even if the executable started with embedded ones
+	ShaderManifest previous = mShaders;
+	try
 	{
-		throw std::runtime_error("failed to create shader module!");
+		mShaders.load(mSettings.shaderDir.empty() ? "Shaders" : mSettings.shaderDir);
 	}
-	return shaderModule;
+	catch (const std::runtime_error &error)
+	{
+		std::cerr << "shader reload: " << error.what() << std::endl;
+		mShaders = previous;
+		return;
+	}
+
+	//Shader modules are created here, the pipelines are compiled on the compile thread
+	//	and updatePipelines swaps them in once they are done.
+	mPipelines.reload(mShaders.changedSources(previous));
 }
 
 /************************************************************************/
-/*  specify how many color and depth buffers there will be, 
-/*	how many samples to use for each of them 
-/*	and how their contents should be handled throughout the rendering operations                                                                     */
+/*	The frame as a render graph.
+/*	Passes only declare which images and buffers they use and how,
+/*	RenderGraph derives the render passes, load and store ops, 
+/*	layout transitions and pipeline barriers from that.
 /************************************************************************/
-void HelloTriangleApplication::createRenderPass()
+void HelloTriangleApplication::createRenderGraph()
 {
-	VkAttachmentDescription colorAttachment = {};
-	colorAttachment.format = mSwapChainFormat;
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT; //1 sample
+	mRenderGraph.create(mDevice, mAllocator);
+
+	//The image the frame ends up in.
+	//A swap chain image becomes available to COLOR_ATTACHMENT_OUTPUT 
+	//	through drawFrame's wait on mImageAvailableSemaphores,
+	//	the graph makes its layout transition wait for that stage.
+	//Headless frames are never presented, leave them ready to be copied out instead
+	if (mSettings.headless)
+	{
+		mBackBuffer = mRenderGraph.importImage("back buffer", mSwapChainFormat, VK_SAMPLE_COUNT_1_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 0);
+	}
+	else
+	{
+		mBackBuffer = mRenderGraph.importImage("back buffer", mSwapChainFormat, VK_SAMPLE_COUNT_1_BIT,
+			VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	}
 
-	/************************************************************************/
-	/*The loadOp and storeOp determine what to do with the data in the attachment before rendering and after rendering.
+	//--gpu-culling: the compute shader decides which objects the scene draws.
+	//The draw commands and their count are rewritten every frame,
+	//	the graph orders that after the previous frame's indirect draw
+	//	and the indirect draw after the culling pass.
+	RenderGraph::ResourceId drawCommandBuffer = 0;
+	RenderGraph::ResourceId drawCountBuffer = 0;
+	if (mSettings.gpuCulling)
+	{
+		RenderGraph::ResourceId objects = mRenderGraph.importBuffer("objects");
+		drawCommandBuffer = mRenderGraph.importBuffer("draw commands");
+		drawCountBuffer = mRenderGraph.importBuffer("draw count");
 
-	/* LOAD_OP:
-	/*		VK_ATTACHMENT_LOAD_OP_LOAD: Preserve the existing contents of the attachment
-	/*		VK_ATTACHMENT_LOAD_OP_CLEAR: Clear the values to a constant at the start
-	/*		VK_ATTACHMENT_LOAD_OP_DONT_CARE: Existing contents are undefined; we don't care about them
-	/*
-	/* STORE_OP:
-	/*
-	/*
-	/************************************************************************/
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-
-	//storeOp
-	//******************************************
-	//VK_ATTACHMENT_STORE_OP_STORE: 
-	//			Rendered contents will be stored 
-	//			in memory and can be read later
-	//VK_ATTACHMENT_STORE_OP_DONT_CARE : 
-	//			Contents of the framebuffer 
-	//			will be undefined 
-	//			after the rendering operation
-	//******************************************
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		RenderGraph::PassId reset = mRenderGraph.addPass("reset draw count", RenderGraph::PassType::Transfer,
+			[this](VkCommandBuffer commandBuffer, const RenderGraph::PassContext &context)
+			{
+				mCulling.recordReset(commandBuffer);
+			});
+		mRenderGraph.use(reset, drawCountBuffer, RenderGraph::Usage::TransferDestination);
+		//Without VK_KHR_draw_indirect_count the unused commands are zeroed as well
+		if (mDrawIndexedIndirectCount == nullptr)
+		{
+			mRenderGraph.use(reset, drawCommandBuffer, RenderGraph::Usage::TransferDestination);
+		}
 
-	/************************************************************************/
-	/*	VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL: 
-	/*		Images used as color attachment
-	/*	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: 
-	/*		Images to be presented in the swap chain
-	/*	VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: 
-	/*		Images to be used as destination 
-	/*		for a memory copy operation
-	/************************************************************************/
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-	//initialLayout specifies which layout the image will have before the render pass begins.
-	//finalLayout specifies the layout to automatically transition to when the render pass finishes
+		RenderGraph::PassId cull = mRenderGraph.addPass("cull", RenderGraph::PassType::Compute,
+			[this](VkCommandBuffer commandBuffer, const RenderGraph::PassContext &context)
+			{
+				mCulling.recordCull(commandBuffer);
+			});
+		mRenderGraph.use(cull, objects, RenderGraph::Usage::StorageRead);
+		mRenderGraph.use(cull, drawCommandBuffer, RenderGraph::Usage::StorageWrite);
+		mRenderGraph.use(cull, drawCountBuffer, RenderGraph::Usage::StorageWrite);
+
+		//The readback buffers are only read by the host, importing one keeps the pass from being culled
+		if (mSettings.verifyCulling)
+		{
+			RenderGraph::ResourceId readback = mRenderGraph.importBuffer("culling readback");
+			RenderGraph::PassId copy = mRenderGraph.addPass("read back draws", RenderGraph::PassType::Transfer,
+				[this](VkCommandBuffer commandBuffer, const RenderGraph::PassContext &context)
+				{
+					mCulling.recordReadback(commandBuffer, context.frameIndex);
+				});
+			mRenderGraph.use(copy, drawCommandBuffer, RenderGraph::Usage::TransferSource);
+			mRenderGraph.use(copy, drawCountBuffer, RenderGraph::Usage::TransferSource);
+			mRenderGraph.use(copy, readback, RenderGraph::Usage::TransferDestination);
+		}
+	}
 
-	//A single render pass can consist of multiple subpasses
-	//Subpasses are subsequent rendering operations 
-	//that depend on the contents of framebuffers in previous passes,
+	//The scene: the draws of recordDraws, inline or from the workers' secondary command buffers.
+	//The single indirect draw of --gpu-culling is recorded by one worker.
+	mScenePass = mRenderGraph.addPass("scene", RenderGraph::PassType::Graphics,
+		[this](VkCommandBuffer commandBuffer, const RenderGraph::PassContext &context)
+		{
+			uint32_t drawCount = mSettings.gpuCulling ? 1 : mSettings.drawCount;
+			if (context.contents == VK_SUBPASS_CONTENTS_INLINE)
+			{
+				recordDraws(commandBuffer, 0, drawCount);
+				return;
+			}
 
-	/************************************************************************/
-	/*	VkAttchmentReference                                                                     */
-	/************************************************************************/
-	VkAttachmentReference colorAttachmentRef = {};
-	colorAttachmentRef.attachment = 0;
-	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-	//The attachment parameter specifies 
-	//which attachment to reference 
-	//by its index in the attachment descriptions array.
-
-	//The attachment parameter specifies 
-	//		which attachment to reference 
-	//		by its index in the attachment descriptions array.
-
-	VkSubpassDescription subpass = {};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	//The index of the attachment in this array 
-	//is directly referenced 
-	//from the fragment shader 
-	//with the layout(location = 0) out vec4 outColor 
-	//directive!
-
-	subpass.pColorAttachments = &colorAttachmentRef;
-
-	//pInputAttachments			: Attachments that are read from a shader
-	//pResolveAttachments		: Attachments used 
-	//			for multisampling color attachments
-	//pDepthStencilAttachment	: Attachments for depth and stencil data
-	//pPreserveAttachments		: Attachments that are not used 
-	//			by this subpass, 
-	//			but for which the data must be preserved
-	
-	//Render Pass
-	VkRenderPassCreateInfo renderPassInfo = {};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = 1;
-	renderPassInfo.pAttachments = &colorAttachment;
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
+			//The primary may not record any draw commands itself inside this render pass
+			ParallelRecorder::RecordFunction recordFunction =
+				[this](VkCommandBuffer secondary, uint32_t firstDraw, uint32_t drawCount)
+				{
+					recordDraws(secondary, firstDraw, drawCount);
+				};
+			const std::vector<VkCommandBuffer> &secondaries = mRecorder.record(context.frameIndex, context.renderPass,
+				context.framebuffer, drawCount, recordFunction);
+			vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+		});
+
+	//Cleared at the start of the pass,
+	//	the graph turns that into VK_ATTACHMENT_LOAD_OP_CLEAR.
+	//Depth and the multisampled color only live during the pass:
+	//	nothing reads them afterwards, so they are never stored (VK_ATTACHMENT_STORE_OP_DONT_CARE)
+	//	and the graph creates them as transient attachments in lazily allocated memory.
+	//The multisampled color is resolved into the back buffer at the end of the subpass,
+	//	only the back buffer is stored, the presentation engine reads it after the frame.
+	mSampleCount = chooseSampleCount();
+	VkClearValue clearColor = { 0.0f,0.0f,0.0f,1.0f };
+	VkClearValue clearDepth = {};
+	clearDepth.depthStencil = { 1.0f, 0 };
+
+	RenderGraph::ResourceId depth = mRenderGraph.createImage("depth", findDepthFormat(), mSampleCount);
+	mRenderGraph.use(mScenePass, depth, RenderGraph::Usage::DepthAttachment, &clearDepth);
+	if (mSampleCount == VK_SAMPLE_COUNT_1_BIT)
+	{
+		mRenderGraph.use(mScenePass, mBackBuffer, RenderGraph::Usage::ColorAttachment, &clearColor);
+	}
+	else
+	{
+		RenderGraph::ResourceId color = mRenderGraph.createImage("multisampled color", mSwapChainFormat, mSampleCount);
+		mRenderGraph.use(mScenePass, color, RenderGraph::Usage::ColorAttachment, &clearColor);
+		mRenderGraph.use(mScenePass, mBackBuffer, RenderGraph::Usage::ResolveAttachment);
+	}
 
-	if (vkCreateRenderPass(mDevice, &renderPassInfo, nullptr, &mRenderPass) != VK_SUCCESS)
+	if (mSettings.gpuCulling)
 	{
-		throw std::runtime_error("Failed to create render pass!");
+		mRenderGraph.use(mScenePass, drawCommandBuffer, RenderGraph::Usage::IndirectBuffer);
+		mRenderGraph.use(mScenePass, drawCountBuffer, RenderGraph::Usage::IndirectBuffer);
 	}
+
+	mRenderGraph.compile();
 }
 
-void HelloTriangleApplication::createFrameBuffers()
+void HelloTriangleApplication::createRenderTargets()
 {
-	mSwapChainFrameBuffers.resize(mSwapChainImages.size());
-	for (size_t i = 0;i < mSwapChainImageViews.size();++i)
+	mRenderGraph.setImportedImages(mBackBuffer, mSwapChainImages, mSwapChainImageViews);
+	mRenderGraph.createTargets(mSwapChainExtent);
+}
+
+VkSampleCountFlagBits HelloTriangleApplication::chooseSampleCount() const
+{
+	//Both attachments of the pass need the same count
+	const VkPhysicalDeviceLimits &limits = mDeviceProfile.properties.limits;
+	VkSampleCountFlags supported = limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+
+	uint32_t samples = mSettings.msaaSamples;
+	while (samples > 1 && (supported & samples) == 0)
+	{
+		samples /= 2;
+	}
+	if (samples != mSettings.msaaSamples)
 	{
-		VkImageView attachments[] = { mSwapChainImageViews[i] };
-		VkFramebufferCreateInfo frameBufferInfo = {};
-		frameBufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		frameBufferInfo.renderPass = mRenderPass;
-		frameBufferInfo.pAttachments = attachments;
-		frameBufferInfo.width = mSwapChainExtent.width;
-		frameBufferInfo.height = mSwapChainExtent.height;
-		frameBufferInfo.layers = 1;
+		std::cout << "msaa: " << mSettings.msaaSamples << " samples not supported, using " << samples << std::endl;
+	}
+	return static_cast<VkSampleCountFlagBits>(samples);
+}
 
-		if (vkCreateFramebuffer(mDevice, &frameBufferInfo, nullptr, &mSwapChainFrameBuffers[i]) != VK_SUCCESS)
+VkFormat HelloTriangleApplication::findDepthFormat() const
+{
+	//D32_SFLOAT is the most precise, the others are there for devices without it.
+	//No stencil is used, formats with one just come along.
+	const VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT };
+	for (VkFormat format : candidates)
+	{
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(mPhysicalDevice, format, &properties);
+		if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
 		{
-			throw std::runtime_error("Failed to create Framebuffer");
+			return format;
 		}
 	}
+	throw std::runtime_error("failed to find a supported depth format!");
 }
 
 void HelloTriangleApplication::createCommandPool()
 {
-	QueueFamily queueFamilyIndice = findQueueFamilies(mPhysicalDevice);
+	const QueueFamily &queueFamilyIndice = mQueueFamilies;
 
 	VkCommandPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	poolInfo.queueFamilyIndex = queueFamilyIndice.graphicsFamily.value();
-	poolInfo.flags = 0;
+	//The static command buffers of one frame slot are re-recorded
+	//	when a pipeline compiled in the background replaces the fallback.
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 	//Command buffers are executed 
 	//by submitting them 
@@ -1094,9 +1715,119 @@ void HelloTriangleApplication::createCommandPool()
 	}
 }
 
+void HelloTriangleApplication::createVertexBuffers()
+{
+	const QueueFamily &queueFamilyIndice = mQueueFamilies;
+	uint32_t graphicsFamily = queueFamilyIndice.graphicsFamily.value();
+	uint32_t transferFamily = queueFamilyIndice.transferFamily.value_or(graphicsFamily);
+	mUploads.create(mDevice, mAllocator, transferFamily, mTransferQueue, graphicsFamily, UPLOAD_RING_SIZE);
+
+	//Device-local memory is the fastest for the GPU to read,
+	//	but usually can't be written by the CPU, hence TRANSFER_DST and the staging copy.
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkDeviceSize vertexBufferSize = sizeof(vertices[0]) * vertices.size();
+	bufferInfo.size = vertexBufferSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	mVertexBuffer = mAllocator.createBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mVertexBufferMemory);
+
+	VkDeviceSize indexBufferSize = sizeof(indices[0]) * indices.size();
+	bufferInfo.size = indexBufferSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	mIndexBuffer = mAllocator.createBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mIndexBufferMemory);
+	mIndexCount = static_cast<uint32_t>(indices.size());
+
+	//Where every draw puts the mesh, read by the vertex shader (and the culling shader)
+	float meshRadius = 0.0f;
+	for (const Vertex &vertex : vertices)
+	{
+		meshRadius = std::max(meshRadius, glm::length(vertex.pos));
+	}
+	mObjects = ObjectCulling::makeGrid(mSettings.drawCount, meshRadius);
+	VkDeviceSize objectBufferSize = sizeof(mObjects[0]) * mObjects.size();
+	bufferInfo.size = objectBufferSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	mObjectBuffer = mAllocator.createBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mObjectBufferMemory);
+
+	//All copies go out in one submission.
+	//Nothing waits for it here, the first frame's submission waits on its semaphore.
+	mUploads.uploadBuffer(mVertexBuffer, 0, vertices.data(), vertexBufferSize,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	mUploads.uploadBuffer(mIndexBuffer, 0, indices.data(), indexBufferSize,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+	mUploads.uploadBuffer(mObjectBuffer, 0, mObjects.data(), objectBufferSize,
+		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	mUploads.submit();
+}
+
+void HelloTriangleApplication::createObjectDescriptorSet()
+{
+	//The same bindings as set 0 of the vertex shader,
+	//	so mLayouts hands out the set layout of mPipelineLayout.
+	VkDescriptorSetLayoutBinding binding = {};
+	binding.binding = 0;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	binding.descriptorCount = 1;
+	binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	VkDescriptorSetLayout setLayout = mLayouts.getSetLayout({ binding });
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 1;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	if (vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor pool!");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = mDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &setLayout;
+	if (vkAllocateDescriptorSets(mDevice, &allocInfo, &mObjectSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate descriptor set!");
+	}
+
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = mObjectBuffer;
+	bufferInfo.range = VK_WHOLE_SIZE;
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = mObjectSet;
+	write.dstBinding = 0;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &bufferInfo;
+	vkUpdateDescriptorSets(mDevice, 1, &write, 0, nullptr);
+}
+
+void HelloTriangleApplication::createCulling()
+{
+	if (!mSettings.gpuCulling)
+		return;
+
+	//The culling pipeline goes through the same cache as the graphics pipelines
+	mCulling.create(mDevice, mDeviceProfile.properties.limits, mAllocator, mLayouts, mShaders, mPipelineCache.handle(),
+		mObjectBuffer, mObjects, mIndexCount, mDrawIndexedIndirectCount, mSettings.verifyCulling, MAX_FRAMES_IN_FLIGHT);
+}
+
 void HelloTriangleApplication::createCommandBuffer()
 {
-	mCommandBuffers.resize(mSwapChainFrameBuffers.size());
+	//The other modes record their command buffers every frame
+	if (!needsRecordMode(ApplicationSettings::RecordMode::Static))
+		return;
+
+	mCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT * mSwapChainImages.size());
 
 	// VkCommandBufferAllocateInfo specifies the command pool 
 	//		and number of buffers to allocate:
@@ -1116,94 +1847,206 @@ void HelloTriangleApplication::createCommandBuffer()
 		throw std::runtime_error("failed to allocate command buffers!");
 	}
 
-	for (size_t i = 0;i < mCommandBuffers.size();++i)
+	for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+	{
+		for (uint32_t image = 0; image < mSwapChainImages.size(); ++image)
+		{
+			recordCommandBuffer(mCommandBuffers[commandBufferIndex(frame, image)], image, static_cast<uint32_t>(frame));
+		}
+	}
+	mStaleCommandBufferSlots.assign(MAX_FRAMES_IN_FLIGHT, false);
+}
+
+void HelloTriangleApplication::createProfiler()
+{
+	if (mSettings.profilePath.empty())
+		return;
+
+	uint32_t graphicsFamily = mQueueFamilies.graphicsFamily.value();
+	mProfiler.create(mDevice, mDeviceProfile.properties,
+		mDeviceProfile.queueFamilies[graphicsFamily].timestampValidBits, MAX_FRAMES_IN_FLIGHT);
+}
+
+void HelloTriangleApplication::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frameIndex)
+{
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	//The flags parameter specifies how we're going to use the command buffer. 
+	//The following values are available:
+	//		VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT: The command buffer will be rerecorded right after executing it once.
+	//		VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT : This is a secondary command buffer that will be entirely within a single render pass.
+	//		VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT : The command buffer can be resubmitted while it is also already pending execution.
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	//The pInheritanceInfo parameter is only relevant for secondary command buffers.
+	//	It specifies which state to inherit from 
+	//	the calling primary command buffers
+	beginInfo.pInheritanceInfo = nullptr; //optional
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin recording command buffer!");
+	}
+
+	mProfiler.resetQueries(commandBuffer, frameIndex);
+	mProfiler.beginGpuScope(commandBuffer, frameIndex, "render graph");
+
+	//The graph begins the render pass of every graphics pass
+	//	with vkCmdBeginRenderPass, whose final parameter controls 
+	//		how the drawing commands 
+	//		within the render pass will be provided.
+	//It can have one of two values :
+	//		VK_SUBPASS_CONTENTS_INLINE: The render pass commands will be embedded
+	//			in the primary command buffer itself 
+	//			and no secondary command buffers will be executed.
+	//		VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS: The render pass commands 
+	//			will be executed from secondary command buffers.
+	mRenderGraph.setSubpassContents(mScenePass, VK_SUBPASS_CONTENTS_INLINE);
+	mRenderGraph.execute(commandBuffer, imageIndex, frameIndex);
+
+	mProfiler.endGpuScope(commandBuffer, frameIndex, "render graph");
+	
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record command buffer!");
+	}
+}
+
+void HelloTriangleApplication::recordDraws(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount) const
+{
+	/************************************************************************/
+	/*	Basic drawing commands
+	/************************************************************************/
+	//Secondary command buffers don't inherit any state from the primary,
+	//	so all of this is recorded again into every one of them.
+
+	// bind the graphics pipeline:
+	//	The second parameter specifies 
+	//	if the pipeline object is a graphics or compute pipeline. 
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mGraphicsPipeline);
+
+	//Viewport and scissor are dynamic state of the pipeline, 
+	//	so they follow the swap chain extent without rebuilding the pipeline.
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)mSwapChainExtent.width;
+	viewport.height = (float)mSwapChainExtent.height;
+	/*
+	 *	The minDepth and maxDepth values specify 
+	 *	the range of depth values to use for the framebuffer
+	 */
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	//While viewports define the transformation from the image to the framebuffer,
+	//scissor rectangles define in which regions pixels will actually be stored.
+	VkRect2D scissor = {};
+	scissor.offset = { 0,0 };
+	scissor.extent = mSwapChainExtent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	//Binding 0 reads from the start of the vertex buffer
+	VkBuffer vertexBuffers[] = { mVertexBuffer };
+	VkDeviceSize offsets[] = { 0 };
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, mIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+	//The objects, indexed by gl_InstanceIndex
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, 0, 1, &mObjectSet, 0, nullptr);
+
+	//The compute shader has already written the commands of the visible objects
+	if (mSettings.gpuCulling)
+	{
+		mCulling.recordDraw(commandBuffer);
+		return;
+	}
+
+	//indexCount: Number of indices to draw.
+	//instanceCount : Used for instanced rendering, 
+	//			use 1 if you're not doing that.
+	//firstIndex : Used as an offset into the index buffer.
+	//vertexOffset : Added to every index before looking up the vertex.
+	//firstInstance : Used as an offset for instanced rendering, 
+	//			defines the lowest value of gl_InstanceIndex.
+	//Every draw is the same mesh, firstInstance selects the object it is drawn at.
+	//Objects outside the view are drawn anyway, --gpu-culling skips them.
+	for (uint32_t i = 0; i < drawCount; ++i)
 	{
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		//The flags parameter specifies how we're going to use the command buffer. 
-		//The following values are available:
-		//		VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT: The command buffer will be rerecorded right after executing it once.
-		//		VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT : This is a secondary command buffer that will be entirely within a single render pass.
-		//		VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT : The command buffer can be resubmitted while it is also already pending execution.
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		//The pInheritanceInfo parameter is only relevant for secondary command buffers.
-		//	It specifies which state to inherit from 
-		//	the calling primary command buffers
-		beginInfo.pInheritanceInfo = nullptr; //optional
+		vkCmdDrawIndexed(commandBuffer, mIndexCount, 1, 0, 0, firstDraw + i);
+	}
+}
+
+void HelloTriangleApplication::createFrameCommandBuffers()
+{
+	if (!needsRecordMode(ApplicationSettings::RecordMode::PerFrame)
+		&& !needsRecordMode(ApplicationSettings::RecordMode::Threaded))
+		return;
 
-		if (vkBeginCommandBuffer(mCommandBuffers[i], &beginInfo) != VK_SUCCESS)
+	const QueueFamily &queueFamilyIndice = mQueueFamilies;
+
+	mFrameCommandPools.resize(MAX_FRAMES_IN_FLIGHT);
+	mFrameCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		//TRANSIENT: the command buffer is re-recorded every frame,
+		//	the whole pool is reset at once with vkResetCommandPool.
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamilyIndice.graphicsFamily.value();
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &mFrameCommandPools[i]) != VK_SUCCESS)
 		{
-			throw std::runtime_error("failed to begin recording command buffer!");
+			throw std::runtime_error("failed to create frame command pool!");
 		}
 
-		VkRenderPassBeginInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		//The first parameters are the render pass itself 
-		//	and the attachments to bind.
-		renderPassInfo.renderPass = mRenderPass;
-		//The next two parameters define the size of the render area.
-		// The render area defines where shader loads and stores will take place. 
-		//The pixels outside this region will have undefined values.
-		// It should match the size of the attachments for best performance.
-		renderPassInfo.renderArea.offset = { 0,0 };
-		renderPassInfo.renderArea.extent = mSwapChainExtent;
-
-		//The last two parameters define the clear values to use for VK_ATTACHMENT_LOAD_OP_CLEAR, 
-		//	which we used as load operation for the color attachment.
-		VkClearValue clearColor = { 0.0f,0.0f,0.0f,1.0f };
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearColor;
-		vkCmdBeginRenderPass(mCommandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-		//The render pass can now begin.
-		//All of the functions that 
-		//	record commands can be recognized 
-		//	by their vkCmd prefix
-
-		//The first parameter for every command 
-		//		is always the command buffer 
-		//		to record the command to.
-		//
-		//The second parameter specifies 
-		//		the details of the render pass 
-		//		we've just provided.
-
-		//The final parameter controls 
-		//		how the drawing commands 
-		//		within the render pass will be provided.
-
-		//It can have one of two values :
-		//		VK_SUBPASS_CONTENTS_INLINE: The render pass commands will be embedded
-		//			in the primary command buffer itself 
-		//			and no secondary command buffers will be executed.
-		//		VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS: The render pass commands 
-		//			will be executed from secondary command buffers.
-
-		/************************************************************************/
-		/*	Basic drawing commands
-		/************************************************************************/
-		// bind the graphics pipeline:
-		//	The second parameter specifies 
-		//	if the pipeline object is a graphics or compute pipeline. 
-		vkCmdBindPipeline(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, mGraphicsPipeline);
-		
-		//vertexCount: Even though we don't have a vertex buffer, 
-		//			we technically still have 3 vertices to draw.
-		//instanceCount : Used for instanced rendering, 
-		//			use 1 if you're not doing that.
-		//firstVertex : Used as an offset into the vertex buffer,
-		//			defines the lowest value of gl_VertexIndex.
-		//firstInstance : Used as an offset for instanced rendering, 
-		//			defines the lowest value of gl_InstanceIndex.
-		vkCmdDraw(mCommandBuffers[i], 3, 1, 0, 0);
-		
-		vkCmdEndRenderPass(mCommandBuffers[i]);
-		
-		if (vkEndCommandBuffer(mCommandBuffers[i]) != VK_SUCCESS)
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = mFrameCommandPools[i];
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(mDevice, &allocInfo, &mFrameCommandBuffers[i]) != VK_SUCCESS)
 		{
-			throw std::runtime_error("Failed to record command buffer!");
+			throw std::runtime_error("failed to allocate frame command buffer!");
 		}
 	}
+
+	if (needsRecordMode(ApplicationSettings::RecordMode::Threaded))
+	{
+		mRecorder.create(mDevice, queueFamilyIndice.graphicsFamily.value(), mSettings.recordThreads, MAX_FRAMES_IN_FLIGHT);
+	}
+}
+
+VkCommandBuffer HelloTriangleApplication::recordFrameCommandBuffer(uint32_t frameIndex, uint32_t imageIndex)
+{
+	//drawFrame has waited for the fence of this slot,
+	//	so the pool's previous command buffer is not pending anymore.
+	vkResetCommandPool(mDevice, mFrameCommandPools[frameIndex], 0);
+	VkCommandBuffer commandBuffer = mFrameCommandBuffers[frameIndex];
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin recording command buffer!");
+	}
+
+	mProfiler.resetQueries(commandBuffer, frameIndex);
+	mProfiler.beginGpuScope(commandBuffer, frameIndex, "render graph");
+
+	//Threaded mode: the draws come from the workers' secondary command buffers
+	mRenderGraph.setSubpassContents(mScenePass, mRecordMode == ApplicationSettings::RecordMode::PerFrame
+		? VK_SUBPASS_CONTENTS_INLINE : VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	mRenderGraph.execute(commandBuffer, imageIndex, frameIndex);
+
+	mProfiler.endGpuScope(commandBuffer, frameIndex, "render graph");
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record command buffer!");
+	}
+	return commandBuffer;
 }
 
 void HelloTriangleApplication::drawFrame()
@@ -1231,26 +2074,222 @@ void HelloTriangleApplication::drawFrame()
 	//Fences are mainly designed to synchronize your application itself with rendering operation, 
 	//whereas semaphores are used to synchronize operations within or across command queues.
 
+	GpuProfiler::CpuScope frameScope(mProfiler, "drawFrame");
+
+	//The fence of this slot was signaled by the submission 
+	//	MAX_FRAMES_IN_FLIGHT frames ago, 
+	//	after that its semaphores and the command buffer it used are free again.
+	FrameStats::Clock::time_point waitStart = FrameStats::Clock::now();
+	vkWaitForFences(mDevice, 1, &mInFlightFences[mCurrentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+	//Only the waits count, not the CPU work between them
+	mFrameStats.addCpuWait(waitStart);
+	mProfiler.addCpuEvent("wait for frame", waitStart, FrameStats::Clock::now());
+
+	//The timestamps of the frame that used this slot are ready as well
+	double gpuMs = mProfiler.collect(mCurrentFrame);
+	if (gpuMs >= 0.0)
+	{
+		mFrameStats.addGpuTime(gpuMs);
+	}
+
+	//So are the draw commands its culling pass read back
+	if (mSettings.verifyCulling)
+	{
+		mCulling.verify(static_cast<uint32_t>(mCurrentFrame));
+	}
+
+	//Everything retired at least MAX_FRAMES_IN_FLIGHT frames ago is unused now
+	destroyRetiredSwapChains(false);
+
+	//So is the per-frame memory this slot handed out last time
+	mAllocator.beginFrame(static_cast<uint32_t>(mCurrentFrame));
+	if (mSettings.verifyCulling)
+	{
+		mCulling.beginFrame(static_cast<uint32_t>(mCurrentFrame));
+		//The static command buffers of this slot copy into the readback buffer just replaced
+		if (!mStaleCommandBufferSlots.empty())
+		{
+			mStaleCommandBufferSlots[mCurrentFrame] = true;
+		}
+	}
+
+	//and the upload batches those frames consumed
+	if (mFrameNumber + 1 >= MAX_FRAMES_IN_FLIGHT)
+	{
+		mUploads.update(mFrameNumber + 1 - MAX_FRAMES_IN_FLIGHT);
+		//and the pipelines replaced by a shader reload before them
+		mPipelines.destroyRetired(mFrameNumber + 1 - MAX_FRAMES_IN_FLIGHT);
+	}
+
+	//Switch to pipelines that finished compiling in the background
+	updatePipelines();
+
 	/************************************************************************/
 	/*		Acquiring an image from the swap chain
 	/************************************************************************/
 	uint32_t imageIndex;
-	vkAcquireNextImageKHR(mDevice, mSwapChain, 
-		std::numeric_limits<uint64_t>::max(), 
-		mImageAvailableSemaphore, 
-		VK_NULL_HANDLE, 
-		&imageIndex);
-	
+	if (mSettings.headless)
+	{
+		//No presentation engine: walk the ring of offscreen images ourselves
+		imageIndex = mNextOffscreenImage;
+		mNextOffscreenImage = (mNextOffscreenImage + 1) % static_cast<uint32_t>(mSwapChainImages.size());
+	}
+	else
+	{
+		GpuProfiler::CpuScope acquireScope(mProfiler, "acquire");
+		VkResult result = vkAcquireNextImageKHR(mDevice, mSwapChain, 
+			std::numeric_limits<uint64_t>::max(), 
+			mImageAvailableSemaphores[mCurrentFrame], 
+			VK_NULL_HANDLE, 
+			&imageIndex);
+
+		//VK_ERROR_OUT_OF_DATE_KHR: The swap chain has become incompatible with the surface 
+		//		and can no longer be used for rendering. Usually happens after a window resize.
+		//VK_SUBOPTIMAL_KHR : The swap chain can still be used to successfully present to the surface, 
+		//		but the surface properties are no longer matched exactly.
+		//		The image was acquired (and the semaphore will be signaled), so draw it and recreate after presenting.
+		if (result == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			//Nothing was submitted, the fence of this slot is still signaled
+			recreateSwapChain();
+			return;
+		}
+		else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+		{
+			throw std::runtime_error("failed to acquire swap chain image!");
+		}
+	}
+
+	//The swap chain may hand out images out of order, 
+	//	or have fewer images than MAX_FRAMES_IN_FLIGHT, 
+	//	so the image we got can still be used by an older frame.
+	if (mImagesInFlight[imageIndex] != VK_NULL_HANDLE)
+	{
+		FrameStats::Clock::time_point imageWaitStart = FrameStats::Clock::now();
+		vkWaitForFences(mDevice, 1, &mImagesInFlight[imageIndex], VK_TRUE, std::numeric_limits<uint64_t>::max());
+		mFrameStats.addCpuWait(imageWaitStart);
+	}
+	mImagesInFlight[imageIndex] = mInFlightFences[mCurrentFrame];
+
+	/************************************************************************/
+	/*		Submitting the command buffer
+	/************************************************************************/
+	//We want to wait with writing colors to the image until it's available, 
+	//	the earlier stages of the pipeline can already run.
+	//Headless frames have nothing to wait for and nobody to signal, 
+	//	the in-flight fence alone orders them.
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<VkPipelineStageFlags> waitStages;
+	if (!mSettings.headless)
+	{
+		waitSemaphores.push_back(mImageAvailableSemaphores[mCurrentFrame]);
+		waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	}
+	VkSemaphore signalSemaphores[] = { mRenderFinishedSemaphores[mCurrentFrame] };
+
+	//Uploads finished on the transfer queue since the last frame:
+	//	wait for their semaphores and run their ownership acquire first.
+	std::vector<VkCommandBuffer> commandBuffers;
+	mUploads.acquireUploads(mFrameNumber + 1, waitSemaphores, waitStages, commandBuffers);
+
+	//Static command buffers only need to be looked up,
+	//	the other modes pay for recording here.
+	auto recordStart = std::chrono::steady_clock::now();
+	if (mRecordMode == ApplicationSettings::RecordMode::Static)
+	{
+		commandBuffers.push_back(mCommandBuffers[commandBufferIndex(mCurrentFrame, imageIndex)]);
+	}
+	else
+	{
+		GpuProfiler::CpuScope recordScope(mProfiler, "record");
+		commandBuffers.push_back(recordFrameCommandBuffer(static_cast<uint32_t>(mCurrentFrame), imageIndex));
+	}
+	mRecordMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
+	submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+	submitInfo.pCommandBuffers = commandBuffers.data();
+	submitInfo.signalSemaphoreCount = mSettings.headless ? 0 : 1;
+	submitInfo.pSignalSemaphores = signalSemaphores;
+
+	//Unlike semaphores, fences have to be reset manually.
+	//Only reset right before the submit that will signal it again.
+	vkResetFences(mDevice, 1, &mInFlightFences[mCurrentFrame]);
+
+	{
+		GpuProfiler::CpuScope submitScope(mProfiler, "submit");
+		if (vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, mInFlightFences[mCurrentFrame]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to submit draw command buffer!");
+		}
+	}
+	mProfiler.frameSubmitted(mCurrentFrame);
+	++mFrameNumber;
+
+	/************************************************************************/
+	/*		Presentation
+	/************************************************************************/
+	if (!mSettings.headless)
+	{
+		GpuProfiler::CpuScope presentScope(mProfiler, "present");
+
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = signalSemaphores;
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &mSwapChain;
+		presentInfo.pImageIndices = &imageIndex;
+		presentInfo.pResults = nullptr; //optional
+
+		VkResult result = vkQueuePresentKHR(mPresentQueue, &presentInfo);
+
+		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || mFrameBufferResized)
+		{
+			mFrameBufferResized = false;
+			recreateSwapChain();
+		}
+		else if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to present swap chain image!");
+		}
+	}
+
+	mCurrentFrame = (mCurrentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	mFrameStats.endFrame();
+	if (mRecordMode == ApplicationSettings::RecordMode::Threaded)
+	{
+		mRecorder.endFrame();
+	}
 }
 
-void HelloTriangleApplication::createSemaphore()
+void HelloTriangleApplication::createSyncObjects()
 {
+	mImageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+	mRenderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+	mInFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+	mImagesInFlight.resize(mSwapChainImages.size(), VK_NULL_HANDLE);
+
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	//Fences are created signaled, 
+	//	otherwise the very first vkWaitForFences in drawFrame would wait forever.
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 	
-	if (vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &mImageAvailableSemaphore) != VK_SUCCESS ||
-		vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &mRenderFinishedSemaphore) != VK_SUCCESS)
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
 	{
-		throw std::runtime_error("Failed to create semaphores!");
+		if (vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &mImageAvailableSemaphores[i]) != VK_SUCCESS ||
+			vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &mRenderFinishedSemaphores[i]) != VK_SUCCESS ||
+			vkCreateFence(mDevice, &fenceInfo, nullptr, &mInFlightFences[i]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create synchronization objects for a frame!");
+		}
 	}
 }
\ No newline at end of file
@@ -1,12 +1,16 @@
 #pragma once
 
 #define GLFW_INCLUDE_VULKAN
+#ifdef _WIN32
 #define VK_USE_PLATFORM_WIN32_KHR
 #define GLFW_EXPOSE_NATIVE_WIN32
+#endif
 
 #include <vulkan/vulkan.h>
 #include <GLFW/glfw3.h>
+#ifdef _WIN32
 #include <GLFW/glfw3native.h>
+#endif
 
 #include <functional>
 #include <iostream>
@@ -14,13 +18,35 @@
 #include <stdlib.h>
 #include <optional>
 
+#include "ApplicationSettings.h"
+#include "DebugMessageLog.h"
+#include "DeviceAllocator.h"
+#include "DeviceProfile.h"
+#include "FrameStats.h"
+#include "GpuProfiler.h"
+#include "ObjectCulling.h"
+#include "ParallelRecorder.h"
+#include "PipelineCache.h"
+#include "PipelineLayoutCache.h"
+#include "PipelineRegistry.h"
+#include "RenderGraph.h"
+#include "ShaderManifest.h"
+#include "ShaderWatcher.h"
+#include "StartupTimer.h"
+#include "UploadScheduler.h"
+#include "Vertex.h"
+
 class HelloTriangleApplication
 {
 public:
+	explicit HelloTriangleApplication(const ApplicationSettings &settings = ApplicationSettings());
+
 	void run();
 
 private:
 	void initWindow();
+
+	static void frameBufferResizeCallback(GLFWwindow* window, int width, int height);
 	
 	void initVulkan();
 
@@ -36,12 +62,37 @@ private:
 
 	void mainLoop();
 
+	//Draws count frames (0 = until the window is closed),
+	//	returns false if the window was closed before.
+	bool runFrames(uint64_t count);
+
+	//--benchmark-record: the same number of frames in every RecordMode,
+	//	then a table of frame and recording times.
+	void runRecordBenchmark();
+
+	//--benchmark-pipelines: creation time and pipeline cache size of a set of material variants,
+	//	created as independent pipelines and as derivatives of one parent.
+	void runPipelineBenchmark();
+
+	//In benchmark mode every recording path is set up, so mRecordMode can change between frames
+	bool needsRecordMode(ApplicationSettings::RecordMode mode) const
+	{
+		return mSettings.benchmarkRecord || mSettings.recordMode == mode;
+	}
+
 	void cleanUp();
 
-	bool checkValidationLayerSupport();
+	//The first validation layer the loader knows, nullptr if there is none
+	const char* findValidationLayer();
+
+	//Severities and types of --validation, shared by the instance and the persistent messenger
+	void fillDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo);
 
 	std::vector<const char*> getRequiredExtensions();
 
+	//The swap chain extension is only needed when presenting to a window
+	std::vector<const char*> getRequiredDeviceExtensions();
+
 	void setupDebugCallback();
 	
 	VkResult CreateDebugUtilsMessengerEXT(VkInstance instance
@@ -53,23 +104,51 @@ private:
 		,VkDebugUtilsMessengerEXT callback
 		, const VkAllocationCallbacks* pAllocator);
 
+	//Goes straight to the device of the saved profile (--device-profile) if it is still there,
+	//	otherwise profiles and ranks every device and saves the profile of the one picked.
+	//Fills mDeviceProfile and mQueueFamilies, nothing after this queries the device again.
 	void pickPhysicalDevice();
 
-	bool isDeviceSuitable(const VkPhysicalDevice &device);
+	//Logs every device with its score or why it can't be used,
+	//	returns the index of the one selected by --device or else the highest scoring one.
+	int rankPhysicalDevices(const std::vector<DeviceProfile> &profiles);
 
-	void pickPhysicalDevicebyScore();
+	//true if --device is not set or selects the device at index with this UUID
+	bool matchesDeviceOverride(uint32_t index, const uint8_t deviceUUID[VK_UUID_SIZE]);
 
-	int rateDeviceSuitability(const VkPhysicalDevice &device);
+	bool isDeviceSuitable(const DeviceProfile &profile);
 
-	bool checkDeviceExtensionSupport(const VkPhysicalDevice &device);
+	//nullptr if the device has everything the application needs, otherwise what is missing
+	const char* findUnsuitability(const DeviceProfile &profile);
+
+	//0 for unsuitable devices, otherwise ranked by device type, then VRAM, then dedicated queue families
+	uint64_t rateDeviceSuitability(const DeviceProfile &profile);
+
+	//Sum of the DEVICE_LOCAL heaps
+	static VkDeviceSize deviceLocalMemory(const DeviceProfile &profile);
+
+	static const char* deviceTypeName(VkPhysicalDeviceType type);
+
+	bool checkDeviceExtensionSupport(const DeviceProfile &profile);
+
+	//Checked during device selection and enabled on the logical device
+	VkPhysicalDeviceFeatures getRequiredDeviceFeatures();
+
+	bool checkDeviceFeatureSupport(const DeviceProfile &profile);
 
 	struct QueueFamily
 	{
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		//Optional, a family with TRANSFER but neither GRAPHICS nor COMPUTE.
+		//Usually backed by the DMA engines, copies there run next to rendering.
+		std::optional<uint32_t> transferFamily;
+		//false in headless mode, where there is no surface to present to
+		bool requiresPresent = true;
 		bool isComplete()
 		{
-			return graphicsFamily.has_value() && presentFamily.has_value();
+			return graphicsFamily.has_value() 
+				&& (presentFamily.has_value() || !requiresPresent);
 		}
 	};
 
@@ -80,9 +159,12 @@ private:
 		std::vector<VkPresentModeKHR>		presentModes;
 	};
 
-	QueueFamily findQueueFamilies(VkPhysicalDevice device);
+	//Only reads the profile, presentation support comes from querySurface
+	QueueFamily findQueueFamilies(const DeviceProfile &profile);
 
-	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
+	//Formats and present modes from mDeviceProfile,
+	//	the capabilities are queried every time because currentExtent follows the window.
+	SwapChainSupportDetails querySwapChainSupport();
 
 	/*
 	There are three types of settings to determine :
@@ -121,48 +203,172 @@ private:
 	/*The swap extent is the resolution of the swap chain images and it's almost always exactly equal to the resolution of the window that we're drawing to.The range of the possible resolutions is defined in the VkSurfaceCapabilitiesKHR structure.*/
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilites);
 	
+	//Creates the swap chain, passing the current one (if any) as oldSwapchain
+	//	so the presentation engine can hand its resources over.
 	void createSwapChain();
 
+	//Called when the surface changed (resize, VK_ERROR_OUT_OF_DATE_KHR, VK_SUBOPTIMAL_KHR).
+	//Only the extent dependent objects are rebuilt:
+	//	swap chain, image views, framebuffers and command buffers.
+	//The pipeline survives because viewport and scissor are dynamic state.
+	//The old objects are retired instead of destroyed,
+	//	so there is no vkDeviceWaitIdle on the resize path.
+	void recreateSwapChain();
+
+	//Moves the current swap chain objects into mRetiredSwapChains
+	void retireSwapChain();
+
+	//Destroys retired swap chain objects no frame in flight can still use.
+	//force: destroy everything, the caller made sure the device is idle.
+	void destroyRetiredSwapChains(bool force);
+
+	//Headless replacement for createSwapChain:
+	//	a ring of device-local images the render pass draws into,
+	//	stored in mSwapChainImages so image views, framebuffers 
+	//	and command buffers are shared with the windowed path.
+	void createOffscreenTargets();
+
 	void createImageViews();
 
+	//Loaded from disk before any pipeline is created, saved again in cleanUp
+	void createPipelineCache();
+
 	void createGraphicsPipeline();
+	//Picks up pipelines compiled in the background,
+	//	called after the fence wait of the current frame slot.
+	void updatePipelines();
+
+	//--hot-reload: runs CompileShaders.py whenever a source in the shader directory is saved
+	void createShaderWatcher();
+	//After a rebuild: loads the new manifest and recompiles the pipelines of the changed shaders
+	void reloadShaders();
 
-	void createRenderPass();
+	//Declares the frame as passes of mRenderGraph and compiles it,
+	//	which creates the render passes and plans every barrier.
+	//Depends on the swap chain format only.
+	void createRenderGraph();
 
-	VkShaderModule createShaderModule(const std::vector<char>& code);
+	//The graph's images and framebuffers for the current swap chain images
+	void createRenderTargets();
 
-	void createFrameBuffers();
+	//--msaa, lowered to the highest count the device supports for color and depth attachments
+	VkSampleCountFlagBits chooseSampleCount() const;
+	//The first depth format the device can use as an optimal tiling attachment
+	VkFormat findDepthFormat() const;
 
 	void createCommandPool();
 
+	//Device-local vertex and index buffers for the mesh and the object buffer of the scene,
+	//	streamed in by mUploads with a single transfer submission.
+	void createVertexBuffers();
+
+	//The descriptor set of the vertex shader, which reads the object buffer
+	void createObjectDescriptorSet();
+
+	//--gpu-culling: the culling pipeline and the buffers of the indirect draw
+	void createCulling();
+
+	//Command buffers are recorded once per frame in flight and swap chain image,
+	//	so each can write its timestamps into the query pool of its frame.
+	//See commandBufferIndex for the layout of mCommandBuffers.
 	void createCommandBuffer();
 
+	void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frameIndex);
+
+	//The draw commands of the render pass: pipeline, dynamic state, buffers
+	//	and draws [firstDraw, firstDraw + drawCount), one per object.
+	//With --gpu-culling a single indirect draw of the visible objects instead, drawCount is ignored.
+	//Shared by every recording mode, and called from several threads at once
+	//	in threaded mode, so it must not change any member.
+	void recordDraws(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount) const;
+
+	//Everything but --record=static records a fresh primary command buffer per frame
+	//	from a pool of its frame slot.
+	void createFrameCommandBuffers();
+
+	//Records the primary command buffer of frameIndex for the swap chain image imageIndex,
+	//	inline for RecordMode::PerFrame, from secondaries for RecordMode::Threaded.
+	VkCommandBuffer recordFrameCommandBuffer(uint32_t frameIndex, uint32_t imageIndex);
+
+	size_t commandBufferIndex(size_t frameIndex, uint32_t imageIndex) const
+	{
+		return frameIndex * mSwapChainImages.size() + imageIndex;
+	}
+
+	//Enabled by --profile, see GpuProfiler
+	void createProfiler();
+
 	//The drawFrame function will perform the following operations:
 	//		Acquire an image from the swap chain
 	//		Execute the command buffer with that image as attachment in the framebuffer
 	//		Return the image to the swap chain for presentation
 	void drawFrame();
 
-	void createSemaphore();
+	//One set of synchronization objects per frame in flight,
+	//	so the CPU can record frame N+1 while the GPU is still busy with frame N.
+	void createSyncObjects();
 
 private:
+	ApplicationSettings					mSettings;
 	GLFWwindow*							mWindow;
 	VkQueue								mGraphicsQueue;
 	VkQueue								mPresentQueue;
+	//Falls back to mGraphicsQueue when the device has no dedicated transfer family
+	VkQueue								mTransferQueue;
 	VkDevice							mDevice;
 	VkInstance							mInstance;
 	VkSurfaceKHR						mSurface;
 	VkPhysicalDevice					mPhysicalDevice;
+	//Everything known about mPhysicalDevice, queried once in pickPhysicalDevice
+	DeviceProfile						mDeviceProfile;
+	QueueFamily							mQueueFamilies;
+	//nullptr when the instance has no VK_KHR_get_physical_device_properties2
+	PFN_vkGetPhysicalDeviceProperties2KHR	mGetProperties2 = nullptr;
+	//Phases of run and initVulkan, printed at the end of initVulkan
+	StartupTimer						mStartupTimer;
 	VkDebugUtilsMessengerEXT			mCallback;
+	//Enabled on the instance and the device, nullptr when validation is off or unavailable
+	const char*							mValidationLayer = nullptr;
+	//--validation=performance and the layer supports VK_EXT_validation_features
+	bool								mBestPractices = false;
+	//Where debugCallback puts the messages, written out on a background thread
+	DebugMessageLog						mDebugLog;
 	VkSwapchainKHR						mSwapChain;
 	std::vector<VkImage>				mSwapChainImages;
 	VkFormat							mSwapChainFormat;
 	VkExtent2D							mSwapChainExtent;
 	std::vector<VkImageView>			mSwapChainImageViews;
-	VkRenderPass						mRenderPass;
+	//The frame: passes, their resources and the synchronization between them
+	RenderGraph							mRenderGraph;
+	//The swap chain image (or offscreen image) of the frame, imported into mRenderGraph
+	RenderGraph::ResourceId				mBackBuffer;
+	RenderGraph::PassId					mScenePass;
+	//Samples of the scene's color and depth attachments, the pipeline has to match
+	VkSampleCountFlagBits				mSampleCount = VK_SAMPLE_COUNT_1_BIT;
+	//Which compiled SPIR-V module belongs to which shader source
+	ShaderManifest						mShaders;
+	ShaderWatcher						mShaderWatcher;
+	//Reflected shaders and the layouts derived from them
+	PipelineLayoutCache					mLayouts;
+	PipelineCache						mPipelineCache;
+	//Every graphics pipeline, looked up by description
+	PipelineRegistry					mPipelines;
+	GraphicsPipelineDesc				mPipelineDesc;
+	//Owned by mLayouts
 	VkPipelineLayout					mPipelineLayout;
+	//Owned by mPipelines, the fallback while the real pipeline compiles
 	VkPipeline							mGraphicsPipeline;
-	std::vector<VkFramebuffer>			mSwapChainFrameBuffers;
+	//Per frame slot: the static command buffers bind an outdated pipeline
+	std::vector<bool>					mStaleCommandBufferSlots;
+
+	//All buffer and image memory is sub-allocated from here,
+	//	created right after the device and destroyed right before it.
+	DeviceAllocator						mAllocator;
+
+	//Headless only: memory backing the offscreen images in mSwapChainImages,
+	//	and the next image of the ring to render into.
+	std::vector<DeviceAllocation>		mOffscreenImageMemory;
+	uint32_t							mNextOffscreenImage = 0;
 
 	//Commands in Vulkan, like drawing operations and memory transfers, 
 	//	are not executed directly using function calls.
@@ -174,10 +380,71 @@ private:
 	VkCommandPool						mCommandPool;
 	std::vector<VkCommandBuffer>		mCommandBuffers;
 
+	//Per frame recording (see createFrameCommandBuffers):
+	//	one pool and primary command buffer per frame in flight.
+	std::vector<VkCommandPool>			mFrameCommandPools;
+	std::vector<VkCommandBuffer>		mFrameCommandBuffers;
+	ParallelRecorder					mRecorder;
+	ApplicationSettings::RecordMode		mRecordMode;
+	//CPU time spent getting the frame's command buffer ready, for runRecordBenchmark
+	double								mRecordMs = 0.0;
+
+	UploadScheduler						mUploads;
+	VkBuffer							mVertexBuffer;
+	DeviceAllocation					mVertexBufferMemory;
+	VkBuffer							mIndexBuffer;
+	DeviceAllocation					mIndexBufferMemory;
+	uint32_t							mIndexCount = 0;
+
+	//One object per draw (--draws), placed on a grid by ObjectCulling::makeGrid
+	std::vector<SceneObject>			mObjects;
+	VkBuffer							mObjectBuffer;
+	DeviceAllocation					mObjectBufferMemory;
+	VkDescriptorPool					mDescriptorPool;
+	//Set 0 of mPipelineLayout: the object buffer
+	VkDescriptorSet						mObjectSet;
+
+	//--gpu-culling only
+	ObjectCulling						mCulling;
+	//Loaded when the device has VK_KHR_draw_indirect_count, nullptr otherwise
+	PFN_vkCmdDrawIndexedIndirectCountKHR	mDrawIndexedIndirectCount = nullptr;
+
 	//We'll need one semaphore to signal that 
-	//mImageAvailableSemaphore: an image has been acquired and is ready for rendering, 
-	//mRenderFinishedSemaphore: and another one to signal 
+	//mImageAvailableSemaphores: an image has been acquired and is ready for rendering, 
+	//mRenderFinishedSemaphores: and another one to signal 
 	//		that rendering has finished and presentation can happen.
-	VkSemaphore							mImageAvailableSemaphore;
-	VkSemaphore							mRenderFinishedSemaphore;
+	//Both are rings indexed by mCurrentFrame.
+	std::vector<VkSemaphore>			mImageAvailableSemaphores;
+	std::vector<VkSemaphore>			mRenderFinishedSemaphores;
+
+	//mInFlightFences: signaled when the GPU has finished the frame using that slot,
+	//		the CPU waits on it before reusing the slot's semaphores.
+	//mImagesInFlight: the fence of the frame currently rendering into each swap chain image,
+	//		so an image returned out of order by vkAcquireNextImageKHR is not written twice.
+	std::vector<VkFence>				mInFlightFences;
+	std::vector<VkFence>				mImagesInFlight;
+	size_t								mCurrentFrame = 0;
+
+	//Number of frames submitted so far
+	uint64_t							mFrameNumber = 0;
+
+	//Set by the GLFW callback, 
+	//	not every platform reports VK_ERROR_OUT_OF_DATE_KHR on resize.
+	bool								mFrameBufferResized = false;
+
+	//Swap chain objects replaced by recreateSwapChain.
+	//Frames submitted before lastFrame may still use them, 
+	//	they are destroyed once those frames' fences have signaled.
+	struct RetiredSwapChain
+	{
+		VkSwapchainKHR					swapChain;
+		std::vector<VkImageView>		imageViews;
+		RenderGraph::Targets			graphTargets;
+		std::vector<VkCommandBuffer>	commandBuffers;
+		uint64_t						lastFrame;
+	};
+	std::vector<RetiredSwapChain>		mRetiredSwapChains;
+
+	FrameStats							mFrameStats;
+	GpuProfiler							mProfiler;
 };
@@ -0,0 +1,382 @@
+#include "ObjectCulling.h"
+#include "PipelineLayoutCache.h"
+#include "ReadFile.h"
+#include "ShaderManifest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+//local_size_x of CullObjects.comp
+static const uint32_t CULL_GROUP_SIZE = 64;
+
+//Written into the readback buffers at creation, the GPU never counts that many draws
+static const uint32_t NOT_READ_BACK = ~0u;
+
+std::vector<SceneObject> ObjectCulling::makeGrid(uint32_t count, float meshRadius)
+{
+	uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+	uint32_t visible = side < GRID_VISIBLE ? std::max(side, 1u) : GRID_VISIBLE;
+	float cell = 2.0f / static_cast<float>(visible);
+	float offset = 0.5f * static_cast<float>(side - 1);
+
+	std::vector<SceneObject> objects(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		SceneObject &object = objects[i];
+		object.center = glm::vec2(static_cast<float>(i % side) - offset, static_cast<float>(i / side) - offset) * cell;
+		object.scale = 0.5f * cell;
+		object.radius = meshRadius * object.scale;
+	}
+	return objects;
+}
+
+std::vector<VkDrawIndexedIndirectCommand> ObjectCulling::cull(const std::vector<SceneObject> &objects,
+	glm::vec2 viewMin, glm::vec2 viewMax, uint32_t indexCount)
+{
+	std::vector<VkDrawIndexedIndirectCommand> commands;
+	for (uint32_t i = 0; i < objects.size(); ++i)
+	{
+		//Same test as CullObjects.comp: the bounding circle's box overlaps the view
+		const SceneObject &object = objects[i];
+		if (object.center.x + object.radius < viewMin.x || object.center.x - object.radius > viewMax.x ||
+			object.center.y + object.radius < viewMin.y || object.center.y - object.radius > viewMax.y)
+		{
+			continue;
+		}
+
+		VkDrawIndexedIndirectCommand command = {};
+		command.indexCount = indexCount;
+		command.instanceCount = 1;
+		//gl_InstanceIndex selects the object in the vertex shader
+		command.firstInstance = i;
+		commands.push_back(command);
+	}
+	return commands;
+}
+
+ObjectCulling::ObjectCulling()
+	: mDevice(VK_NULL_HANDLE)
+	, mAllocator(nullptr)
+	, mDrawIndexedIndirectCount(nullptr)
+	, mPipeline(VK_NULL_HANDLE)
+	, mPipelineLayout(VK_NULL_HANDLE)
+	, mSetLayout(VK_NULL_HANDLE)
+	, mDescriptorPool(VK_NULL_HANDLE)
+	, mDescriptorSet(VK_NULL_HANDLE)
+	, mDrawCommands(VK_NULL_HANDLE)
+	, mDrawCount(VK_NULL_HANDLE)
+	, mConstants()
+	, mReadbackSize(0)
+	, mVerifiedFrames(0)
+{
+}
+
+void ObjectCulling::create(VkDevice device, const VkPhysicalDeviceLimits &limits, DeviceAllocator &allocator,
+	PipelineLayoutCache &layouts, const ShaderManifest &shaders, VkPipelineCache pipelineCache,
+	VkBuffer objectBuffer, const std::vector<SceneObject> &objects, uint32_t indexCount,
+	PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount, bool verify, uint32_t framesInFlight)
+{
+	uint32_t objectCount = static_cast<uint32_t>(objects.size());
+	//Without multiDrawIndirect the limit is 1
+	if (objectCount > limits.maxDrawIndirectCount)
+	{
+		throw std::runtime_error("the device can't draw that many objects with one indirect draw!");
+	}
+
+	mDevice = device;
+	mAllocator = &allocator;
+	mDrawIndexedIndirectCount = drawIndexedIndirectCount;
+
+	//The whole view, in the space of the object centers (normalized device coordinates)
+	mConstants.viewMin = glm::vec2(-1.0f, -1.0f);
+	mConstants.viewMax = glm::vec2(1.0f, 1.0f);
+	mConstants.objectCount = objectCount;
+	mConstants.indexCount = indexCount;
+
+	//Room for every object, culling can only ever remove some.
+	//TRANSFER_DST: recordReset, TRANSFER_SRC: recordReadback
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.size = sizeof(VkDrawIndexedIndirectCommand) * std::max(objectCount, 1u);
+	mDrawCommands = allocator.createBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mDrawCommandsMemory);
+
+	bufferInfo.size = sizeof(uint32_t);
+	mDrawCount = allocator.createBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mDrawCountMemory);
+
+	if (verify)
+	{
+		mObjects = objects;
+		//The count, followed by the commands
+		mReadbackSize = sizeof(uint32_t) + sizeof(VkDrawIndexedIndirectCommand) * objectCount;
+		mReadbacks.assign(framesInFlight, VK_NULL_HANDLE);
+		mReadbackMemory.resize(framesInFlight);
+	}
+
+	createPipeline(layouts, shaders, pipelineCache);
+	createDescriptorSet(objectBuffer);
+
+	std::cout << "culling: " << objectCount << " objects on the GPU, "
+		<< (drawIndexedIndirectCount != nullptr ? "vkCmdDrawIndexedIndirectCountKHR" : "vkCmdDrawIndexedIndirect over every slot")
+		<< (verify ? ", verified against the CPU" : "") << std::endl;
+}
+
+void ObjectCulling::createPipeline(PipelineLayoutCache &layouts, const ShaderManifest &shaders, VkPipelineCache pipelineCache)
+{
+	std::unique_ptr<ShaderBlob> code = shaders.open("CullObjects.comp");
+
+	VkShaderModuleCreateInfo moduleInfo = {};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = code->size();
+	moduleInfo.pCode = code->words();
+
+	VkShaderModule module;
+	if (vkCreateShaderModule(mDevice, &moduleInfo, nullptr, &module) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create shader module!");
+	}
+
+	//Set 0: objects, draw commands, draw count. Push constants: CullConstants
+	const ShaderReflection &reflection = layouts.reflect(*code);
+	if (reflection.stage != VK_SHADER_STAGE_COMPUTE_BIT || reflection.pushConstantSize != sizeof(CullConstants))
+	{
+		vkDestroyShaderModule(mDevice, module, nullptr);
+		throw std::runtime_error("CullObjects.comp doesn't match ObjectCulling!");
+	}
+	mPipelineLayout = layouts.getPipelineLayout({ &reflection });
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings;
+	for (auto &binding : reflection.bindings)
+	{
+		VkDescriptorSetLayoutBinding description = {};
+		description.binding = binding.binding;
+		description.descriptorType = binding.type;
+		description.descriptorCount = binding.count;
+		description.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings.push_back(description);
+	}
+	mSetLayout = layouts.getSetLayout(bindings);
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = module;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = mPipelineLayout;
+
+	VkResult result = vkCreateComputePipelines(mDevice, pipelineCache, 1, &pipelineInfo, nullptr, &mPipeline);
+	//The pipeline keeps what it needs of the module
+	vkDestroyShaderModule(mDevice, module, nullptr);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create the culling pipeline!");
+	}
+}
+
+void ObjectCulling::createDescriptorSet(VkBuffer objectBuffer)
+{
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 3;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	if (vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor pool!");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = mDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &mSetLayout;
+	if (vkAllocateDescriptorSets(mDevice, &allocInfo, &mDescriptorSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate descriptor set!");
+	}
+
+	//The buffers never change, the set is written once
+	VkDescriptorBufferInfo bufferInfos[3] = {};
+	bufferInfos[0].buffer = objectBuffer;
+	bufferInfos[1].buffer = mDrawCommands;
+	bufferInfos[2].buffer = mDrawCount;
+
+	VkWriteDescriptorSet writes[3] = {};
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		bufferInfos[i].range = VK_WHOLE_SIZE;
+
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = mDescriptorSet;
+		writes[i].dstBinding = i;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].pBufferInfo = &bufferInfos[i];
+	}
+	vkUpdateDescriptorSets(mDevice, 3, writes, 0, nullptr);
+}
+
+void ObjectCulling::destroy()
+{
+	if (mDevice == VK_NULL_HANDLE)
+		return;
+
+	for (size_t frame = 0; frame < mReadbacks.size(); ++frame)
+	{
+		if (mReadbacks[frame] != VK_NULL_HANDLE)
+			mAllocator->destroyBuffer(mReadbacks[frame], mReadbackMemory[frame]);
+	}
+	mReadbacks.clear();
+	mReadbackMemory.clear();
+
+	mAllocator->destroyBuffer(mDrawCount, mDrawCountMemory);
+	mAllocator->destroyBuffer(mDrawCommands, mDrawCommandsMemory);
+	vkDestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
+	vkDestroyPipeline(mDevice, mPipeline, nullptr);
+
+	if (!mObjects.empty())
+	{
+		std::cout << "culling: " << mVerifiedFrames << " frames matched the CPU" << std::endl;
+	}
+	mDevice = VK_NULL_HANDLE;
+}
+
+void ObjectCulling::recordReset(VkCommandBuffer commandBuffer) const
+{
+	vkCmdFillBuffer(commandBuffer, mDrawCount, 0, VK_WHOLE_SIZE, 0);
+	//recordDraw will draw every slot, the ones the shader doesn't write must draw nothing
+	if (zeroesDrawCommands())
+	{
+		vkCmdFillBuffer(commandBuffer, mDrawCommands, 0, VK_WHOLE_SIZE, 0);
+	}
+}
+
+void ObjectCulling::recordCull(VkCommandBuffer commandBuffer) const
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout, 0, 1, &mDescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, mPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(mConstants), &mConstants);
+	//The last group checks objectCount for its surplus invocations
+	vkCmdDispatch(commandBuffer, (mConstants.objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+}
+
+void ObjectCulling::recordDraw(VkCommandBuffer commandBuffer) const
+{
+	uint32_t maxDraws = mConstants.objectCount;
+	if (mDrawIndexedIndirectCount != nullptr)
+	{
+		//The GPU reads the number of draws from mDrawCount
+		mDrawIndexedIndirectCount(commandBuffer, mDrawCommands, 0, mDrawCount, 0,
+			maxDraws, sizeof(VkDrawIndexedIndirectCommand));
+	}
+	else if (maxDraws > 0)
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, mDrawCommands, 0, maxDraws, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+
+void ObjectCulling::recordReadback(VkCommandBuffer commandBuffer, uint32_t frameIndex) const
+{
+	//Static command buffers are first recorded before any frame began,
+	//	they are recorded again once the frame has its buffer.
+	VkBuffer readback = mReadbacks[frameIndex];
+	if (readback == VK_NULL_HANDLE)
+		return;
+
+	VkBufferCopy region = {};
+	region.size = sizeof(uint32_t);
+	vkCmdCopyBuffer(commandBuffer, mDrawCount, readback, 1, &region);
+	if (mConstants.objectCount > 0)
+	{
+		region.dstOffset = sizeof(uint32_t);
+		region.size = sizeof(VkDrawIndexedIndirectCommand) * mConstants.objectCount;
+		vkCmdCopyBuffer(commandBuffer, mDrawCommands, readback, 1, &region);
+	}
+
+	//The graph doesn't know about the host, make the copies visible to it.
+	//The fence then guarantees they are done when verify reads them.
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+		1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void ObjectCulling::verify(uint32_t frameIndex)
+{
+	if (mObjects.empty() || frameIndex >= mReadbacks.size() || mReadbacks[frameIndex] == VK_NULL_HANDLE)
+		return;
+
+	const char* mapped = static_cast<const char*>(mReadbackMemory[frameIndex].mapped);
+	uint32_t count;
+	std::memcpy(&count, mapped, sizeof(count));
+	std::vector<VkDrawIndexedIndirectCommand> gpu;
+	if (count != NOT_READ_BACK && count <= mConstants.objectCount)
+	{
+		gpu.resize(count);
+		std::memcpy(gpu.data(), mapped + sizeof(uint32_t), sizeof(VkDrawIndexedIndirectCommand) * count);
+	}
+
+	//The allocator recycles the frame's Linear memory next, free it before that
+	mAllocator->destroyBuffer(mReadbacks[frameIndex], mReadbackMemory[frameIndex]);
+	mReadbacks[frameIndex] = VK_NULL_HANDLE;
+
+	if (count == NOT_READ_BACK)
+		return;
+	if (count > mConstants.objectCount)
+	{
+		throw std::runtime_error("culling: the GPU counted more draws than there are objects!");
+	}
+	//Invocations append in whatever order they reach the atomic counter
+	std::sort(gpu.begin(), gpu.end(), [](const VkDrawIndexedIndirectCommand &a, const VkDrawIndexedIndirectCommand &b)
+	{
+		return a.firstInstance < b.firstInstance;
+	});
+
+	std::vector<VkDrawIndexedIndirectCommand> cpu = cull(mObjects, mConstants.viewMin, mConstants.viewMax, mConstants.indexCount);
+	bool matches = gpu.size() == cpu.size();
+	for (size_t i = 0; matches && i < gpu.size(); ++i)
+	{
+		matches = gpu[i].indexCount == cpu[i].indexCount && gpu[i].instanceCount == cpu[i].instanceCount &&
+			gpu[i].firstIndex == cpu[i].firstIndex && gpu[i].vertexOffset == cpu[i].vertexOffset &&
+			gpu[i].firstInstance == cpu[i].firstInstance;
+	}
+	if (!matches)
+	{
+		std::cerr << "culling: the GPU drew " << gpu.size() << " objects, the CPU reference " << cpu.size() << std::endl;
+		throw std::runtime_error("culling: the GPU's draw commands differ from the CPU reference!");
+	}
+
+	if (mVerifiedFrames++ == 0)
+	{
+		std::cout << "culling: " << count << " of " << mConstants.objectCount << " objects visible, the GPU matches the CPU" << std::endl;
+	}
+}
+
+void ObjectCulling::beginFrame(uint32_t frameIndex)
+{
+	if (mObjects.empty() || frameIndex >= mReadbacks.size())
+		return;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.size = mReadbackSize;
+	mReadbacks[frameIndex] = mAllocator->createBuffer(bufferInfo,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, mReadbackMemory[frameIndex],
+		DeviceAllocator::Strategy::Linear);
+	//A frame that never gets submitted leaves this in place
+	std::memcpy(mReadbackMemory[frameIndex].mapped, &NOT_READ_BACK, sizeof(NOT_READ_BACK));
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "DeviceAllocator.h"
+
+class PipelineLayoutCache;
+class ShaderManifest;
+
+//Placement and bounds of one object of the scene, as the shaders read it (std430):
+//	VertexShader.vert draws the mesh scaled by scale around center,
+//	CullObjects.comp tests the bounding circle (center, radius) against the view.
+struct SceneObject
+{
+	glm::vec2	center;
+	float		radius;
+	float		scale;
+};
+
+//GPU-driven drawing: a compute pass decides which objects are visible
+//	and writes one VkDrawIndexedIndirectCommand per visible object plus their count,
+//	the scene pass draws them all with a single vkCmdDrawIndexedIndirectCount.
+//The CPU records the same few commands no matter how many objects there are.
+//
+//Every frame:
+//	recordReset		zeroes the draw count (vkCmdFillBuffer)
+//	recordCull		one invocation per object, visible objects append a command with an atomic counter
+//	recordDraw		in the scene's render pass
+//The render graph places the barriers between them.
+//
+//Without VK_KHR_draw_indirect_count the draw count can't be read by the GPU,
+//	recordReset then zeroes all commands as well
+//	and recordDraw draws every slot, the ones behind the count draw 0 instances.
+//
+//cull is the CPU reference of CullObjects.comp.
+//With verify, recordReadback copies the GPU's commands into a host visible buffer per frame in flight
+//	and verify compares them with the reference once the frame's fence has signaled,
+//	e.g. to test the shader under a software implementation on a machine without a GPU.
+//The readback buffers are transient: verify destroys a frame's buffer,
+//	beginFrame creates a new one in the allocator's Linear memory of that frame.
+class ObjectCulling
+{
+public:
+	//Up to GRID_VISIBLE x GRID_VISIBLE objects fill the view, bigger grids reach past it
+	static const uint32_t GRID_VISIBLE = 16;
+
+	//count objects on a square grid around the origin,
+	//	a single object covers the whole view at scale 1.
+	//meshRadius: bounding radius of the mesh at scale 1
+	static std::vector<SceneObject> makeGrid(uint32_t count, float meshRadius);
+
+	//The commands CullObjects.comp writes for objects, in object order.
+	//The view is a rectangle in the same space as the object centers.
+	static std::vector<VkDrawIndexedIndirectCommand> cull(const std::vector<SceneObject> &objects,
+		glm::vec2 viewMin, glm::vec2 viewMax, uint32_t indexCount);
+
+	ObjectCulling();
+
+	//objectBuffer holds objects, drawIndexedIndirectCount may be nullptr.
+	//Throws if the device can't draw that many commands indirectly.
+	void create(VkDevice device, const VkPhysicalDeviceLimits &limits, DeviceAllocator &allocator,
+		PipelineLayoutCache &layouts, const ShaderManifest &shaders, VkPipelineCache pipelineCache,
+		VkBuffer objectBuffer, const std::vector<SceneObject> &objects, uint32_t indexCount,
+		PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount, bool verify, uint32_t framesInFlight);
+	void destroy();
+
+	//Written by recordReset and recordCull, read by recordDraw (and recordReadback)
+	VkBuffer drawCommands() const { return mDrawCommands; }
+	VkBuffer drawCount() const { return mDrawCount; }
+	bool zeroesDrawCommands() const { return mDrawIndexedIndirectCount == nullptr; }
+
+	void recordReset(VkCommandBuffer commandBuffer) const;
+	void recordCull(VkCommandBuffer commandBuffer) const;
+	//Inside the render pass, with the graphics pipeline and the vertex and index buffers bound
+	void recordDraw(VkCommandBuffer commandBuffer) const;
+	//Copies this frame's commands and count into the readback buffer of frameIndex
+	void recordReadback(VkCommandBuffer commandBuffer, uint32_t frameIndex) const;
+
+	//After the fence of frameIndex: throws if the frame's commands differ from the reference.
+	//Frames that didn't read back anything yet are skipped.
+	//Destroys the frame's readback buffer, call before DeviceAllocator::beginFrame.
+	void verify(uint32_t frameIndex);
+
+	//With verify: creates the readback buffer of frameIndex, call after DeviceAllocator::beginFrame.
+	//Command buffers recorded before reference the previous buffer and have to be recorded again.
+	void beginFrame(uint32_t frameIndex);
+
+private:
+	struct CullConstants
+	{
+		glm::vec2	viewMin;
+		glm::vec2	viewMax;
+		uint32_t	objectCount;
+		uint32_t	indexCount;
+	};
+
+	void createPipeline(PipelineLayoutCache &layouts, const ShaderManifest &shaders, VkPipelineCache pipelineCache);
+	void createDescriptorSet(VkBuffer objectBuffer);
+
+private:
+	VkDevice							mDevice;
+	DeviceAllocator*					mAllocator;
+	PFN_vkCmdDrawIndexedIndirectCountKHR	mDrawIndexedIndirectCount;
+
+	VkPipeline							mPipeline;
+	//Owned by the layout cache
+	VkPipelineLayout					mPipelineLayout;
+	VkDescriptorSetLayout				mSetLayout;
+	VkDescriptorPool					mDescriptorPool;
+	VkDescriptorSet						mDescriptorSet;
+
+	VkBuffer							mDrawCommands;
+	DeviceAllocation					mDrawCommandsMemory;
+	VkBuffer							mDrawCount;
+	DeviceAllocation					mDrawCountMemory;
+
+	CullConstants						mConstants;
+	//Only with verify, VK_NULL_HANDLE until beginFrame created a frame's buffer
+	std::vector<SceneObject>			mObjects;
+	VkDeviceSize						mReadbackSize;
+	std::vector<VkBuffer>				mReadbacks;
+	std::vector<DeviceAllocation>		mReadbackMemory;
+	uint64_t							mVerifiedFrames;
+};
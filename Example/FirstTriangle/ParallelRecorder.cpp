@@ -0,0 +1,258 @@
+#include "ParallelRecorder.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+ParallelRecorder::ParallelRecorder()
+	: mDevice(VK_NULL_HANDLE)
+	, mFrameIndex(0)
+	, mInheritance()
+	, mRecordFunction(nullptr)
+	, mGeneration(0)
+	, mRemaining(0)
+	, mQuit(false)
+	, mFrames(0)
+	, mWallMs(0.0)
+	, mLastReport(Clock::now())
+{
+}
+
+ParallelRecorder::~ParallelRecorder()
+{
+	stopWorkers();
+}
+
+void ParallelRecorder::create(VkDevice device, uint32_t queueFamily, uint32_t threadCount, uint32_t framesInFlight)
+{
+	mDevice = device;
+	mQuit = false;
+
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		std::unique_ptr<Worker> worker(new Worker());
+		worker->pools.resize(framesInFlight);
+		worker->commandBuffers.resize(framesInFlight);
+
+		for (uint32_t frame = 0; frame < framesInFlight; ++frame)
+		{
+			//TRANSIENT: the command buffers are re-recorded every frame
+			VkCommandPoolCreateInfo poolInfo = {};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.queueFamilyIndex = queueFamily;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &worker->pools[frame]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create worker command pool!");
+			}
+
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = worker->pools[frame];
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+			if (vkAllocateCommandBuffers(mDevice, &allocInfo, &worker->commandBuffers[frame]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate secondary command buffer!");
+			}
+		}
+		mWorkers.push_back(std::move(worker));
+	}
+
+	//Start the threads only after mWorkers stopped growing
+	for (uint32_t i = 0; i < mWorkers.size(); ++i)
+	{
+		mWorkers[i]->thread = std::thread(&ParallelRecorder::workerMain, this, i);
+	}
+
+	std::cout << "recording draws on " << mWorkers.size() << " threads" << std::endl;
+}
+
+void ParallelRecorder::destroy()
+{
+	stopWorkers();
+
+	for (auto &worker : mWorkers)
+	{
+		//Destroying a pool frees its command buffers
+		for (auto pool : worker->pools)
+		{
+			vkDestroyCommandPool(mDevice, pool, nullptr);
+		}
+	}
+	mWorkers.clear();
+}
+
+const std::vector<VkCommandBuffer>& ParallelRecorder::record(uint32_t frameIndex, VkRenderPass renderPass, VkFramebuffer frameBuffer,
+	uint32_t drawCount, const RecordFunction &recordFunction)
+{
+	Clock::time_point start = Clock::now();
+
+	//Secondary command buffers inside a render pass
+	//	have to know the render pass and subpass they will run in.
+	//The framebuffer is optional but lets the driver optimize.
+	mInheritance = {};
+	mInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	mInheritance.renderPass = renderPass;
+	mInheritance.subpass = 0;
+	mInheritance.framebuffer = frameBuffer;
+
+	mFrameIndex = frameIndex;
+	mRecordFunction = &recordFunction;
+
+	//Contiguous ranges, the first workers get one draw more when it doesn't divide evenly
+	uint32_t workerCount = static_cast<uint32_t>(mWorkers.size());
+	uint32_t perWorker = drawCount / workerCount;
+	uint32_t remainder = drawCount % workerCount;
+	uint32_t firstDraw = 0;
+	for (uint32_t i = 0; i < workerCount; ++i)
+	{
+		mWorkers[i]->firstDraw = firstDraw;
+		mWorkers[i]->drawCount = perWorker + (i < remainder ? 1 : 0);
+		firstDraw += mWorkers[i]->drawCount;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mRemaining = workerCount;
+		++mGeneration;
+		mStart.notify_all();
+		mDone.wait(lock, [this] { return mRemaining == 0; });
+	}
+
+	//The workers are idle again, so their errors can be read without the lock
+	for (auto &worker : mWorkers)
+	{
+		if (worker->error)
+		{
+			std::exception_ptr error = worker->error;
+			for (auto &other : mWorkers)
+			{
+				other->error = nullptr;
+			}
+			std::rethrow_exception(error);
+		}
+	}
+
+	//Keep the draw order of a single threaded recording
+	mRecorded.clear();
+	for (auto &worker : mWorkers)
+	{
+		if (worker->drawCount > 0)
+		{
+			mRecorded.push_back(worker->commandBuffers[mFrameIndex]);
+		}
+	}
+
+	++mFrames;
+	mWallMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	return mRecorded;
+}
+
+void ParallelRecorder::workerMain(uint32_t index)
+{
+	Worker &worker = *mWorkers[index];
+	uint64_t generation = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mStart.wait(lock, [&] { return mQuit || mGeneration != generation; });
+			if (mQuit)
+				return;
+			generation = mGeneration;
+		}
+
+		Clock::time_point start = Clock::now();
+		if (worker.drawCount > 0)
+		{
+			//An exception escaping the thread would call std::terminate
+			try
+			{
+				recordWorker(worker);
+			}
+			catch (...)
+			{
+				worker.error = std::current_exception();
+			}
+		}
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			worker.recordMs += ms;
+			if (--mRemaining == 0)
+			{
+				mDone.notify_one();
+			}
+		}
+	}
+}
+
+void ParallelRecorder::stopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mStart.notify_all();
+
+	for (auto &worker : mWorkers)
+	{
+		if (worker->thread.joinable())
+		{
+			worker->thread.join();
+		}
+	}
+}
+
+void ParallelRecorder::recordWorker(Worker &worker)
+{
+	//The frame's fence has signaled, nothing from this pool is pending anymore
+	vkResetCommandPool(mDevice, worker.pools[mFrameIndex], 0);
+
+	VkCommandBuffer commandBuffer = worker.commandBuffers[mFrameIndex];
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	//RENDER_PASS_CONTINUE: the whole buffer runs inside the render pass of the primary
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = &mInheritance;
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin secondary command buffer!");
+	}
+
+	(*mRecordFunction)(commandBuffer, worker.firstDraw, worker.drawCount);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record secondary command buffer!");
+	}
+}
+
+void ParallelRecorder::endFrame()
+{
+	double elapsed = std::chrono::duration<double>(Clock::now() - mLastReport).count();
+	if (elapsed < 1.0 || mFrames == 0)
+		return;
+
+	//With perfect scaling every thread records for about as long as the wall time
+	std::cout << "record wall/frame: " << mWallMs / mFrames << " ms\tthreads:";
+	for (auto &worker : mWorkers)
+	{
+		std::cout << " " << worker->recordMs / mFrames;
+		worker->recordMs = 0.0;
+	}
+	std::cout << " ms" << std::endl;
+
+	mFrames = 0;
+	mWallMs = 0.0;
+	mLastReport = Clock::now();
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Records the draws of a render pass on several threads.
+//
+//Command pools are externally synchronized:
+//	a pool and every command buffer allocated from it
+//	may only be used by one thread at a time.
+//So each worker owns one VkCommandPool per frame in flight
+//	and records a VK_COMMAND_BUFFER_LEVEL_SECONDARY command buffer from it.
+//The main thread runs them with vkCmdExecuteCommands
+//	inside a render pass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+//
+//The pool of a frame is reset with vkResetCommandPool before it is recorded again,
+//	which is cheaper than resetting the command buffers one by one.
+//
+//The recording time of every worker is summed up and printed roughly once per second,
+//	comparing it with the wall time of record shows how well recording scales across cores.
+class ParallelRecorder
+{
+public:
+	//Records draws [firstDraw, firstDraw + drawCount) into a secondary command buffer
+	//	that has already been begun.
+	//Called from the worker threads at the same time, so it must only read shared state.
+	typedef std::function<void(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount)> RecordFunction;
+
+	ParallelRecorder();
+	//Only stops the workers, for when destroy was never reached
+	~ParallelRecorder();
+
+	//threadCount 0: one worker per hardware thread
+	void create(VkDevice device, uint32_t queueFamily, uint32_t threadCount, uint32_t framesInFlight);
+	void destroy();
+
+	uint32_t threadCount() const { return static_cast<uint32_t>(mWorkers.size()); }
+
+	//Splits drawCount draws evenly over the workers and waits until all of them are recorded.
+	//The caller must have waited for the fence of frameIndex.
+	//The returned command buffers stay valid until the next record with the same frameIndex.
+	//An exception thrown on a worker is rethrown here once all workers are done.
+	const std::vector<VkCommandBuffer>& record(uint32_t frameIndex, VkRenderPass renderPass, VkFramebuffer frameBuffer,
+		uint32_t drawCount, const RecordFunction &recordFunction);
+
+	//Prints the per-thread recording times once per second
+	void endFrame();
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Worker
+	{
+		std::thread						thread;
+		//One pool and one secondary command buffer per frame in flight
+		std::vector<VkCommandPool>		pools;
+		std::vector<VkCommandBuffer>	commandBuffers;
+		uint32_t						firstDraw = 0;
+		uint32_t						drawCount = 0;
+		double							recordMs = 0.0;
+		//Thrown by recordWorker, rethrown by record
+		std::exception_ptr				error;
+	};
+
+	void workerMain(uint32_t index);
+	void recordWorker(Worker &worker);
+	void stopWorkers();
+
+private:
+	VkDevice								mDevice;
+	std::vector<std::unique_ptr<Worker>>	mWorkers;
+
+	//The current job, written by record while all workers are idle
+	uint32_t								mFrameIndex;
+	VkCommandBufferInheritanceInfo			mInheritance;
+	const RecordFunction*					mRecordFunction;
+	std::vector<VkCommandBuffer>			mRecorded;
+
+	//Workers start when mGeneration changes and report back through mRemaining
+	std::mutex								mMutex;
+	std::condition_variable					mStart;
+	std::condition_variable					mDone;
+	uint64_t								mGeneration;
+	uint32_t								mRemaining;
+	bool									mQuit;
+
+	uint32_t								mFrames;
+	double									mWallMs;
+	Clock::time_point						mLastReport;
+};
@@ -0,0 +1,167 @@
+#include "PipelineCache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+//Layout of the header every pipeline cache blob starts with
+//	(VK_PIPELINE_CACHE_HEADER_VERSION_ONE).
+//All fields are little endian 32 bit words followed by the UUID bytes.
+struct PipelineCacheHeader
+{
+	uint32_t	headerSize;
+	uint32_t	headerVersion;
+	uint32_t	vendorID;
+	uint32_t	deviceID;
+	uint8_t		pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+PipelineCache::PipelineCache()
+	: mDevice(VK_NULL_HANDLE)
+	, mCache(VK_NULL_HANDLE)
+	, mWarm(false)
+{
+}
+
+void PipelineCache::create(VkDevice device, const VkPhysicalDeviceProperties &properties, const std::string &path)
+{
+	mDevice = device;
+	mPath = path;
+	mWarm = false;
+	mLoadedData.clear();
+
+	if (!mPath.empty())
+	{
+		std::ifstream file(mPath, std::ios::ate | std::ios::binary);
+		if (file.is_open())
+		{
+			//A read error is not the driver's fault, don't blame it on a mismatch
+			const char* problem = nullptr;
+			std::vector<char> data;
+			std::streamoff size = file.tellg();
+			if (size < 0)
+			{
+				problem = "its size could not be read";
+			}
+			else
+			{
+				data.resize(static_cast<size_t>(size));
+				file.seekg(0);
+				file.read(data.data(), data.size());
+				if (!file || file.gcount() != size)
+				{
+					problem = "it could not be read completely";
+				}
+			}
+			if (problem == nullptr)
+			{
+				problem = findHeaderProblem(data, properties);
+			}
+
+			if (problem == nullptr)
+			{
+				mLoadedData.swap(data);
+				mWarm = true;
+			}
+			else
+			{
+				std::cout << "pipeline cache: ignoring " << mPath << ", " << problem << std::endl;
+			}
+		}
+	}
+
+	VkPipelineCacheCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = mLoadedData.size();
+	createInfo.pInitialData = mLoadedData.empty() ? nullptr : mLoadedData.data();
+
+	if (vkCreatePipelineCache(mDevice, &createInfo, nullptr, &mCache) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline cache!");
+	}
+
+	std::cout << "pipeline cache: " << (mWarm ? "warm, " : "cold, ")
+		<< mLoadedData.size() << " bytes loaded" << std::endl;
+}
+
+void PipelineCache::destroy()
+{
+	if (mCache == VK_NULL_HANDLE)
+		return;
+
+	save();
+	vkDestroyPipelineCache(mDevice, mCache, nullptr);
+	mCache = VK_NULL_HANDLE;
+}
+
+void PipelineCache::save()
+{
+	if (mPath.empty() || mCache == VK_NULL_HANDLE)
+		return;
+
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(mDevice, mCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+		return;
+
+	std::vector<char> data(dataSize);
+	if (vkGetPipelineCacheData(mDevice, mCache, &dataSize, data.data()) != VK_SUCCESS)
+		return;
+	data.resize(dataSize);
+
+	if (data == mLoadedData)
+		return;
+
+	std::string tempPath = mPath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(data.data(), data.size());
+		if (!file)
+		{
+			std::cerr << "pipeline cache: failed to write " << tempPath << std::endl;
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, mPath, error);
+	if (error)
+	{
+		std::cerr << "pipeline cache: failed to replace " << mPath << ": " << error.message() << std::endl;
+		std::filesystem::remove(tempPath, error);
+		return;
+	}
+
+	mLoadedData.swap(data);
+	std::cout << "pipeline cache: saved " << mLoadedData.size() << " bytes to " << mPath << std::endl;
+}
+
+size_t PipelineCache::dataSize() const
+{
+	size_t dataSize = 0;
+	if (mCache == VK_NULL_HANDLE || vkGetPipelineCacheData(mDevice, mCache, &dataSize, nullptr) != VK_SUCCESS)
+		return 0;
+	return dataSize;
+}
+
+const char* PipelineCache::findHeaderProblem(const std::vector<char> &data, const VkPhysicalDeviceProperties &properties) const
+{
+	PipelineCacheHeader header;
+	if (data.empty())
+		return "it is empty";
+	if (data.size() < sizeof(header))
+		return "it is too short for a pipeline cache header";
+
+	memcpy(&header, data.data(), sizeof(header));
+
+	if (header.headerSize < sizeof(header) || header.headerSize > data.size())
+		return "its header size is invalid, the file is truncated or corrupt";
+	if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+		return "it has an unknown header version";
+	if (header.vendorID != properties.vendorID
+		|| header.deviceID != properties.deviceID
+		|| memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+		return "it was created for another device or driver";
+	return nullptr;
+}
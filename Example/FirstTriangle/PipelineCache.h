@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+
+//A VkPipelineCache that survives process restarts.
+//
+//The driver stores compiled pipeline state in the cache,
+//	so pipelines created with it on the next run
+//	skip most of the shader compilation.
+//
+//The blob is only valid for the exact device and driver it was created with,
+//	its header carries the vendor ID, device ID and pipelineCacheUUID to check that.
+//A blob that doesn't match is ignored and the cache starts out empty (cold).
+class PipelineCache
+{
+public:
+	PipelineCache();
+
+	//Loads path (if it exists and matches this device) and creates the cache.
+	//An empty path disables loading and saving, the cache then only lives in memory.
+	void create(VkDevice device, const VkPhysicalDeviceProperties &properties, const std::string &path);
+
+	//Writes the cache back to disk and destroys it.
+	void destroy();
+
+	//Writes the current cache contents to a temporary file
+	//	and renames it over the old one,
+	//	so a crash while saving never leaves a truncated blob behind.
+	void save();
+
+	VkPipelineCache handle() const { return mCache; }
+
+	//true if a valid blob was loaded, i.e. pipeline creation should be fast
+	bool isWarm() const { return mWarm; }
+
+	//Size of the data the driver currently keeps in the cache
+	size_t dataSize() const;
+
+private:
+	//Why data can't be used as initial data for this device, nullptr if it can
+	const char* findHeaderProblem(const std::vector<char> &data, const VkPhysicalDeviceProperties &properties) const;
+
+private:
+	VkDevice				mDevice;
+	VkPipelineCache			mCache;
+	std::string				mPath;
+	bool					mWarm;
+
+	//What was loaded from disk, save() skips the write if nothing changed
+	std::vector<char>		mLoadedData;
+};
@@ -0,0 +1,176 @@
+#include "PipelineLayoutCache.h"
+#include "ReadFile.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+PipelineLayoutCache::PipelineLayoutCache()
+	: mDevice(VK_NULL_HANDLE)
+{
+}
+
+void PipelineLayoutCache::create(VkDevice device)
+{
+	mDevice = device;
+}
+
+void PipelineLayoutCache::destroy()
+{
+	for (auto &layout : mPipelineLayouts)
+	{
+		vkDestroyPipelineLayout(mDevice, layout.second, nullptr);
+	}
+	for (auto &layout : mSetLayouts)
+	{
+		vkDestroyDescriptorSetLayout(mDevice, layout.second, nullptr);
+	}
+	mPipelineLayouts.clear();
+	mSetLayouts.clear();
+	mReflections.clear();
+}
+
+const ShaderReflection& PipelineLayoutCache::reflect(const ShaderBlob &code)
+{
+	//FNV-1a 64 over the words, the same module always maps to the same entry
+	//	no matter where it was loaded from.
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < code.size() / sizeof(uint32_t); ++i)
+	{
+		hash ^= code.words()[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	auto found = mReflections.find(hash);
+	if (found != mReflections.end())
+	{
+		return *found->second;
+	}
+
+	std::unique_ptr<ShaderReflection> reflection(new ShaderReflection(ShaderReflection::reflect(code.words(), code.size())));
+	return *(mReflections[hash] = std::move(reflection));
+}
+
+VkPipelineLayout PipelineLayoutCache::getPipelineLayout(const std::vector<const ShaderReflection*> &stages)
+{
+	//set -> binding -> description, merged over all stages
+	std::map<uint32_t, std::map<uint32_t, VkDescriptorSetLayoutBinding>> sets;
+	VkPushConstantRange pushConstants = {};
+
+	for (const ShaderReflection* stage : stages)
+	{
+		for (auto &binding : stage->bindings)
+		{
+			auto inserted = sets[binding.set].emplace(binding.binding, VkDescriptorSetLayoutBinding());
+			VkDescriptorSetLayoutBinding &description = inserted.first->second;
+			if (inserted.second)
+			{
+				description.binding = binding.binding;
+				description.descriptorType = binding.type;
+				description.descriptorCount = binding.count;
+			}
+			else if (description.descriptorType != binding.type || description.descriptorCount != binding.count)
+			{
+				throw std::runtime_error("shader stages disagree about the descriptor at a binding!");
+			}
+			description.stageFlags |= stage->stage;
+		}
+
+		if (stage->pushConstantSize > 0)
+		{
+			pushConstants.stageFlags |= stage->stage;
+			pushConstants.size = std::max(pushConstants.size, stage->pushConstantSize);
+		}
+	}
+
+	//Set numbers are indices into pSetLayouts,
+	//	unused sets below the highest one still need an (empty) layout.
+	std::vector<VkDescriptorSetLayout> setLayouts;
+	if (!sets.empty())
+	{
+		setLayouts.resize(sets.rbegin()->first + 1);
+		for (uint32_t set = 0; set < setLayouts.size(); ++set)
+		{
+			std::vector<VkDescriptorSetLayoutBinding> bindings;
+			for (auto &binding : sets[set])
+			{
+				bindings.push_back(binding.second);
+			}
+			setLayouts[set] = getSetLayout(bindings);
+		}
+	}
+
+	PipelineLayoutKey key(setLayouts, { pushConstants.stageFlags, pushConstants.size });
+	auto found = mPipelineLayouts.find(key);
+	if (found != mPipelineLayouts.end())
+	{
+		return found->second;
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = pushConstants.size > 0 ? 1 : 0;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+	VkPipelineLayout layout;
+	if (vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+	mPipelineLayouts[key] = layout;
+	return layout;
+}
+
+VkDescriptorSetLayout PipelineLayoutCache::getSetLayout(const std::vector<VkDescriptorSetLayoutBinding> &bindings)
+{
+	SetLayoutKey key;
+	for (auto &binding : bindings)
+	{
+		key.push_back({ binding.binding, static_cast<uint32_t>(binding.descriptorType),
+			binding.descriptorCount, static_cast<uint32_t>(binding.stageFlags) });
+	}
+	std::sort(key.begin(), key.end());
+
+	auto found = mSetLayouts.find(key);
+	if (found != mSetLayouts.end())
+	{
+		return found->second;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	VkDescriptorSetLayout layout;
+	if (vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor set layout!");
+	}
+	mSetLayouts[key] = layout;
+	return layout;
+}
+
+void PipelineLayoutCache::getVertexInput(const ShaderReflection &vertexShader,
+	VkVertexInputBindingDescription &bindingDescription,
+	std::vector<VkVertexInputAttributeDescription> &attributeDescriptions)
+{
+	attributeDescriptions.clear();
+	uint32_t offset = 0;
+	for (auto &input : vertexShader.inputs)
+	{
+		VkVertexInputAttributeDescription attribute = {};
+		attribute.binding = 0;
+		attribute.location = input.location;
+		attribute.format = input.format;
+		attribute.offset = offset;
+		attributeDescriptions.push_back(attribute);
+		offset += input.size;
+	}
+
+	bindingDescription = {};
+	bindingDescription.binding = 0;
+	bindingDescription.stride = offset;
+	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+}
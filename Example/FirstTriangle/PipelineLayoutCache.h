@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "ShaderReflection.h"
+
+class ShaderBlob;
+
+//Pipeline layouts and vertex input state derived from the shaders (ShaderReflection)
+//	instead of being written by hand next to every pipeline.
+//
+//Everything is cached:
+//	reflection results by a hash of the SPIR-V words, a module is only parsed once,
+//	descriptor set layouts by their bindings, so pipelines with the same resources share them,
+//	pipeline layouts by their set layouts and push constant range.
+//Pipelines that share a layout can also share descriptor sets and push constants
+//	when switching between them.
+//
+//The cache owns every layout it hands out, they stay valid until destroy.
+class PipelineLayoutCache
+{
+public:
+	PipelineLayoutCache();
+
+	void create(VkDevice device);
+	void destroy();
+
+	//The returned reference stays valid until destroy
+	const ShaderReflection& reflect(const ShaderBlob &code);
+
+	//One layout for all stages of a pipeline:
+	//	bindings used by several stages are visible to all of them,
+	//	the push constant range covers the largest block of any stage.
+	VkPipelineLayout getPipelineLayout(const std::vector<const ShaderReflection*> &stages);
+
+	//Set layout for the given bindings, also used to allocate descriptor sets
+	VkDescriptorSetLayout getSetLayout(const std::vector<VkDescriptorSetLayoutBinding> &bindings);
+
+	//Vertex input for one interleaved buffer at binding 0,
+	//	the attributes are packed in location order without padding.
+	static void getVertexInput(const ShaderReflection &vertexShader,
+		VkVertexInputBindingDescription &bindingDescription,
+		std::vector<VkVertexInputAttributeDescription> &attributeDescriptions);
+
+private:
+	//binding, type, count, stages of every binding of a set
+	typedef std::vector<std::array<uint32_t, 4>> SetLayoutKey;
+	//set layouts, push constant stages and size
+	typedef std::pair<std::vector<VkDescriptorSetLayout>, std::array<uint32_t, 2>> PipelineLayoutKey;
+
+private:
+	VkDevice											mDevice;
+	std::map<uint64_t, std::unique_ptr<ShaderReflection>>	mReflections;
+	std::map<SetLayoutKey, VkDescriptorSetLayout>		mSetLayouts;
+	std::map<PipelineLayoutKey, VkPipelineLayout>		mPipelineLayouts;
+};
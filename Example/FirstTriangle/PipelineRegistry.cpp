@@ -0,0 +1,847 @@
+#include "PipelineRegistry.h"
+#include "PipelineCache.h"
+#include "PipelineLayoutCache.h"
+#include "ReadFile.h"
+#include "ShaderManifest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+void PipelineRegistry::fillState(const GraphicsPipelineDesc &desc, PipelineState &state)
+{
+	//***************************
+	//		Vertex Input
+	//***************************
+	//
+	//Bindings: spacing between data and
+	//			whether the data is per - vertex or per - instance(see instancing)
+	//Attribute descriptions :
+	//			type of the attributes passed to the vertex shader,
+	//			which binding to load them from
+	//			and at which offset
+	//
+	//Both are taken from the inputs the vertex shader declares (see getShaderModule).
+	VkPipelineVertexInputStateCreateInfo &vertexInputInfo = state.vertexInputInfo;
+	vertexInputInfo = {};
+	vertexInputInfo.sType							= VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputInfo.vertexBindingDescriptionCount	= state.attributeDescriptions.empty() ? 0 : 1;
+	vertexInputInfo.pVertexBindingDescriptions		= &state.bindingDescription;
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(state.attributeDescriptions.size());
+	vertexInputInfo.pVertexAttributeDescriptions	= state.attributeDescriptions.data();
+
+	/************************************************************************/
+	/*		Input Assembly                                                                      */
+	/************************************************************************/
+	VkPipelineInputAssemblyStateCreateInfo &inputAssembly = state.inputAssembly;
+	inputAssembly = {};
+	inputAssembly.sType						= VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	//VK_PRIMITIVE_TOPOLOGY_POINT_LIST: points from vertices
+	//VK_PRIMITIVE_TOPOLOGY_LINE_LIST : line from every 2 vertices without reuse
+	//VK_PRIMITIVE_TOPOLOGY_LINE_STRIP : the end vertex of every line is used as start vertex for the next line
+	//VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST : triangle from every 3 vertices without reuse
+	//VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP : the second and third vertex of every triangle are used as first two vertices of the next triangle
+	inputAssembly.topology					= desc.topology;
+	//If you set the primitiveRestartEnable member to VK_TRUE,
+	//then it's possible to break up lines
+	//and triangles in the _STRIP topology modes
+	//by using a special index of 0xFFFF or 0xFFFFFFFF.
+	inputAssembly.primitiveRestartEnable	= VK_FALSE;
+
+	/************************************************************************/
+	/*		Viewports and Scissors                                                                      */
+	/************************************************************************/
+	//Viewport and scissor are dynamic state (see below)
+	//	and set in recordCommandBuffer,
+	//	so the pipeline doesn't depend on the swap chain extent
+	//	and survives recreateSwapChain.
+
+	//It is possible to use multiple viewports
+	//and scissor rectangles on some graphics cards,
+	//so its members reference an array of them.
+	//Using multiple requires enabling a GPU feature(see logical device creation).
+	VkPipelineViewportStateCreateInfo &viewportState = state.viewportState;
+	viewportState = {};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.pViewports = nullptr; //dynamic
+	viewportState.scissorCount = 1;
+	viewportState.pScissors = nullptr; //dynamic
+
+	/************************************************************************/
+	/*		Rasterizer                                                                      */
+	/************************************************************************/
+	VkPipelineRasterizationStateCreateInfo &rasterizer = state.rasterizer;
+	rasterizer = {};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	//If depthClampEnable is set to VK_TRUE, then fragments that are beyond the near and far planes are clamped to them as opposed to discarding them. This is useful in some special cases like shadow maps. Using this requires enabling a GPU feature.
+	rasterizer.depthClampEnable = VK_FALSE;
+	//If rasterizerDiscardEnable is set to VK_TRUE, then geometry never passes through the rasterizer stage. This basically disables any output to the framebuffer.
+	rasterizer.rasterizerDiscardEnable = VK_FALSE;
+	//The polygonMode determines how fragments are generated for geometry.The following modes are available :
+	//			VK_POLYGON_MODE_FILL	: fill the area of the polygon with fragments
+	//			VK_POLYGON_MODE_LINE	: polygon edges are drawn as lines
+	//			VK_POLYGON_MODE_POINT : polygon vertices are drawn as points
+	rasterizer.polygonMode = desc.polygonMode;
+	//The lineWidth member is straightforward,
+	//it describes the thickness of lines
+	//in terms of number of fragments.
+	//The maximum line width that is supported depends on the hardware and any line thicker than 1.0f requires you to enable the wideLines GPU feature.
+	rasterizer.lineWidth = 1.0f;
+	//The cullMode variable determines the type of face culling to use.You can disable culling, cull the front faces, cull the back faces or both.
+	rasterizer.cullMode = desc.cullMode;
+	//The frontFace variable specifies the vertex order for faces to be considered front-facing and can be clockwise or counterclockwise.
+	rasterizer.frontFace = desc.frontFace;
+	//The rasterizer can alter the depth values by adding a constant value or biasing them based on a fragment's slope
+	rasterizer.depthBiasEnable			= VK_FALSE;
+	rasterizer.depthBiasConstantFactor	= 0.0f;//optional
+	rasterizer.depthBiasClamp			= 0.0f;//optional
+	rasterizer.depthBiasSlopeFactor		= 0.0f;//optional
+
+	/************************************************************************/
+	/*		MultiSampling                                                                     */
+	/************************************************************************/
+	//The VkPipelineMultisampleStateCreateInfo struct configures multisampling,
+	//which is one of the ways to perform anti-aliasing.
+	VkPipelineMultisampleStateCreateInfo &multisampling = state.multisampling;
+	multisampling = {};
+	multisampling.sType					= VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.sampleShadingEnable	= VK_FALSE;
+	multisampling.rasterizationSamples	= desc.samples;
+	multisampling.minSampleShading		= 1.0f;//optional
+	multisampling.pSampleMask			= nullptr;//optional
+	multisampling.alphaToCoverageEnable = VK_FALSE;//optional
+	multisampling.alphaToOneEnable		= VK_FALSE;//optional
+
+	/************************************************************************/
+	/*		Depth and stencil testing
+	/************************************************************************/
+	//Ignored when the subpass has no depth attachment
+	VkPipelineDepthStencilStateCreateInfo &depthStencil = state.depthStencil;
+	depthStencil = {};
+	depthStencil.sType				= VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable	= desc.depthTest ? VK_TRUE : VK_FALSE;
+	depthStencil.depthWriteEnable	= desc.depthWrite ? VK_TRUE : VK_FALSE;
+	depthStencil.depthCompareOp		= desc.depthCompareOp;
+	depthStencil.maxDepthBounds		= 1.0f;
+
+	/************************************************************************/
+	/*		Color Blending                                                                      */
+	/************************************************************************/
+	//After a fragment shader has returned a color,
+	//it needs to be combined with the color
+	//that is already in the framebuffer.
+	//This transformation is known as color blending and there are two ways to do it:
+	//	1.Mix the old and new value to produce a final color
+	//	2.Combine the old and new value using a bitwise operation
+	VkPipelineColorBlendAttachmentState &colorBlendAttachment = state.colorBlendAttachment;
+	colorBlendAttachment = {};
+	colorBlendAttachment.colorWriteMask			= VK_COLOR_COMPONENT_R_BIT |
+		VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT |
+		VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachment.blendEnable			= desc.blendEnable ? VK_TRUE : VK_FALSE;
+	colorBlendAttachment.srcColorBlendFactor	= desc.srcColorBlendFactor;
+	colorBlendAttachment.dstColorBlendFactor	= desc.dstColorBlendFactor;
+	colorBlendAttachment.colorBlendOp			= desc.colorBlendOp;
+	colorBlendAttachment.srcAlphaBlendFactor	= desc.srcAlphaBlendFactor;
+	colorBlendAttachment.dstAlphaBlendFactor	= desc.dstAlphaBlendFactor;
+	colorBlendAttachment.alphaBlendOp			= desc.alphaBlendOp;
+
+	//color blending follow pseudo-code:
+	//	if (blendEnable)
+	//	{
+	//		finalColor.rgb = (srcColorBlendFactor * newColor.rgb) < colorBlendOp > (dstColorBlendFactor * oldColor.rgb);
+	//		finalColor.a = (srcAlphaBlendFactor * newColor.a) < alphaBlendOp > (dstAlphaBlendFactor * oldColor.a);
+	//	}
+	//	else
+	//	{
+	//		finalColor = newColor;
+	//	}
+	//
+	//	finalColor = finalColor & colorWriteMask;
+	VkPipelineColorBlendStateCreateInfo &colorBlending = state.colorBlending;
+	colorBlending = {};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	//If you want to use the second method of blending(bitwise combination),
+	//	then you should set logicOpEnable to VK_TRUE.
+	//
+	//The bitwise operation can then be specified
+	//	in the logicOp field
+	//
+	//Note that this will automatically disable the first method,
+	//	as if you had set blendEnable to VK_FALSE
+	//	for every attached framebuffer!
+	//
+	//The colorWriteMask will also be used in this mode
+	//	to determine which channels in the framebuffer will actually be affected.
+	colorBlending.logicOpEnable		= VK_FALSE;
+	colorBlending.logicOp			= VK_LOGIC_OP_COPY;
+	colorBlending.attachmentCount	= 1;
+	colorBlending.pAttachments		= &colorBlendAttachment;
+	colorBlending.blendConstants[0] = 0.0f; //optional
+	colorBlending.blendConstants[1] = 0.0f; //optional
+	colorBlending.blendConstants[2] = 0.0f; //optional
+	colorBlending.blendConstants[3] = 0.0f; //optional
+
+	/************************************************************************/
+	/*		Dynamic State                                                                     */
+	/************************************************************************/
+	state.dynamicStates[0] = VK_DYNAMIC_STATE_VIEWPORT;
+	state.dynamicStates[1] = VK_DYNAMIC_STATE_SCISSOR;
+
+	VkPipelineDynamicStateCreateInfo &dynamicState = state.dynamicState;
+	dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = state.dynamicStates;
+}
+
+PipelineRegistry::PipelineRegistry()
+	: mDevice(VK_NULL_HANDLE)
+	, mPipelineCache(nullptr)
+	, mShaders(nullptr)
+	, mLayouts(nullptr)
+	, mFallback(nullptr)
+	, mDerivatives(true)
+	, mJobSequence(0)
+	, mFrameNumber(0)
+	, mActive(0)
+	, mQuit(false)
+	, mHits(0)
+	, mCreated(0)
+	, mBatches(0)
+	, mDerived(0)
+	, mCreateMs(0.0)
+	, mAsyncCreated(0)
+	, mAsyncLatencyMs(0.0)
+	, mReloaded(0)
+{
+}
+
+PipelineRegistry::~PipelineRegistry()
+{
+	stopCompileThreads();
+}
+
+void PipelineRegistry::create(VkDevice device, PipelineCache &pipelineCache, ShaderManifest &shaders, PipelineLayoutCache &layouts,
+	uint32_t compileThreads)
+{
+	mDevice = device;
+	mPipelineCache = &pipelineCache;
+	mShaders = &shaders;
+	mLayouts = &layouts;
+	mQuit = false;
+
+	for (uint32_t i = 0; i < compileThreads; ++i)
+	{
+		mCompileThreads.push_back(std::thread(&PipelineRegistry::compileMain, this));
+	}
+}
+
+void PipelineRegistry::destroy()
+{
+	stopCompileThreads();
+
+	for (auto &job : mFinished)
+	{
+		if (job->result == VK_SUCCESS)
+			vkDestroyPipeline(mDevice, job->pipeline.pipeline, nullptr);
+	}
+	mFinished.clear();
+	mCompiling.clear();
+	mLatestJob.clear();
+	mPendingBases.clear();
+
+	for (auto &retired : mRetired)
+	{
+		vkDestroyPipeline(mDevice, retired.pipeline, nullptr);
+	}
+	for (VkShaderModule module : mStaleModules)
+	{
+		vkDestroyShaderModule(mDevice, module, nullptr);
+	}
+	mRetired.clear();
+	mStaleModules.clear();
+
+	for (auto &pipeline : mPipelines)
+	{
+		vkDestroyPipeline(mDevice, pipeline.second.pipeline, nullptr);
+	}
+	for (auto &module : mShaderModules)
+	{
+		vkDestroyShaderModule(mDevice, module.second.module, nullptr);
+	}
+	mPipelines.clear();
+	mPending.clear();
+	mShaderModules.clear();
+	mParents.clear();
+	mFallback = nullptr;
+}
+
+const PipelineRegistry::Pipeline& PipelineRegistry::get(const GraphicsPipelineDesc &desc)
+{
+	auto found = mPipelines.find(desc);
+	if (found != mPipelines.end())
+	{
+		++mHits;
+		return found->second;
+	}
+
+	//Compiling it twice would leave one of the two pipelines without an owner
+	if (isCompiling(desc))
+	{
+		waitIdle();
+		update(mFrameNumber);
+		return mPipelines.at(desc);
+	}
+
+	request(desc);
+	flush();
+	return mPipelines.at(desc);
+}
+
+void PipelineRegistry::request(const GraphicsPipelineDesc &desc)
+{
+	if (mPipelines.count(desc) != 0 || isCompiling(desc))
+		return;
+	for (auto &pending : mPending)
+	{
+		if (pending == desc)
+			return;
+	}
+	mPending.push_back(desc);
+}
+
+void PipelineRegistry::flush()
+{
+	if (mPending.empty())
+		return;
+
+	//Sized up front, the create infos point into the states
+	std::vector<PipelineState> states(mPending.size());
+	std::vector<VkGraphicsPipelineCreateInfo> pipelineInfos(mPending.size());
+	std::vector<Pipeline> created(mPending.size());
+	//family hash -> index of the family's parent in this batch
+	std::unordered_map<uint64_t, int32_t> batchParents;
+	uint32_t derived = 0;
+
+	for (size_t i = 0; i < mPending.size(); ++i)
+	{
+		prepare(mPending[i], states[i], created[i]);
+		VkGraphicsPipelineCreateInfo &pipelineInfo = pipelineInfos[i] = states[i].pipelineInfo;
+
+		if (!mDerivatives)
+			continue;
+
+		//Base pipeline by handle if the parent exists,
+		//	by index if it is created earlier in this call,
+		//	otherwise this one becomes the parent.
+		//Only one of basePipelineHandle and basePipelineIndex may be used.
+		uint64_t family = mPending[i].familyHash();
+		VkPipeline parent = findParent(mPending[i]);
+		auto inBatch = batchParents.find(family);
+		if (parent != VK_NULL_HANDLE)
+		{
+			pipelineInfo.flags |= VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+			pipelineInfo.basePipelineHandle = parent;
+			++derived;
+		}
+		else if (inBatch != batchParents.end())
+		{
+			pipelineInfo.flags |= VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+			pipelineInfo.basePipelineIndex = inBatch->second;
+			++derived;
+		}
+		else
+		{
+			pipelineInfo.flags |= VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+			batchParents[family] = static_cast<int32_t>(i);
+		}
+	}
+
+	//The vkCreateGraphicsPipelines function
+	//		actually has more parameters than
+	//		the usual object creation functions in Vulkan
+
+	//It is designed to take multiple VkGraphicsPipelineCreateInfo objects
+	//		and create multiple VkPipeline objects
+	//		in a single call.
+
+	//The second parameter references an optional VkPipelineCache object.
+	//A pipeline cache can be used to store and reuse data
+	//		relevant to pipeline creation across multiple calls to vkCreateGraphicsPipelines
+	//		and even across program executions
+	//		if the cache is stored to a file.
+	// This makes it possible to significantly
+	//		speed up pipeline creation at a later time.
+	std::vector<VkPipeline> pipelines(mPending.size(), VK_NULL_HANDLE);
+	auto pipelineStart = Clock::now();
+	if (vkCreateGraphicsPipelines(mDevice, mPipelineCache->handle(), static_cast<uint32_t>(pipelineInfos.size()),
+		pipelineInfos.data(), nullptr, pipelines.data()) != VK_SUCCESS)
+	{
+		//Some of the batch may have been created
+		for (VkPipeline pipeline : pipelines)
+		{
+			if (pipeline != VK_NULL_HANDLE)
+				vkDestroyPipeline(mDevice, pipeline, nullptr);
+		}
+		mPending.clear();
+		throw std::runtime_error("Failed to create graphics pipeline!");
+	}
+	double ms = std::chrono::duration<double, std::milli>(Clock::now() - pipelineStart).count();
+
+	std::cout << pipelines.size() << " graphics pipeline(s) created in " << ms
+		<< " ms (" << (mPipelineCache->isWarm() ? "warm" : "cold") << " pipeline cache, "
+		<< derived << " derivatives)" << std::endl;
+
+	for (size_t i = 0; i < mPending.size(); ++i)
+	{
+		created[i].pipeline = pipelines[i];
+		mPipelines[mPending[i]] = created[i];
+	}
+	for (auto &parent : batchParents)
+	{
+		mParents[parent.first] = mPending[parent.second];
+	}
+	mCreated += static_cast<uint32_t>(mPending.size());
+	mDerived += derived;
+	++mBatches;
+	mCreateMs += ms;
+	mPending.clear();
+}
+
+void PipelineRegistry::setFallback(const GraphicsPipelineDesc &desc)
+{
+	mFallback = &get(desc);
+}
+
+const PipelineRegistry::Pipeline& PipelineRegistry::getOrFallback(const GraphicsPipelineDesc &desc)
+{
+	auto found = mPipelines.find(desc);
+	if (found != mPipelines.end())
+	{
+		++mHits;
+		return found->second;
+	}
+
+	if (mCompileThreads.empty() || mFallback == nullptr)
+	{
+		return get(desc);
+	}
+
+	if (!isCompiling(desc))
+	{
+		std::unique_ptr<CompileJob> job(new CompileJob());
+		job->desc = desc;
+		job->state.reset(new PipelineState());
+		job->requested = Clock::now();
+		job->sequence = ++mJobSequence;
+		prepare(desc, *job->state, job->pipeline);
+
+		//Jobs of one family may run at the same time on different threads,
+		//	so only an existing parent can be the base.
+		//Without one, every job allows derivatives and update makes the first to finish the parent.
+		if (mDerivatives)
+		{
+			VkGraphicsPipelineCreateInfo &pipelineInfo = job->state->pipelineInfo;
+			VkPipeline parent = findParent(desc);
+			if (parent != VK_NULL_HANDLE)
+			{
+				pipelineInfo.flags |= VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+				pipelineInfo.basePipelineHandle = parent;
+				job->base = parent;
+				++mPendingBases[parent];
+			}
+			else
+			{
+				pipelineInfo.flags |= VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+			}
+		}
+
+		mCompiling.push_back(desc);
+		mLatestJob[desc] = job->sequence;
+		submit(std::move(job));
+	}
+	return *mFallback;
+}
+
+bool PipelineRegistry::update(uint64_t frameNumber)
+{
+	mFrameNumber = frameNumber;
+
+	std::vector<std::unique_ptr<CompileJob>> finished;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		finished.swap(mFinished);
+	}
+
+	for (auto &job : finished)
+	{
+		mCompiling.erase(std::find(mCompiling.begin(), mCompiling.end(), job->desc));
+		if (job->base != VK_NULL_HANDLE && --mPendingBases[job->base] == 0)
+		{
+			mPendingBases.erase(job->base);
+		}
+
+		//A reload queued a newer version while this one was compiling
+		auto latest = mLatestJob.find(job->desc);
+		if (latest == mLatestJob.end() || latest->second != job->sequence)
+		{
+			if (job->result == VK_SUCCESS)
+				vkDestroyPipeline(mDevice, job->pipeline.pipeline, nullptr);
+			continue;
+		}
+		mLatestJob.erase(latest);
+
+		auto existing = mPipelines.find(job->desc);
+		if (job->result != VK_SUCCESS)
+		{
+			//A reloaded shader the driver rejects shouldn't end the application
+			if (existing != mPipelines.end())
+			{
+				std::cerr << "failed to recompile a graphics pipeline, keeping the old one" << std::endl;
+				continue;
+			}
+			throw std::runtime_error("Failed to create graphics pipeline!");
+		}
+
+		//Latency: from the request until the pipeline can be used,
+		//	including the time spent waiting in the queue and for this update.
+		double latencyMs = std::chrono::duration<double, std::milli>(Clock::now() - job->requested).count();
+		std::cout << "graphics pipeline compiled in background: " << job->compileMs << " ms compile, "
+			<< latencyMs << " ms until ready, " << queueDepth() << " still queued" << std::endl;
+
+		//Replaced in place, so references handed out by get stay valid.
+		//Frames recorded before this one may still use the old pipeline.
+		if (existing != mPipelines.end())
+		{
+			mRetired.push_back({ existing->second.pipeline, frameNumber });
+			existing->second = job->pipeline;
+			++mReloaded;
+			continue;
+		}
+
+		mPipelines[job->desc] = job->pipeline;
+		if (mDerivatives && findParent(job->desc) == VK_NULL_HANDLE)
+		{
+			mParents[job->desc.familyHash()] = job->desc;
+		}
+		if (job->derived)
+		{
+			++mDerived;
+		}
+		++mAsyncCreated;
+		mAsyncLatencyMs += latencyMs;
+	}
+
+	//Nothing can reference the old modules once every job queued before the reload is done
+	if (mCompiling.empty())
+	{
+		for (VkShaderModule module : mStaleModules)
+		{
+			vkDestroyShaderModule(mDevice, module, nullptr);
+		}
+		mStaleModules.clear();
+	}
+	return !finished.empty();
+}
+
+void PipelineRegistry::destroyRetired(uint64_t finishedFrame)
+{
+	for (auto it = mRetired.begin(); it != mRetired.end();)
+	{
+		//A reload may replace a parent while a derivative of it is still compiling
+		if (it->lastFrame <= finishedFrame && mPendingBases.find(it->pipeline) == mPendingBases.end())
+		{
+			vkDestroyPipeline(mDevice, it->pipeline, nullptr);
+			it = mRetired.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void PipelineRegistry::reload(const std::vector<std::string> &sources)
+{
+	if (sources.empty())
+		return;
+
+	//The next getShaderModule creates the modules from the new code
+	for (auto &source : sources)
+	{
+		auto found = mShaderModules.find(source);
+		if (found != mShaderModules.end())
+		{
+			mStaleModules.push_back(found->second.module);
+			mShaderModules.erase(found);
+		}
+	}
+
+	//Existing pipelines and those still compiling from the old code
+	std::vector<GraphicsPipelineDesc> affected;
+	auto usesChanged = [&sources](const GraphicsPipelineDesc &desc)
+	{
+		return std::find(sources.begin(), sources.end(), desc.vertexShader) != sources.end()
+			|| std::find(sources.begin(), sources.end(), desc.fragmentShader) != sources.end();
+	};
+	for (auto &pipeline : mPipelines)
+	{
+		if (usesChanged(pipeline.first))
+			affected.push_back(pipeline.first);
+	}
+	for (auto &desc : mCompiling)
+	{
+		if (usesChanged(desc) && mPipelines.count(desc) == 0
+			&& std::find(affected.begin(), affected.end(), desc) == affected.end())
+			affected.push_back(desc);
+	}
+
+	for (auto &desc : affected)
+	{
+		std::unique_ptr<CompileJob> job(new CompileJob());
+		job->desc = desc;
+		job->state.reset(new PipelineState());
+		job->requested = Clock::now();
+		job->sequence = ++mJobSequence;
+		prepare(desc, *job->state, job->pipeline);
+
+		//The old parent is retired with its family,
+		//	so the new pipeline can't derive from it but can be the parent of later variants.
+		if (mDerivatives)
+		{
+			job->state->pipelineInfo.flags |= VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+		}
+
+		mCompiling.push_back(desc);
+		mLatestJob[desc] = job->sequence;
+		submit(std::move(job));
+	}
+
+	std::cout << "pipeline registry: " << sources.size() << " shader(s) changed, "
+		<< affected.size() << " pipeline(s) queued for recompilation" << std::endl;
+}
+
+void PipelineRegistry::submit(std::unique_ptr<CompileJob> job)
+{
+	if (mCompileThreads.empty())
+	{
+		compile(*job);
+		std::lock_guard<std::mutex> lock(mMutex);
+		mFinished.push_back(std::move(job));
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQueue.push_back(std::move(job));
+	}
+	mWork.notify_one();
+}
+
+void PipelineRegistry::compile(CompileJob &job)
+{
+	auto start = Clock::now();
+	job.result = vkCreateGraphicsPipelines(mDevice, mPipelineCache->handle(), 1,
+		&job.state->pipelineInfo, nullptr, &job.pipeline.pipeline);
+	job.compileMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	job.derived = job.result == VK_SUCCESS && (job.state->pipelineInfo.flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
+	//The create infos are not needed anymore
+	job.state.reset();
+}
+
+void PipelineRegistry::waitIdle()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mIdle.wait(lock, [this] { return mQueue.empty() && mActive == 0; });
+}
+
+uint32_t PipelineRegistry::queueDepth() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return static_cast<uint32_t>(mQueue.size()) + mActive;
+}
+
+void PipelineRegistry::compileMain()
+{
+	for (;;)
+	{
+		std::unique_ptr<CompileJob> job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWork.wait(lock, [this] { return mQuit || !mQueue.empty(); });
+			if (mQuit)
+				return;
+			job = std::move(mQueue.front());
+			mQueue.pop_front();
+			++mActive;
+		}
+
+		compile(*job);
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mFinished.push_back(std::move(job));
+			--mActive;
+			if (mQueue.empty() && mActive == 0)
+			{
+				mIdle.notify_all();
+			}
+		}
+	}
+}
+
+void PipelineRegistry::stopCompileThreads()
+{
+	//A job being compiled can't be interrupted, the queued ones are simply dropped
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQueue.clear();
+		mQuit = true;
+	}
+	mWork.notify_all();
+	for (auto &thread : mCompileThreads)
+	{
+		thread.join();
+	}
+	mCompileThreads.clear();
+}
+
+VkPipeline PipelineRegistry::findParent(const GraphicsPipelineDesc &desc) const
+{
+	auto parent = mParents.find(desc.familyHash());
+	if (parent == mParents.end())
+		return VK_NULL_HANDLE;
+	auto found = mPipelines.find(parent->second);
+	return found != mPipelines.end() ? found->second.pipeline : VK_NULL_HANDLE;
+}
+
+bool PipelineRegistry::isCompiling(const GraphicsPipelineDesc &desc) const
+{
+	return std::find(mCompiling.begin(), mCompiling.end(), desc) != mCompiling.end();
+}
+
+void PipelineRegistry::releaseRenderPass(VkRenderPass renderPass)
+{
+	//Jobs for the render pass still reference it
+	waitIdle();
+	update(mFrameNumber);
+
+	for (auto it = mPipelines.begin(); it != mPipelines.end();)
+	{
+		if (it->first.renderPass == renderPass)
+		{
+			if (&it->second == mFallback)
+				mFallback = nullptr;
+			vkDestroyPipeline(mDevice, it->second.pipeline, nullptr);
+			it = mPipelines.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	//Derivatives don't depend on their parent after creation,
+	//	the family just needs a new one.
+	for (auto it = mParents.begin(); it != mParents.end();)
+	{
+		if (it->second.renderPass == renderPass)
+			it = mParents.erase(it);
+		else
+			++it;
+	}
+}
+
+void PipelineRegistry::printStats() const
+{
+	std::cout << "pipeline registry: " << mPipelines.size() << " pipelines, "
+		<< mCreated << " created in " << mBatches << " batches (" << mCreateMs << " ms), "
+		<< mDerived << " as derivatives, " << mHits << " lookups reused an existing pipeline" << std::endl;
+	if (mAsyncCreated > 0)
+	{
+		std::cout << "pipeline registry: " << mAsyncCreated << " compiled in background, "
+			<< mAsyncLatencyMs / mAsyncCreated << " ms average until ready" << std::endl;
+	}
+	if (mReloaded > 0)
+	{
+		std::cout << "pipeline registry: " << mReloaded << " replaced after shader changes" << std::endl;
+	}
+}
+
+const PipelineRegistry::ShaderModule& PipelineRegistry::getShaderModule(const std::string &source)
+{
+	auto found = mShaderModules.find(source);
+	if (found != mShaderModules.end())
+	{
+		return found->second;
+	}
+
+	//Embedded modules are used in place, files are mapped only until the module is created,
+	//	the driver keeps its own copy of the code.
+	std::unique_ptr<ShaderBlob> code = mShaders->open(source);
+
+	//pCode has to be 4 byte aligned,
+	//	ShaderBlob guarantees that for both the mapped and the read path.
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code->size();
+	createInfo.pCode = code->words();
+
+	ShaderModule module;
+	if (vkCreateShaderModule(mDevice, &createInfo, nullptr, &module.module) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create shader module!");
+	}
+	//What the shader expects from the pipeline, cached by the module contents
+	module.reflection = &mLayouts->reflect(*code);
+	return mShaderModules[source] = module;
+}
+
+void PipelineRegistry::prepare(const GraphicsPipelineDesc &desc, PipelineState &state, Pipeline &pipeline)
+{
+	const ShaderModule &vertShader = getShaderModule(desc.vertexShader);
+	const ShaderModule &fragShader = getShaderModule(desc.fragmentShader);
+
+	state.shaderStages[0] = {};
+	state.shaderStages[0].sType		= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	state.shaderStages[0].stage		= VK_SHADER_STAGE_VERTEX_BIT;
+	state.shaderStages[0].module	= vertShader.module;
+	state.shaderStages[0].pName		= "main";
+
+	state.shaderStages[1] = {};
+	state.shaderStages[1].sType		= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	state.shaderStages[1].stage		= VK_SHADER_STAGE_FRAGMENT_BIT;
+	state.shaderStages[1].module	= fragShader.module;
+	state.shaderStages[1].pName		= "main";
+
+	PipelineLayoutCache::getVertexInput(*vertShader.reflection, state.bindingDescription, state.attributeDescriptions);
+	fillState(desc, state);
+
+	//Descriptor set layouts and push constant ranges the shaders declare.
+	//The cache owns the layout, pipelines with the same resources get the same one.
+	pipeline.layout = mLayouts->getPipelineLayout({ vertShader.reflection, fragShader.reflection });
+	pipeline.vertexStride = state.bindingDescription.stride;
+	pipeline.vertexAttributes = state.attributeDescriptions;
+
+	VkGraphicsPipelineCreateInfo &pipelineInfo = state.pipelineInfo;
+	pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = state.shaderStages;
+	pipelineInfo.pVertexInputState = &state.vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &state.inputAssembly;
+	pipelineInfo.pViewportState = &state.viewportState;
+	pipelineInfo.pRasterizationState = &state.rasterizer;
+	pipelineInfo.pMultisampleState = &state.multisampling;
+	pipelineInfo.pDepthStencilState = &state.depthStencil;
+	pipelineInfo.pColorBlendState = &state.colorBlending;
+	pipelineInfo.pDynamicState = &state.dynamicState;
+	pipelineInfo.layout = pipeline.layout;
+	pipelineInfo.renderPass = desc.renderPass;
+	pipelineInfo.subpass = desc.subpass;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;	//optional
+	pipelineInfo.basePipelineIndex = -1;				//optional
+}
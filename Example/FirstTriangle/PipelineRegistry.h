@@ -0,0 +1,259 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "GraphicsPipelineDesc.h"
+
+class PipelineCache;
+class PipelineLayoutCache;
+class ShaderManifest;
+struct ShaderReflection;
+
+//Owns every graphics pipeline of the application, keyed by GraphicsPipelineDesc.
+//
+//get returns the existing VkPipeline for a description that was seen before,
+//	so materials sharing the same state never compile it twice.
+//
+//request only queues a description,
+//	flush then creates everything queued with one vkCreateGraphicsPipelines call.
+//Drivers can compile the pipelines of one call in parallel
+//	and only look up the pipeline cache once.
+//
+//Shader modules are created on first use and kept until destroy,
+//	new pipelines with known shaders don't touch the shader files again.
+//
+//With compile threads, getOrFallback never blocks on a pipeline that doesn't exist yet:
+//	the pipeline is compiled on a worker thread
+//	and a designated fallback pipeline is returned until update picks up the result.
+//The workers share the VkPipelineCache of the main thread,
+//	pipeline caches are internally synchronized unless created with
+//	VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT.
+//Everything but the vkCreateGraphicsPipelines call (shader modules, reflection, layouts)
+//	still happens on the calling thread, so the caches used for it need no locking.
+//
+//Variants of one material (same shaders, render pass and depth state,
+//	see GraphicsPipelineDesc::familyHash) are created as pipeline derivatives:
+//	the first one of a family is created with VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT and becomes the parent,
+//	the others with VK_PIPELINE_CREATE_DERIVATIVE_BIT and the parent as their base.
+//In a flush the base is given by its index in the same call, afterwards by its handle.
+//Derivatives are only a hint, whether they are cheaper to create or to switch to
+//	is up to the driver (see HelloTriangleApplication::runPipelineBenchmark).
+//
+//reload rebuilds the pipelines of changed shaders on the compile threads,
+//	the old pipelines keep being used until update swaps the new ones in.
+//The handle in a Pipeline then changes, the old one is retired
+//	and only destroyed once the frames that may still use it have finished.
+class PipelineRegistry
+{
+public:
+	struct Pipeline
+	{
+		VkPipeline			pipeline = VK_NULL_HANDLE;
+		//Owned by the PipelineLayoutCache
+		VkPipelineLayout	layout = VK_NULL_HANDLE;
+		//Size of one vertex the vertex shader reads from binding 0
+		uint32_t			vertexStride = 0;
+		//Its inputs in location order, with the offsets and formats the vertex buffer must have
+		std::vector<VkVertexInputAttributeDescription>	vertexAttributes;
+	};
+
+	PipelineRegistry();
+	//Only stops the compile threads, for when destroy was never reached
+	~PipelineRegistry();
+
+	//compileThreads 0: no background compilation, getOrFallback then creates pipelines right away
+	void create(VkDevice device, PipelineCache &pipelineCache, ShaderManifest &shaders, PipelineLayoutCache &layouts,
+		uint32_t compileThreads = 0);
+
+	//The device has to be idle, pipelines still compiling are waited for
+	void destroy();
+
+	//Creates the pipeline right away if it doesn't exist yet,
+	//	together with everything requested so far.
+	//The reference stays valid until the pipeline is destroyed.
+	const Pipeline& get(const GraphicsPipelineDesc &desc);
+
+	//Queues the creation of desc for the next flush, nothing happens if it already exists
+	void request(const GraphicsPipelineDesc &desc);
+
+	//Creates all requested pipelines in a single vkCreateGraphicsPipelines call
+	void flush();
+
+	//The pipeline getOrFallback returns while the requested one is still compiling.
+	//Created right away, it has to be compatible with the render pass and layout of every description
+	//	it stands in for.
+	void setFallback(const GraphicsPipelineDesc &desc);
+
+	//The pipeline for desc if it exists,
+	//	otherwise queues it for a compile thread and returns the fallback.
+	//Without compile threads it behaves like get.
+	const Pipeline& getOrFallback(const GraphicsPipelineDesc &desc);
+
+	//Takes over the pipelines the compile threads finished, call once per frame.
+	//Returns true if any became available or replaced an existing one.
+	//frameNumber: the frame about to be recorded, replaced pipelines may be used by earlier ones.
+	bool update(uint64_t frameNumber);
+
+	//Destroys the pipelines replaced before finishedFrame + 1,
+	//	every frame up to finishedFrame has to be complete on the GPU.
+	//Ones still named as the base of a derivative being compiled are kept until update took the job over.
+	void destroyRetired(uint64_t finishedFrame);
+
+	//The modules of sources changed on disk (see ShaderManifest::changedSources):
+	//	creates new shader modules and queues every pipeline using them for recompilation.
+	//Without compile threads they are compiled right away.
+	void reload(const std::vector<std::string> &sources);
+
+	//Blocks until the compile threads are done with everything queued
+	void waitIdle();
+
+	//Pipelines queued or compiling on the compile threads
+	uint32_t queueDepth() const;
+
+	//Destroys the pipelines created for renderPass, before the render pass itself is destroyed.
+	//None of them may still be in use by the GPU.
+	void releaseRenderPass(VkRenderPass renderPass);
+
+	//On by default, only affects pipelines created afterwards
+	void setDerivatives(bool enable) { mDerivatives = enable; }
+
+	//Time spent in vkCreateGraphicsPipelines by flush so far
+	double createMs() const { return mCreateMs; }
+
+	void printStats() const;
+
+private:
+	struct DescHash
+	{
+		size_t operator()(const GraphicsPipelineDesc &desc) const { return static_cast<size_t>(desc.hash()); }
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct ShaderModule
+	{
+		VkShaderModule			module = VK_NULL_HANDLE;
+		const ShaderReflection*	reflection = nullptr;
+	};
+
+	//The create info structs of one pipeline,
+	//	they point into each other so they have to stay at one place until creation.
+	struct PipelineState
+	{
+		VkPipelineShaderStageCreateInfo					shaderStages[2];
+		VkVertexInputBindingDescription					bindingDescription;
+		std::vector<VkVertexInputAttributeDescription>	attributeDescriptions;
+		VkPipelineVertexInputStateCreateInfo			vertexInputInfo;
+		VkPipelineInputAssemblyStateCreateInfo			inputAssembly;
+		VkPipelineViewportStateCreateInfo				viewportState;
+		VkPipelineRasterizationStateCreateInfo			rasterizer;
+		VkPipelineMultisampleStateCreateInfo			multisampling;
+		VkPipelineDepthStencilStateCreateInfo			depthStencil;
+		VkPipelineColorBlendAttachmentState				colorBlendAttachment;
+		VkPipelineColorBlendStateCreateInfo				colorBlending;
+		VkDynamicState									dynamicStates[2];
+		VkPipelineDynamicStateCreateInfo				dynamicState;
+		VkGraphicsPipelineCreateInfo					pipelineInfo;
+	};
+
+	//A pipeline handed to the compile threads
+	struct CompileJob
+	{
+		GraphicsPipelineDesc			desc;
+		std::unique_ptr<PipelineState>	state;
+		Pipeline						pipeline;
+		VkResult						result = VK_SUCCESS;
+		Clock::time_point				requested;
+		double							compileMs = 0.0;
+		//Created with VK_PIPELINE_CREATE_DERIVATIVE_BIT
+		bool							derived = false;
+		//basePipelineHandle of a derivative, it must exist until vkCreateGraphicsPipelines returned
+		VkPipeline						base = VK_NULL_HANDLE;
+		//Only the latest job for a description is used, older ones were superseded by a reload
+		uint64_t						sequence = 0;
+	};
+
+	//A pipeline replaced by a reload, in use by frames before lastFrame
+	struct RetiredPipeline
+	{
+		VkPipeline	pipeline;
+		uint64_t	lastFrame;
+	};
+
+	const ShaderModule& getShaderModule(const std::string &source);
+
+	//Everything up to the vkCreateGraphicsPipelines call, on the calling thread
+	void prepare(const GraphicsPipelineDesc &desc, PipelineState &state, Pipeline &pipeline);
+	static void fillState(const GraphicsPipelineDesc &desc, PipelineState &state);
+
+	//The created parent of desc's family, VK_NULL_HANDLE if there is none yet
+	VkPipeline findParent(const GraphicsPipelineDesc &desc) const;
+
+	//Hands the job to a compile thread, or compiles it right away without threads
+	void submit(std::unique_ptr<CompileJob> job);
+	void compile(CompileJob &job);
+
+	void compileMain();
+	void stopCompileThreads();
+	bool isCompiling(const GraphicsPipelineDesc &desc) const;
+
+private:
+	VkDevice				mDevice;
+	PipelineCache*			mPipelineCache;
+	ShaderManifest*			mShaders;
+	PipelineLayoutCache*	mLayouts;
+
+	std::unordered_map<GraphicsPipelineDesc, Pipeline, DescHash>	mPipelines;
+	std::vector<GraphicsPipelineDesc>								mPending;
+	std::map<std::string, ShaderModule>								mShaderModules;
+	const Pipeline*													mFallback;
+	//family hash -> the pipeline the family's derivatives use as their base
+	std::unordered_map<uint64_t, GraphicsPipelineDesc>				mParents;
+	bool															mDerivatives;
+
+	//Descriptions handed to the compile threads and not picked up by update yet,
+	//	only used by the calling thread.
+	std::vector<GraphicsPipelineDesc>			mCompiling;
+	//Sequence number of the latest job of every description in mCompiling
+	std::unordered_map<GraphicsPipelineDesc, uint64_t, DescHash>	mLatestJob;
+	uint64_t									mJobSequence;
+
+	//Replaced by reload
+	std::vector<RetiredPipeline>				mRetired;
+	//Base pipelines of the derivatives in mCompiling, with the number of jobs using each
+	std::map<VkPipeline, uint32_t>				mPendingBases;
+	//Modules of old shader code, queued jobs may still use them
+	std::vector<VkShaderModule>					mStaleModules;
+	uint64_t									mFrameNumber;
+
+	//Compile threads: take jobs from mQueue, put them into mFinished
+	std::vector<std::thread>					mCompileThreads;
+	mutable std::mutex							mMutex;
+	std::condition_variable						mWork;
+	std::condition_variable						mIdle;
+	std::deque<std::unique_ptr<CompileJob>>		mQueue;
+	std::vector<std::unique_ptr<CompileJob>>	mFinished;
+	uint32_t									mActive;
+	bool										mQuit;
+
+	uint32_t				mHits;
+	uint32_t				mCreated;
+	uint32_t				mBatches;
+	uint32_t				mDerived;
+	double					mCreateMs;
+	uint32_t				mAsyncCreated;
+	double					mAsyncLatencyMs;
+	uint32_t				mReloaded;
+};
@@ -2,25 +2,187 @@
 
 #include <fstream>
 #include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
 
-static std::vector<char> readFile(const std::string &filename)
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//The SPIR-V words of a shader file, ready for VkShaderModuleCreateInfo::pCode.
+//
+//The file is memory-mapped, so the driver reads straight from the page cache
+//	and no heap copy is made.
+//Mappings start at a page boundary, which satisfies the 4 byte alignment pCode needs.
+//If mapping is not possible the file is read once into a vector<uint32_t>,
+//	which is aligned as well.
+//
+//Code embedded in the executable is used in place, without any file access.
+//
+//Only keep the blob alive until vkCreateShaderModule returned,
+//	the driver copies the code into the module.
+class ShaderBlob
 {
-	//ate : Start reading at the end of the file
-	//binary : Read the file as binary file
-	//		(avoid text transformations)
+public:
+	//words must stay valid as long as the blob, size is in bytes
+	ShaderBlob(const uint32_t* words, size_t size)
+		: mWords(words)
+		, mSize(size)
+		, mMapped(nullptr)
+#ifdef _WIN32
+		, mFile(INVALID_HANDLE_VALUE)
+		, mMapping(nullptr)
+#endif
+	{
+	}
 
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+	explicit ShaderBlob(const std::string &filename)
+		: mWords(nullptr)
+		, mSize(0)
+		, mMapped(nullptr)
+#ifdef _WIN32
+		, mFile(INVALID_HANDLE_VALUE)
+		, mMapping(nullptr)
+#endif
+	{
+		if (!map(filename))
+		{
+			readAligned(filename);
+		}
 
-	if (!file.is_open())
+		//SPIR-V is a stream of 32 bit words starting with the magic number
+		const uint32_t SPIRV_MAGIC = 0x07230203;
+		if (mSize == 0 || mSize % sizeof(uint32_t) != 0 || mWords[0] != SPIRV_MAGIC)
+		{
+			unmap();
+			throw std::runtime_error("not a SPIR-V file: " + filename);
+		}
+	}
+
+	~ShaderBlob()
 	{
-		throw std::runtime_error("Failed to open file!");
+		unmap();
 	}
-	size_t fileSize = (size_t)file.tellg();
 
-	std::vector<char> buffer(fileSize);
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-	file.close();
+	ShaderBlob(const ShaderBlob&) = delete;
+	ShaderBlob& operator=(const ShaderBlob&) = delete;
+
+	const uint32_t* words() const { return mWords; }
+
+	//in bytes, as VkShaderModuleCreateInfo::codeSize expects
+	size_t size() const { return mSize; }
+
+	bool isMapped() const { return mMapped != nullptr; }
+
+private:
+	bool map(const std::string &filename)
+	{
+#ifdef _WIN32
+		mFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (mFile == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart == 0)
+		{
+			unmap();
+			return false;
+		}
+
+		mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mMapping == nullptr)
+		{
+			unmap();
+			return false;
+		}
+
+		mMapped = MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+		if (mMapped == nullptr)
+		{
+			unmap();
+			return false;
+		}
+		mSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+
+		void* mapped = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		//The mapping keeps its own reference to the file
+		close(fd);
+		if (mapped == MAP_FAILED)
+			return false;
+
+		mMapped = mapped;
+		mSize = static_cast<size_t>(fileStat.st_size);
+#endif
+		mWords = static_cast<const uint32_t*>(mMapped);
+		return true;
+	}
+
+	void readAligned(const std::string &filename)
+	{
+		std::ifstream file(filename, std::ios::ate | std::ios::binary);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Failed to open file: " + filename);
+		}
+
+		mSize = (size_t)file.tellg();
+		mFallback.resize((mSize + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+		file.seekg(0);
+		file.read(reinterpret_cast<char*>(mFallback.data()), mSize);
+		//A file truncated while it is read would otherwise pass as zero padded code
+		if (static_cast<size_t>(file.gcount()) != mSize)
+		{
+			throw std::runtime_error("Failed to read file: " + filename);
+		}
+		mWords = mFallback.data();
+	}
+
+	void unmap()
+	{
+#ifdef _WIN32
+		if (mMapped != nullptr)
+			UnmapViewOfFile(mMapped);
+		if (mMapping != nullptr)
+			CloseHandle(mMapping);
+		if (mFile != INVALID_HANDLE_VALUE)
+			CloseHandle(mFile);
+		mMapping = nullptr;
+		mFile = INVALID_HANDLE_VALUE;
+#else
+		if (mMapped != nullptr)
+			munmap(mMapped, mSize);
+#endif
+		mMapped = nullptr;
+	}
 
-	return buffer;
-}
\ No newline at end of file
+private:
+	const uint32_t*			mWords;
+	size_t					mSize;
+	void*					mMapped;
+	std::vector<uint32_t>	mFallback;
+#ifdef _WIN32
+	HANDLE					mFile;
+	HANDLE					mMapping;
+#endif
+};
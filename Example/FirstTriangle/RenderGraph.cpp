@@ -0,0 +1,921 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+//Only these need to be made available, reads just have to happen after them
+static const VkAccessFlags WRITE_ACCESS = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+	| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+static const uint32_t NO_PHYSICAL_IMAGE = ~0u;
+
+static const char* loadOpName(VkAttachmentLoadOp op)
+{
+	switch (op)
+	{
+	case VK_ATTACHMENT_LOAD_OP_LOAD:	return "load";
+	case VK_ATTACHMENT_LOAD_OP_CLEAR:	return "clear";
+	default:							return "don't care";
+	}
+}
+
+static const char* storeOpName(VkAttachmentStoreOp op)
+{
+	return op == VK_ATTACHMENT_STORE_OP_STORE ? "store" : "don't care";
+}
+
+RenderGraph::RenderGraph()
+	: mDevice(VK_NULL_HANDLE)
+	, mAllocator(nullptr)
+	, mCompiled(false)
+	, mExtent({ 0, 0 })
+{
+}
+
+void RenderGraph::create(VkDevice device, DeviceAllocator &allocator)
+{
+	mDevice = device;
+	mAllocator = &allocator;
+	mCompiled = false;
+}
+
+void RenderGraph::destroy()
+{
+	destroyTargets(mTargets);
+	for (auto &pass : mPasses)
+	{
+		if (pass.renderPass != VK_NULL_HANDLE)
+		{
+			vkDestroyRenderPass(mDevice, pass.renderPass, nullptr);
+		}
+	}
+	mPasses.clear();
+	mResources.clear();
+	mPhysicalImages.clear();
+	mFinalBarrier = Barrier();
+	mCompiled = false;
+}
+
+RenderGraph::ResourceId RenderGraph::importImage(const std::string &name, VkFormat format, VkSampleCountFlagBits samples,
+	VkImageLayout finalLayout, VkPipelineStageFlags availableStage)
+{
+	Resource resource;
+	resource.name = name;
+	resource.imported = true;
+	resource.format = format;
+	resource.samples = samples;
+	resource.finalLayout = finalLayout;
+	resource.availableStage = availableStage;
+	mResources.push_back(resource);
+	return static_cast<ResourceId>(mResources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::importBuffer(const std::string &name)
+{
+	Resource resource;
+	resource.name = name;
+	resource.image = false;
+	resource.imported = true;
+	mResources.push_back(resource);
+	return static_cast<ResourceId>(mResources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::createImage(const std::string &name, VkFormat format, VkSampleCountFlagBits samples)
+{
+	Resource resource;
+	resource.name = name;
+	resource.format = format;
+	resource.samples = samples;
+	mResources.push_back(resource);
+	return static_cast<ResourceId>(mResources.size() - 1);
+}
+
+RenderGraph::PassId RenderGraph::addPass(const std::string &name, PassType type, const RecordFunction &record)
+{
+	if (mCompiled)
+	{
+		throw std::runtime_error("render graph: can't add " + name + " after compile!");
+	}
+	Pass pass;
+	pass.name = name;
+	pass.type = type;
+	pass.record = record;
+	mPasses.push_back(pass);
+	return static_cast<PassId>(mPasses.size() - 1);
+}
+
+void RenderGraph::use(PassId pass, ResourceId resource, Usage usage, const VkClearValue* clearValue)
+{
+	UsageInfo info = usageInfo(usage);
+	if (info.attachment && mPasses[pass].type != PassType::Graphics)
+	{
+		throw std::runtime_error("render graph: " + mPasses[pass].name + " uses an attachment but is no graphics pass!");
+	}
+	//Attachments and sampled images need an image, the fixed function reads a buffer.
+	//Storage and transfer uses work with both.
+	bool imageOnly = info.attachment || usage == Usage::SampledFragment || usage == Usage::SampledCompute;
+	bool bufferOnly = info.layout == VK_IMAGE_LAYOUT_UNDEFINED;
+	if ((imageOnly && !mResources[resource].image) || (bufferOnly && mResources[resource].image))
+	{
+		throw std::runtime_error("render graph: " + mResources[resource].name + " can't be used like that by " + mPasses[pass].name + "!");
+	}
+
+	Use entry;
+	entry.resource = resource;
+	entry.usage = usage;
+	entry.clear = clearValue != nullptr && info.attachment;
+	entry.clearValue = clearValue != nullptr ? *clearValue : VkClearValue();
+	mPasses[pass].uses.push_back(entry);
+}
+
+RenderGraph::UsageInfo RenderGraph::usageInfo(Usage usage)
+{
+	const VkPipelineStageFlags fragmentTests = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	switch (usage)
+	{
+	case Usage::ColorAttachment:
+		//READ for blending and LOAD_OP_LOAD
+		return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, true };
+	case Usage::ResolveAttachment:
+		return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, true };
+	case Usage::DepthAttachment:
+		return { fragmentTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true, true };
+	case Usage::DepthReadOnly:
+		return { fragmentTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false, true };
+	case Usage::SampledFragment:
+		return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, false };
+	case Usage::SampledCompute:
+		return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, false };
+	case Usage::StorageRead:
+		return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_GENERAL, false, false };
+	case Usage::StorageWrite:
+		//Atomics and partial writes read what was there before
+		return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_GENERAL, true, false };
+	case Usage::TransferSource:
+		return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false, false };
+	case Usage::TransferDestination:
+		return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true, false };
+	case Usage::IndirectBuffer:
+		return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, false, false };
+	case Usage::VertexBuffer:
+		return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, false, false };
+	case Usage::IndexBuffer:
+	default:
+		return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, false, false };
+	}
+}
+
+bool RenderGraph::isDepthFormat(VkFormat format)
+{
+	return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_X8_D24_UNORM_PACK32 || format == VK_FORMAT_D32_SFLOAT
+		|| format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+VkImageAspectFlags RenderGraph::aspectOf(VkFormat format)
+{
+	if (format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT)
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	return isDepthFormat(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+}
+
+/************************************************************************/
+/*	Compilation
+/************************************************************************/
+void RenderGraph::compile()
+{
+	cullPasses();
+	assignPhysicalImages();
+
+	//The first run finds out where a frame leaves the graph's images and the imported buffers,
+	//	the second one plans the barriers against that, as every frame but the first sees it.
+	//Imported images start over every frame, their previous use is outside the graph.
+	std::vector<State> states(mResources.size() + mPhysicalImages.size());
+	planPasses(states);
+	for (ResourceId i = 0; i < mResources.size(); ++i)
+	{
+		if (mResources[i].imported && mResources[i].image)
+		{
+			states[i] = State();
+		}
+	}
+	planPasses(states);
+	findTransientImages();
+
+	for (auto &pass : mPasses)
+	{
+		if (!pass.culled && pass.type == PassType::Graphics)
+		{
+			createRenderPass(pass);
+		}
+	}
+	mCompiled = true;
+	printSchedule();
+}
+
+void RenderGraph::cullPasses()
+{
+	//Backwards from the imported resources:
+	//	a pass is needed if it writes something a needed pass reads afterwards.
+	std::vector<bool> needed(mResources.size(), false);
+	for (size_t p = mPasses.size(); p-- > 0;)
+	{
+		Pass &pass = mPasses[p];
+		pass.culled = true;
+		for (const auto &use : pass.uses)
+		{
+			if (usageInfo(use.usage).write && (mResources[use.resource].imported || needed[use.resource]))
+			{
+				pass.culled = false;
+			}
+		}
+		if (pass.culled)
+			continue;
+
+		//A clear or resolve replaces the contents, everything else builds on them
+		for (const auto &use : pass.uses)
+		{
+			UsageInfo info = usageInfo(use.usage);
+			bool replaces = info.attachment && (use.clear || use.usage == Usage::ResolveAttachment);
+			needed[use.resource] = !replaces;
+		}
+	}
+}
+
+void RenderGraph::assignPhysicalImages()
+{
+	//Lifetimes of the graph's images in passes that survived culling
+	std::vector<uint32_t> first(mResources.size(), ~0u);
+	std::vector<uint32_t> last(mResources.size(), 0);
+	std::vector<VkImageUsageFlags> usage(mResources.size(), 0);
+	for (uint32_t p = 0; p < mPasses.size(); ++p)
+	{
+		if (mPasses[p].culled)
+			continue;
+		for (const auto &use : mPasses[p].uses)
+		{
+			first[use.resource] = std::min(first[use.resource], p);
+			last[use.resource] = std::max(last[use.resource], p);
+			switch (use.usage)
+			{
+			case Usage::ColorAttachment:
+			case Usage::ResolveAttachment:		usage[use.resource] |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; break;
+			case Usage::DepthAttachment:
+			case Usage::DepthReadOnly:			usage[use.resource] |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT; break;
+			case Usage::SampledFragment:
+			case Usage::SampledCompute:			usage[use.resource] |= VK_IMAGE_USAGE_SAMPLED_BIT; break;
+			case Usage::StorageRead:
+			case Usage::StorageWrite:			usage[use.resource] |= VK_IMAGE_USAGE_STORAGE_BIT; break;
+			case Usage::TransferSource:			usage[use.resource] |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT; break;
+			case Usage::TransferDestination:	usage[use.resource] |= VK_IMAGE_USAGE_TRANSFER_DST_BIT; break;
+			default:							break;
+			}
+		}
+	}
+
+	std::vector<ResourceId> images;
+	for (ResourceId i = 0; i < mResources.size(); ++i)
+	{
+		mResources[i].physical = NO_PHYSICAL_IMAGE;
+		if (!mResources[i].imported && first[i] != ~0u)
+		{
+			images.push_back(i);
+		}
+	}
+	std::sort(images.begin(), images.end(), [&first](ResourceId a, ResourceId b) { return first[a] < first[b]; });
+
+	//Greedy: the first compatible image that is free again by the time the resource is first used
+	mPhysicalImages.clear();
+	for (ResourceId id : images)
+	{
+		Resource &resource = mResources[id];
+		for (uint32_t i = 0; i < mPhysicalImages.size(); ++i)
+		{
+			const PhysicalImage &physical = mPhysicalImages[i];
+			if (physical.format == resource.format && physical.samples == resource.samples && physical.lastPass < first[id])
+			{
+				resource.physical = i;
+				break;
+			}
+		}
+		if (resource.physical == NO_PHYSICAL_IMAGE)
+		{
+			PhysicalImage physical;
+			physical.format = resource.format;
+			physical.samples = resource.samples;
+			mPhysicalImages.push_back(physical);
+			resource.physical = static_cast<uint32_t>(mPhysicalImages.size() - 1);
+		}
+		mPhysicalImages[resource.physical].lastPass = last[id];
+		mPhysicalImages[resource.physical].usage |= usage[id];
+	}
+}
+
+void RenderGraph::findTransientImages()
+{
+	std::vector<bool> transient(mPhysicalImages.size(), true);
+	for (const auto &pass : mPasses)
+	{
+		if (pass.culled)
+			continue;
+		for (const auto &use : pass.uses)
+		{
+			if (!mResources[use.resource].imported && !usageInfo(use.usage).attachment)
+			{
+				transient[mResources[use.resource].physical] = false;
+			}
+		}
+		for (size_t i = 0; i < pass.attachments.size(); ++i)
+		{
+			const Resource &resource = mResources[pass.attachments[i]];
+			const VkAttachmentDescription &description = pass.attachmentDescriptions[i];
+			if (!resource.imported && (description.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD
+				|| description.storeOp == VK_ATTACHMENT_STORE_OP_STORE))
+			{
+				transient[resource.physical] = false;
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < mPhysicalImages.size(); ++i)
+	{
+		mPhysicalImages[i].transient = transient[i];
+		if (transient[i])
+		{
+			mPhysicalImages[i].usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		}
+	}
+}
+
+uint32_t RenderGraph::stateIndex(ResourceId resource) const
+{
+	const Resource &entry = mResources[resource];
+	return entry.imported ? resource : static_cast<uint32_t>(mResources.size()) + entry.physical;
+}
+
+bool RenderGraph::contentsReadAfter(ResourceId resource, uint32_t after) const
+{
+	for (uint32_t p = after + 1; p < mPasses.size(); ++p)
+	{
+		if (mPasses[p].culled)
+			continue;
+		for (const auto &use : mPasses[p].uses)
+		{
+			if (use.resource != resource)
+				continue;
+			UsageInfo info = usageInfo(use.usage);
+			return !(info.attachment && (use.clear || use.usage == Usage::ResolveAttachment));
+		}
+	}
+	return false;
+}
+
+void RenderGraph::planPasses(std::vector<State> &states)
+{
+	//Imported buffers hold data from before the frame, everything else is written in it
+	std::vector<bool> written(mResources.size(), false);
+	std::vector<uint32_t> lastUse(mResources.size(), 0);
+	for (ResourceId i = 0; i < mResources.size(); ++i)
+	{
+		written[i] = mResources[i].imported && !mResources[i].image;
+		if (mResources[i].imported && mResources[i].image)
+		{
+			states[i].writeStages = mResources[i].availableStage;
+		}
+	}
+	for (uint32_t p = 0; p < mPasses.size(); ++p)
+	{
+		if (mPasses[p].culled)
+			continue;
+		for (const auto &use : mPasses[p].uses)
+		{
+			lastUse[use.resource] = p;
+		}
+	}
+
+	for (uint32_t p = 0; p < mPasses.size(); ++p)
+	{
+		Pass &pass = mPasses[p];
+		pass.barrier = Barrier();
+		pass.attachments.clear();
+		pass.attachmentDescriptions.clear();
+		pass.clearValues.clear();
+		pass.dependencies.clear();
+		pass.framebufferPerImage = false;
+		if (pass.culled)
+			continue;
+
+		VkSubpassDependency in = {};
+		in.srcSubpass = VK_SUBPASS_EXTERNAL;
+		in.dstSubpass = 0;
+		bool needsIn = false;
+		VkSubpassDependency out = {};
+		out.srcSubpass = 0;
+		out.dstSubpass = VK_SUBPASS_EXTERNAL;
+		bool needsOut = false;
+
+		for (const auto &use : pass.uses)
+		{
+			const Resource &resource = mResources[use.resource];
+			State &state = states[stateIndex(use.resource)];
+			UsageInfo info = usageInfo(use.usage);
+
+			bool replaces = info.attachment && (use.clear || use.usage == Usage::ResolveAttachment);
+			bool contents = written[use.resource] && !replaces;
+			if (!written[use.resource] && !info.write)
+			{
+				throw std::runtime_error("render graph: " + pass.name + " reads " + resource.name + " before any pass writes it!");
+			}
+
+			//Contents that aren't needed are discarded by transitioning from UNDEFINED
+			VkImageLayout oldLayout = contents ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+			bool transition = resource.image && oldLayout != info.layout;
+
+			//Write after write and write after read, or read after write not yet visible to this stage.
+			//A layout transition is a write as well.
+			VkPipelineStageFlags srcStages = 0;
+			VkAccessFlags srcAccess = 0;
+			if (info.write || transition)
+			{
+				srcStages = state.writeStages | state.readStages;
+				srcAccess = state.writeAccess;
+			}
+			else if (state.writeStages != 0 && (state.visibleStages & info.stages) != info.stages)
+			{
+				srcStages = state.writeStages;
+				srcAccess = state.writeAccess;
+			}
+			bool synchronize = srcStages != 0 || transition;
+
+			VkImageLayout layoutAfter = info.layout;
+			if (info.attachment)
+			{
+				//LOAD_OP_LOAD preserves the existing contents, CLEAR sets them to a constant,
+				//	DONT_CARE leaves them undefined, which is the cheapest on tiled GPUs.
+				//STORE_OP_STORE writes the rendered contents to memory,
+				//	DONT_CARE lets them be thrown away after the pass.
+				VkAttachmentDescription description = {};
+				description.format = resource.format;
+				description.samples = resource.samples;
+				description.loadOp = use.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR
+					: contents ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				description.storeOp = resource.imported || contentsReadAfter(use.resource, p)
+					? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				bool stencil = (aspectOf(resource.format) & VK_IMAGE_ASPECT_STENCIL_BIT) != 0;
+				description.stencilLoadOp = stencil ? description.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				description.stencilStoreOp = stencil ? description.storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				description.initialLayout = oldLayout;
+				description.finalLayout = info.layout;
+
+				//The last use of an imported image moves it to its final layout on the way out
+				if (resource.imported && lastUse[use.resource] == p && resource.finalLayout != info.layout)
+				{
+					description.finalLayout = resource.finalLayout;
+					layoutAfter = resource.finalLayout;
+					out.srcStageMask |= info.stages;
+					out.srcAccessMask |= info.access & WRITE_ACCESS;
+					out.dstStageMask |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+					needsOut = true;
+				}
+
+				pass.attachments.push_back(use.resource);
+				pass.attachmentDescriptions.push_back(description);
+				pass.clearValues.push_back(use.clearValue);
+				pass.framebufferPerImage = pass.framebufferPerImage || resource.imported;
+
+				if (synchronize)
+				{
+					in.srcStageMask |= srcStages;
+					in.srcAccessMask |= srcAccess;
+					in.dstStageMask |= info.stages;
+					in.dstAccessMask |= info.access;
+					needsIn = true;
+				}
+			}
+			else if (synchronize)
+			{
+				pass.barrier.srcStages |= srcStages;
+				pass.barrier.dstStages |= info.stages;
+				if (resource.image)
+				{
+					pass.barrier.images.push_back({ use.resource, srcAccess, info.access, oldLayout, info.layout });
+				}
+				else
+				{
+					pass.barrier.memory = true;
+					pass.barrier.memorySrcAccess |= srcAccess;
+					pass.barrier.memoryDstAccess |= info.access;
+				}
+			}
+
+			if (info.write)
+			{
+				state.writeStages = info.stages;
+				state.writeAccess = info.access & WRITE_ACCESS;
+				state.readStages = 0;
+				state.visibleStages = 0;
+			}
+			else if (transition)
+			{
+				//Later reads in other stages have to wait for the transition
+				state.writeStages = info.stages;
+				state.writeAccess = 0;
+				state.readStages = info.stages;
+				state.visibleStages = info.stages;
+			}
+			else
+			{
+				state.readStages |= info.stages;
+				if (synchronize)
+				{
+					state.visibleStages |= info.stages;
+				}
+			}
+			if (layoutAfter != info.layout)
+			{
+				state.writeStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+				state.writeAccess = 0;
+				state.readStages = 0;
+				state.visibleStages = 0;
+			}
+			if (resource.image)
+			{
+				state.layout = layoutAfter;
+			}
+			written[use.resource] = written[use.resource] || info.write;
+		}
+
+		if (needsIn)
+		{
+			if (in.srcStageMask == 0)
+			{
+				in.srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			}
+			pass.dependencies.push_back(in);
+		}
+		if (needsOut)
+		{
+			pass.dependencies.push_back(out);
+		}
+		if (pass.barrier.srcStages == 0 && !pass.barrier.empty())
+		{
+			pass.barrier.srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		}
+	}
+
+	//Imported images whose last use wasn't an attachment
+	mFinalBarrier = Barrier();
+	for (ResourceId i = 0; i < mResources.size(); ++i)
+	{
+		const Resource &resource = mResources[i];
+		State &state = states[i];
+		if (!resource.imported || !resource.image || !written[i] || state.layout == resource.finalLayout)
+			continue;
+
+		mFinalBarrier.srcStages |= state.writeStages | state.readStages;
+		mFinalBarrier.dstStages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		mFinalBarrier.images.push_back({ i, state.writeAccess, 0, state.layout, resource.finalLayout });
+		state.layout = resource.finalLayout;
+	}
+	if (mFinalBarrier.srcStages == 0 && !mFinalBarrier.empty())
+	{
+		mFinalBarrier.srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	}
+}
+
+void RenderGraph::createRenderPass(Pass &pass)
+{
+	std::vector<VkAttachmentReference> colorReferences;
+	std::vector<VkAttachmentReference> resolveReferences;
+	VkAttachmentReference depthReference = {};
+	bool hasDepth = false;
+
+	uint32_t attachment = 0;
+	for (const auto &use : pass.uses)
+	{
+		UsageInfo info = usageInfo(use.usage);
+		if (!info.attachment)
+			continue;
+
+		VkAttachmentReference reference = { attachment++, info.layout };
+		if (use.usage == Usage::ColorAttachment)
+		{
+			colorReferences.push_back(reference);
+		}
+		else if (use.usage == Usage::ResolveAttachment)
+		{
+			resolveReferences.push_back(reference);
+		}
+		else
+		{
+			if (hasDepth)
+			{
+				throw std::runtime_error("render graph: " + pass.name + " has more than one depth attachment!");
+			}
+			depthReference = reference;
+			hasDepth = true;
+		}
+	}
+	if (!resolveReferences.empty() && resolveReferences.size() != colorReferences.size())
+	{
+		throw std::runtime_error("render graph: " + pass.name + " needs one resolve attachment per color attachment!");
+	}
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+	subpass.pColorAttachments = colorReferences.data();
+	subpass.pResolveAttachments = resolveReferences.empty() ? nullptr : resolveReferences.data();
+	subpass.pDepthStencilAttachment = hasDepth ? &depthReference : nullptr;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = static_cast<uint32_t>(pass.attachmentDescriptions.size());
+	renderPassInfo.pAttachments = pass.attachmentDescriptions.data();
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = static_cast<uint32_t>(pass.dependencies.size());
+	renderPassInfo.pDependencies = pass.dependencies.data();
+
+	if (vkCreateRenderPass(mDevice, &renderPassInfo, nullptr, &pass.renderPass) != VK_SUCCESS)
+	{
+		throw std::runtime_error("render graph: failed to create the render pass of " + pass.name + "!");
+	}
+}
+
+VkRenderPass RenderGraph::renderPass(PassId pass) const
+{
+	return mPasses[pass].renderPass;
+}
+
+/************************************************************************/
+/*	Targets
+/************************************************************************/
+void RenderGraph::setImportedImages(ResourceId resource, const std::vector<VkImage> &images, const std::vector<VkImageView> &views)
+{
+	mResources[resource].images = images;
+	mResources[resource].views = views;
+}
+
+void RenderGraph::createTargets(VkExtent2D extent)
+{
+	mExtent = extent;
+	for (const auto &physical : mPhysicalImages)
+	{
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = physical.format;
+		imageInfo.extent.width = extent.width;
+		imageInfo.extent.height = extent.height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = physical.samples;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = physical.usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		DeviceAllocation memory;
+		VkImage image = physical.transient
+			? mAllocator->createTransientImage(imageInfo, memory)
+			: mAllocator->createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory);
+		mTargets.images.push_back(image);
+		mTargets.memory.push_back(memory);
+
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = physical.format;
+		viewInfo.subresourceRange.aspectMask = aspectOf(physical.format);
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.layerCount = 1;
+		VkImageView view;
+		if (vkCreateImageView(mDevice, &viewInfo, nullptr, &view) != VK_SUCCESS)
+		{
+			throw std::runtime_error("render graph: failed to create an image view!");
+		}
+		mTargets.views.push_back(view);
+	}
+
+	//Passes drawing into an imported image need one framebuffer per image of it
+	for (auto &pass : mPasses)
+	{
+		if (pass.culled || pass.type != PassType::Graphics)
+			continue;
+
+		uint32_t count = 1;
+		for (ResourceId id : pass.attachments)
+		{
+			if (mResources[id].imported)
+			{
+				count = static_cast<uint32_t>(mResources[id].views.size());
+			}
+		}
+
+		pass.firstFramebuffer = static_cast<uint32_t>(mTargets.framebuffers.size());
+		std::vector<VkImageView> attachments(pass.attachments.size());
+		for (uint32_t image = 0; image < count; ++image)
+		{
+			for (size_t i = 0; i < pass.attachments.size(); ++i)
+			{
+				attachments[i] = viewOf(pass.attachments[i], image);
+			}
+
+			VkFramebufferCreateInfo frameBufferInfo = {};
+			frameBufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			frameBufferInfo.renderPass = pass.renderPass;
+			frameBufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+			frameBufferInfo.pAttachments = attachments.data();
+			frameBufferInfo.width = extent.width;
+			frameBufferInfo.height = extent.height;
+			frameBufferInfo.layers = 1;
+
+			VkFramebuffer frameBuffer;
+			if (vkCreateFramebuffer(mDevice, &frameBufferInfo, nullptr, &frameBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("render graph: failed to create the framebuffer of " + pass.name + "!");
+			}
+			mTargets.framebuffers.push_back(frameBuffer);
+		}
+	}
+}
+
+RenderGraph::Targets RenderGraph::releaseTargets()
+{
+	Targets targets;
+	std::swap(targets, mTargets);
+	return targets;
+}
+
+void RenderGraph::destroyTargets(Targets &targets)
+{
+	for (auto frameBuffer : targets.framebuffers)
+	{
+		vkDestroyFramebuffer(mDevice, frameBuffer, nullptr);
+	}
+	for (auto view : targets.views)
+	{
+		vkDestroyImageView(mDevice, view, nullptr);
+	}
+	for (size_t i = 0; i < targets.images.size(); ++i)
+	{
+		mAllocator->destroyImage(targets.images[i], targets.memory[i]);
+	}
+	targets = Targets();
+}
+
+VkImage RenderGraph::imageOf(ResourceId resource, uint32_t imageIndex) const
+{
+	const Resource &entry = mResources[resource];
+	return entry.imported ? entry.images[imageIndex] : mTargets.images[entry.physical];
+}
+
+VkImageView RenderGraph::viewOf(ResourceId resource, uint32_t imageIndex) const
+{
+	const Resource &entry = mResources[resource];
+	return entry.imported ? entry.views[imageIndex] : mTargets.views[entry.physical];
+}
+
+/************************************************************************/
+/*	Execution
+/************************************************************************/
+void RenderGraph::execute(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frameIndex) const
+{
+	for (const auto &pass : mPasses)
+	{
+		if (pass.culled)
+			continue;
+
+		recordBarrier(commandBuffer, pass.barrier, imageIndex);
+
+		PassContext context = {};
+		context.contents = pass.contents;
+		context.extent = mExtent;
+		context.imageIndex = imageIndex;
+		context.frameIndex = frameIndex;
+
+		if (pass.type != PassType::Graphics)
+		{
+			pass.record(commandBuffer, context);
+			continue;
+		}
+
+		context.renderPass = pass.renderPass;
+		context.framebuffer = mTargets.framebuffers[pass.firstFramebuffer + (pass.framebufferPerImage ? imageIndex : 0)];
+
+		VkRenderPassBeginInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = context.renderPass;
+		renderPassInfo.framebuffer = context.framebuffer;
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = mExtent;
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(pass.clearValues.size());
+		renderPassInfo.pClearValues = pass.clearValues.data();
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, pass.contents);
+		pass.record(commandBuffer, context);
+		vkCmdEndRenderPass(commandBuffer);
+	}
+
+	recordBarrier(commandBuffer, mFinalBarrier, imageIndex);
+}
+
+void RenderGraph::recordBarrier(VkCommandBuffer commandBuffer, const Barrier &barrier, uint32_t imageIndex) const
+{
+	if (barrier.empty())
+		return;
+
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = barrier.memorySrcAccess;
+	memoryBarrier.dstAccessMask = barrier.memoryDstAccess;
+
+	std::vector<VkImageMemoryBarrier> imageBarriers(barrier.images.size());
+	for (size_t i = 0; i < barrier.images.size(); ++i)
+	{
+		const ImageBarrier &entry = barrier.images[i];
+		VkImageMemoryBarrier &imageBarrier = imageBarriers[i];
+		imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageBarrier.srcAccessMask = entry.srcAccess;
+		imageBarrier.dstAccessMask = entry.dstAccess;
+		imageBarrier.oldLayout = entry.oldLayout;
+		imageBarrier.newLayout = entry.newLayout;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = imageOf(entry.resource, imageIndex);
+		imageBarrier.subresourceRange.aspectMask = aspectOf(mResources[entry.resource].format);
+		imageBarrier.subresourceRange.baseMipLevel = 0;
+		imageBarrier.subresourceRange.levelCount = 1;
+		imageBarrier.subresourceRange.baseArrayLayer = 0;
+		imageBarrier.subresourceRange.layerCount = 1;
+	}
+
+	vkCmdPipelineBarrier(commandBuffer, barrier.srcStages, barrier.dstStages, 0,
+		barrier.memory ? 1 : 0, &memoryBarrier,
+		0, nullptr,
+		static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+void RenderGraph::printSchedule() const
+{
+	uint32_t graphImages = 0;
+	for (const auto &resource : mResources)
+	{
+		if (!resource.imported && resource.physical != NO_PHYSICAL_IMAGE)
+		{
+			++graphImages;
+		}
+	}
+	uint32_t transientImages = 0;
+	for (const auto &physical : mPhysicalImages)
+	{
+		transientImages += physical.transient ? 1 : 0;
+	}
+	std::cout << "render graph: " << mPasses.size() << " passes, " << graphImages << " images in "
+		<< mPhysicalImages.size() << " allocations, " << transientImages << " transient" << std::endl;
+
+	for (const auto &pass : mPasses)
+	{
+		if (pass.culled)
+		{
+			std::cout << "\t" << pass.name << ": culled, nothing reads its results" << std::endl;
+			continue;
+		}
+
+		std::cout << "\t" << pass.name << ": ";
+		if (pass.barrier.empty())
+		{
+			std::cout << "no barrier";
+		}
+		else
+		{
+			std::cout << "barrier 0x" << std::hex << pass.barrier.srcStages << " -> 0x" << pass.barrier.dstStages << std::dec
+				<< " (" << pass.barrier.images.size() << " images" << (pass.barrier.memory ? ", buffers" : "") << ")";
+		}
+		std::cout << std::endl;
+
+		for (size_t i = 0; i < pass.attachments.size(); ++i)
+		{
+			const VkAttachmentDescription &description = pass.attachmentDescriptions[i];
+			std::cout << "\t\t" << mResources[pass.attachments[i]].name << ": " << loadOpName(description.loadOp)
+				<< ", " << storeOpName(description.storeOp) << std::endl;
+		}
+	}
+}
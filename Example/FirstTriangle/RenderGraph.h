@@ -0,0 +1,286 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "DeviceAllocator.h"
+
+//A frame described as passes and the resources they use.
+//
+//Passes are declared in execution order and only say what they read and write (use).
+//compile derives everything else:
+//	- Pass culling: a pass whose results are never read and don't reach an imported resource is dropped.
+//	- One VkRenderPass per graphics pass.
+//		Load and store ops follow from the neighbouring uses:
+//		an attachment is only loaded if an earlier pass wrote it and only stored if a later pass reads it.
+//		Layout transitions into the attachment layouts happen in the render pass (initialLayout),
+//		synchronized by an external subpass dependency.
+//	- Pipeline barriers for everything used outside of attachments,
+//		one vkCmdPipelineBarrier per pass with only the stages of the accesses involved:
+//		a read after a write waits for the writing stages, a write after reads only for the reading stages,
+//		reads after reads don't wait at all.
+//		Buffers are synchronized with a global VkMemoryBarrier, images get an image barrier each.
+//	- Aliasing: images created by the graph share one VkImage
+//		if their format and sample count match and the passes using them don't overlap.
+//	- Transient images: a graph image that is only used as an attachment
+//		and never loaded or stored (e.g. depth, or multisampled color resolved in the pass)
+//		is created with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT in lazily allocated memory,
+//		on tile-based GPUs it then only exists in tile memory.
+//
+//Imported resources live outside the graph (swap chain images, buffers of the application).
+//Imported images start undefined and are left in their final layout,
+//	imported buffers are assumed to be written before the frame (e.g. by an upload).
+//Images created by the graph never keep their contents from one frame to the next.
+//
+//Everything runs on one queue, so the barriers of the first pass also order it
+//	after the last pass of the previous frame, which may still be running.
+class RenderGraph
+{
+public:
+	typedef uint32_t ResourceId;
+	typedef uint32_t PassId;
+
+	enum class PassType
+	{
+		//Runs inside a render pass made of its attachments
+		Graphics,
+		Compute,
+		Transfer
+	};
+
+	//How a pass uses a resource, each maps to the stages, access and image layout of that use
+	enum class Usage
+	{
+		//Attachments of graphics passes.
+		//The n-th ResolveAttachment receives the resolved n-th ColorAttachment.
+		ColorAttachment,
+		ResolveAttachment,
+		DepthAttachment,
+		DepthReadOnly,
+		//Images read in shaders
+		SampledFragment,
+		SampledCompute,
+		//Storage images and buffers in compute shaders, StorageWrite may also read (atomics)
+		StorageRead,
+		StorageWrite,
+		TransferSource,
+		TransferDestination,
+		//Buffers read by the fixed function stages
+		IndirectBuffer,
+		VertexBuffer,
+		IndexBuffer
+	};
+
+	//What a pass gets to record its commands
+	struct PassContext
+	{
+		//Graphics passes only, already begun
+		VkRenderPass		renderPass;
+		VkFramebuffer		framebuffer;
+		VkSubpassContents	contents;
+		VkExtent2D			extent;
+		uint32_t			imageIndex;
+		uint32_t			frameIndex;
+	};
+
+	typedef std::function<void(VkCommandBuffer commandBuffer, const PassContext &context)> RecordFunction;
+
+	//The objects that depend on the extent and the imported images.
+	//Handed out by releaseTargets so they can be retired with a swap chain.
+	struct Targets
+	{
+		std::vector<VkImage>			images;
+		std::vector<DeviceAllocation>	memory;
+		std::vector<VkImageView>		views;
+		std::vector<VkFramebuffer>		framebuffers;
+	};
+
+	RenderGraph();
+
+	void create(VkDevice device, DeviceAllocator &allocator);
+
+	//Destroys the render passes and the current targets
+	void destroy();
+
+	//finalLayout: the layout the image is left in at the end of the frame.
+	//availableStage: the stage a semaphore makes the image available at, 0 if it is always available.
+	ResourceId importImage(const std::string &name, VkFormat format, VkSampleCountFlagBits samples,
+		VkImageLayout finalLayout, VkPipelineStageFlags availableStage);
+	ResourceId importBuffer(const std::string &name);
+	//Created by the graph at the extent of createTargets
+	ResourceId createImage(const std::string &name, VkFormat format, VkSampleCountFlagBits samples);
+
+	PassId addPass(const std::string &name, PassType type, const RecordFunction &record);
+
+	//clearValue: attachments only, clear instead of loading or discarding the contents
+	void use(PassId pass, ResourceId resource, Usage usage, const VkClearValue* clearValue = nullptr);
+
+	//Culls passes, creates the render passes and plans every barrier.
+	//The declaration can't change afterwards.
+	void compile();
+
+	//After compile: nullptr for culled and non-graphics passes
+	VkRenderPass renderPass(PassId pass) const;
+	bool isCulled(PassId pass) const { return mPasses[pass].culled; }
+
+	//One image and view per swap chain image, must be set before createTargets
+	void setImportedImages(ResourceId resource, const std::vector<VkImage> &images, const std::vector<VkImageView> &views);
+
+	//Creates the graph's images and the framebuffers of every graphics pass
+	void createTargets(VkExtent2D extent);
+	//Hands the current targets to the caller, who destroys them with destroyTargets
+	Targets releaseTargets();
+	void destroyTargets(Targets &targets);
+
+	//Inline by default, secondary command buffers need VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+	void setSubpassContents(PassId pass, VkSubpassContents contents) { mPasses[pass].contents = contents; }
+
+	//Records all passes with their barriers.
+	//imageIndex selects the imported images, frameIndex is passed through to the passes.
+	void execute(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frameIndex) const;
+
+	//The compiled schedule: passes, culled passes, barriers and attachment ops
+	void printSchedule() const;
+
+private:
+	struct UsageInfo
+	{
+		VkPipelineStageFlags	stages;
+		VkAccessFlags			access;
+		VkImageLayout			layout;
+		bool					write;
+		bool					attachment;
+	};
+
+	struct Resource
+	{
+		std::string				name;
+		bool					image = true;
+		bool					imported = false;
+		VkFormat				format = VK_FORMAT_UNDEFINED;
+		VkSampleCountFlagBits	samples = VK_SAMPLE_COUNT_1_BIT;
+		VkImageLayout			finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags	availableStage = 0;
+		//Graph images: the shared image it aliases
+		uint32_t				physical = 0;
+		//Imported images
+		std::vector<VkImage>	images;
+		std::vector<VkImageView>	views;
+	};
+
+	struct Use
+	{
+		ResourceId				resource;
+		Usage					usage;
+		bool					clear;
+		VkClearValue			clearValue;
+	};
+
+	struct ImageBarrier
+	{
+		ResourceId				resource;
+		VkAccessFlags			srcAccess;
+		VkAccessFlags			dstAccess;
+		VkImageLayout			oldLayout;
+		VkImageLayout			newLayout;
+	};
+
+	//A pipeline barrier before a pass (or after the last one)
+	struct Barrier
+	{
+		VkPipelineStageFlags		srcStages = 0;
+		VkPipelineStageFlags		dstStages = 0;
+		//Buffers
+		VkAccessFlags				memorySrcAccess = 0;
+		VkAccessFlags				memoryDstAccess = 0;
+		bool						memory = false;
+		std::vector<ImageBarrier>	images;
+
+		bool empty() const { return !memory && images.empty(); }
+	};
+
+	struct Pass
+	{
+		std::string				name;
+		PassType				type;
+		RecordFunction			record;
+		std::vector<Use>		uses;
+		bool					culled = false;
+		VkSubpassContents		contents = VK_SUBPASS_CONTENTS_INLINE;
+
+		Barrier					barrier;
+		//Graphics passes
+		VkRenderPass			renderPass = VK_NULL_HANDLE;
+		std::vector<ResourceId>	attachments;
+		std::vector<VkAttachmentDescription>	attachmentDescriptions;
+		std::vector<VkClearValue>	clearValues;
+		//External dependencies in (barriers and transitions before the pass) and out (final layouts)
+		std::vector<VkSubpassDependency>	dependencies;
+		//Framebuffers in Targets::framebuffers, one per imported image if the pass uses one
+		uint32_t				firstFramebuffer = 0;
+		bool					framebufferPerImage = false;
+	};
+
+	//Where the last uses of an image or buffer left it
+	struct State
+	{
+		VkImageLayout			layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags	writeStages = 0;
+		VkAccessFlags			writeAccess = 0;
+		//Reads since the last write
+		VkPipelineStageFlags	readStages = 0;
+		//Stages the last write has been made visible to
+		VkPipelineStageFlags	visibleStages = 0;
+	};
+
+	//A VkImage created by the graph, shared by aliased resources
+	struct PhysicalImage
+	{
+		VkFormat				format;
+		VkSampleCountFlagBits	samples;
+		VkImageUsageFlags		usage = 0;
+		//Last pass using it so far, while aliases are assigned
+		uint32_t				lastPass = 0;
+		//Its contents never leave a render pass
+		bool					transient = false;
+	};
+
+	static UsageInfo usageInfo(Usage usage);
+	static bool isDepthFormat(VkFormat format);
+	static VkImageAspectFlags aspectOf(VkFormat format);
+
+	void cullPasses();
+	void assignPhysicalImages();
+	//Runs through the passes once, planning barriers and attachment ops.
+	//states is where the previous frame ended.
+	void planPasses(std::vector<State> &states);
+	//After planning, the load and store ops are known
+	void findTransientImages();
+	void createRenderPass(Pass &pass);
+
+	//States are kept per imported resource and per physical image
+	uint32_t stateIndex(ResourceId resource) const;
+	//Whether a pass after `after` needs the contents resource has then
+	bool contentsReadAfter(ResourceId resource, uint32_t after) const;
+	VkImage imageOf(ResourceId resource, uint32_t imageIndex) const;
+	VkImageView viewOf(ResourceId resource, uint32_t imageIndex) const;
+
+	void recordBarrier(VkCommandBuffer commandBuffer, const Barrier &barrier, uint32_t imageIndex) const;
+
+private:
+	VkDevice					mDevice;
+	DeviceAllocator*			mAllocator;
+	std::vector<Resource>		mResources;
+	std::vector<Pass>			mPasses;
+	std::vector<PhysicalImage>	mPhysicalImages;
+	//Brings imported images into their final layout
+	Barrier						mFinalBarrier;
+	bool						mCompiled;
+
+	VkExtent2D					mExtent;
+	Targets						mTargets;
+};
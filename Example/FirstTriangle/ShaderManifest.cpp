@@ -0,0 +1,222 @@
+#include "ShaderManifest.h"
+#include "ReadFile.h"
+
+//Generated by CompileShaders.py --embed, not there otherwise
+#if __has_include("Shaders/spv/EmbeddedShaders.h")
+#include "Shaders/spv/EmbeddedShaders.h"
+#define HAS_EMBEDDED_SHADERS 1
+#else
+#define HAS_EMBEDDED_SHADERS 0
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+//Has to match MANIFEST_VERSION in CompileShaders.py
+static const int MANIFEST_VERSION = 1;
+
+ShaderManifest::ShaderManifest()
+	: mEmbedded(false)
+{
+}
+
+void ShaderManifest::load(const std::string &shaderDir)
+{
+	mOptions.clear();
+	mEntries.clear();
+	mEmbedded = false;
+
+	if (shaderDir.empty() && hasEmbeddedModules())
+	{
+		loadEmbedded();
+	}
+	else
+	{
+		loadFile(shaderDir.empty() ? "Shaders" : shaderDir);
+	}
+}
+
+std::unique_ptr<ShaderBlob> ShaderManifest::open(const std::string &source) const
+{
+	const Entry &entry = find(source);
+	if (mEmbedded)
+	{
+		return std::unique_ptr<ShaderBlob>(new ShaderBlob(entry.words, entry.size));
+	}
+	return std::unique_ptr<ShaderBlob>(new ShaderBlob(mShaderDir + "/spv/" + entry.module));
+}
+
+std::string ShaderManifest::modulePath(const std::string &source) const
+{
+	const Entry &entry = find(source);
+	if (mEmbedded)
+	{
+		throw std::runtime_error("shader " + source + " is embedded, it has no file!");
+	}
+	return mShaderDir + "/spv/" + entry.module;
+}
+
+std::vector<std::string> ShaderManifest::changedSources(const ShaderManifest &previous) const
+{
+	std::vector<std::string> changed;
+	for (auto &entry : mEntries)
+	{
+		auto old = previous.mEntries.find(entry.first);
+		if (old == previous.mEntries.end())
+			continue;
+
+		//Two file manifests: the hash covers source and compile options.
+		//Embedded modules carry no hash, their code is compared instead.
+		//The previous manifest's files may already be deleted by the rebuild,
+		//	but then both are file manifests and the code is never opened.
+		bool differs;
+		if (!mEmbedded && !previous.mEmbedded)
+		{
+			differs = entry.second.hash != old->second.hash;
+		}
+		else
+		{
+			std::unique_ptr<ShaderBlob> code = open(entry.first);
+			std::unique_ptr<ShaderBlob> oldCode = previous.open(entry.first);
+			differs = code->size() != oldCode->size()
+				|| std::memcmp(code->words(), oldCode->words(), code->size()) != 0;
+		}
+
+		if (differs)
+		{
+			changed.push_back(entry.first);
+		}
+	}
+	return changed;
+}
+
+bool ShaderManifest::hasEmbeddedModules()
+{
+	return HAS_EMBEDDED_SHADERS != 0;
+}
+
+const ShaderManifest::Entry& ShaderManifest::find(const std::string &source) const
+{
+	auto entry = mEntries.find(source);
+	if (entry == mEntries.end())
+	{
+		throw std::runtime_error("shader " + source + " is not in the manifest, rebuild the shaders!");
+	}
+	return entry->second;
+}
+
+void ShaderManifest::loadEmbedded()
+{
+#if HAS_EMBEDDED_SHADERS
+	//Built together with the executable, so they can't be out of date
+	//	as long as the build step ran before compiling this file.
+	for (const auto &module : EmbeddedShaders::modules)
+	{
+		Entry entry;
+		entry.words = module.words;
+		entry.size = module.size;
+		mEntries[module.source] = entry;
+	}
+	mShaderDir.clear();
+	mEmbedded = true;
+#endif
+}
+
+void ShaderManifest::loadFile(const std::string &shaderDir)
+{
+	mShaderDir = shaderDir;
+
+	std::string path = mShaderDir + "/spv/manifest.txt";
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("failed to open " + path + ", run Shaders/CompileShaders.py first!");
+	}
+
+	//One record per line, fields separated by tabs:
+	//	version	<n>
+	//	options	<compile options>
+	//	shader	<source>	<hash>	<module>
+	int version = 0;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+
+		std::vector<std::string> fields;
+		std::stringstream stream(line);
+		std::string field;
+		while (std::getline(stream, field, '\t'))
+		{
+			fields.push_back(field);
+		}
+
+		if (fields.size() == 2 && fields[0] == "version")
+		{
+			version = std::stoi(fields[1]);
+		}
+		else if (fields.size() == 2 && fields[0] == "options")
+		{
+			mOptions = fields[1];
+		}
+		else if (fields.size() == 4 && fields[0] == "shader")
+		{
+			Entry entry;
+			entry.hash = fields[2];
+			entry.module = fields[3];
+			mEntries[fields[1]] = entry;
+		}
+	}
+
+	if (version != MANIFEST_VERSION)
+	{
+		throw std::runtime_error(path + " was written by another version of CompileShaders.py, rebuild the shaders!");
+	}
+
+	checkSources();
+}
+
+uint64_t ShaderManifest::hash(const std::string &options, const std::string &source)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	auto add = [&h](unsigned char byte)
+	{
+		h ^= byte;
+		h *= 0x100000001b3ull;
+	};
+
+	for (char c : options)
+		add(static_cast<unsigned char>(c));
+	add('\n');
+	for (char c : source)
+		add(static_cast<unsigned char>(c));
+	return h;
+}
+
+void ShaderManifest::checkSources() const
+{
+	for (auto &entry : mEntries)
+	{
+		//Installed builds may ship without the sources, nothing to compare then
+		std::ifstream file(mShaderDir + "/" + entry.first, std::ios::binary);
+		if (!file.is_open())
+			continue;
+
+		std::stringstream source;
+		source << file.rdbuf();
+
+		char digest[17];
+		snprintf(digest, sizeof(digest), "%016llx", static_cast<unsigned long long>(hash(mOptions, source.str())));
+		if (entry.second.hash != digest)
+		{
+			std::cout << "shader manifest: " << entry.first
+				<< " changed since it was compiled, run Shaders/CompileShaders.py to rebuild it" << std::endl;
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ShaderBlob;
+
+//Finds the SPIR-V modules built by Shaders/CompileShaders.py.
+//
+//The build step names every binary after a hash of its source and compile options
+//	and lists source -> binary in Shaders/spv/manifest.txt,
+//	so the application asks for "VertexShader.vert" instead of a hard-coded .spv path.
+//
+//When the sources are next to the binaries (running from the source tree)
+//	their hash is recomputed on load,
+//	a shader edited without rebuilding is reported instead of silently running old code.
+//
+//When the build step ran with --embed, the binaries are also compiled into the executable
+//	(Shaders/spv/EmbeddedShaders.h).
+//load("") then uses those: no file is opened,
+//	and the application runs from any working directory.
+class ShaderManifest
+{
+public:
+	ShaderManifest();
+
+	//shaderDir: the directory holding the shader sources, the manifest is in its spv subdirectory.
+	//An empty shaderDir uses the embedded modules, or "Shaders" if there are none.
+	void load(const std::string &shaderDir);
+
+	//The code of the module compiled from source, throws if it isn't in the manifest
+	std::unique_ptr<ShaderBlob> open(const std::string &source) const;
+
+	//Path of the SPIR-V module compiled from source, throws if the manifest doesn't list it
+	//	or the modules are embedded.
+	std::string modulePath(const std::string &source) const;
+
+	bool isEmbedded() const { return mEmbedded; }
+
+	//Sources whose module differs from the one in previous, e.g. after the shaders were rebuilt.
+	//Sources in only one of the two lists are skipped, nothing can be using a new one yet.
+	std::vector<std::string> changedSources(const ShaderManifest &previous) const;
+
+	//true if the executable was built with embedded modules
+	static bool hasEmbeddedModules();
+
+	//Same FNV-1a 64 bit hash CompileShaders.py uses
+	static uint64_t hash(const std::string &options, const std::string &source);
+
+private:
+	struct Entry
+	{
+		std::string		hash;
+		std::string		module;
+		//Only set for embedded modules
+		const uint32_t*	words = nullptr;
+		size_t			size = 0;
+	};
+
+	const Entry& find(const std::string &source) const;
+	void loadEmbedded();
+	void loadFile(const std::string &shaderDir);
+	void checkSources() const;
+
+private:
+	std::string						mShaderDir;
+	std::string						mOptions;
+	std::map<std::string, Entry>	mEntries;
+	bool							mEmbedded;
+};
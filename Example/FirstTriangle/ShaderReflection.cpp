@@ -0,0 +1,446 @@
+#include "ShaderReflection.h"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+//The parts of the SPIR-V specification reflection needs
+namespace spv
+{
+	const uint32_t MAGIC = 0x07230203;
+	const uint32_t HEADER_WORDS = 5;
+
+	enum Op
+	{
+		OpEntryPoint		= 15,
+		OpTypeInt			= 21,
+		OpTypeFloat			= 22,
+		OpTypeVector		= 23,
+		OpTypeMatrix		= 24,
+		OpTypeImage			= 25,
+		OpTypeSampler		= 26,
+		OpTypeSampledImage	= 27,
+		OpTypeArray			= 28,
+		OpTypeRuntimeArray	= 29,
+		OpTypeStruct		= 30,
+		OpTypePointer		= 32,
+		OpConstant			= 43,
+		OpFunction			= 54,
+		OpVariable			= 59,
+		OpDecorate			= 71,
+		OpMemberDecorate	= 72,
+	};
+
+	enum Decoration
+	{
+		Block			= 2,
+		BufferBlock		= 3,
+		ArrayStride		= 6,
+		MatrixStride	= 7,
+		BuiltIn			= 11,
+		Location		= 30,
+		Binding			= 33,
+		DescriptorSet	= 34,
+		Offset			= 35,
+	};
+
+	enum StorageClass
+	{
+		UniformConstant	= 0,
+		Input			= 1,
+		Uniform			= 2,
+		PushConstant	= 9,
+		StorageBuffer	= 12,
+	};
+
+	enum Dim
+	{
+		DimBuffer		= 5,
+		DimSubpassData	= 6,
+	};
+}
+
+namespace
+{
+	//Everything known about one result id
+	struct Id
+	{
+		uint32_t				opcode = 0;
+		//Operands of the declaring instruction, without the result id
+		std::vector<uint32_t>	operands;
+		std::map<uint32_t, uint32_t>	decorations;
+		//Per struct member: decoration -> value
+		std::vector<std::map<uint32_t, uint32_t>>	memberDecorations;
+
+		bool has(uint32_t decoration) const { return decorations.count(decoration) != 0; }
+	};
+
+	class Parser
+	{
+	public:
+		Parser(const uint32_t* words, size_t wordCount)
+			: mWords(words)
+			, mWordCount(wordCount)
+		{
+		}
+
+		ShaderReflection parse();
+
+	private:
+		Id& id(uint32_t index);
+		const Id& type(uint32_t index) const;
+		//Follows arrays down to the element type, multiplying their lengths into count
+		const Id& elementType(uint32_t typeId, uint32_t &count) const;
+		uint32_t constant(uint32_t constantId) const;
+		uint32_t typeSize(uint32_t typeId) const;
+
+		void addInput(ShaderReflection &reflection, const Id &variable, const Id &pointee);
+		void addBinding(ShaderReflection &reflection, const Id &variable, uint32_t storageClass, uint32_t typeId);
+
+	private:
+		const uint32_t*		mWords;
+		size_t				mWordCount;
+		std::vector<Id>		mIds;
+	};
+
+	ShaderReflection Parser::parse()
+	{
+		if (mWordCount < spv::HEADER_WORDS || mWords[0] != spv::MAGIC)
+		{
+			throw std::runtime_error("shader reflection: not a SPIR-V module!");
+		}
+		//Word 3 is the bound: all ids are smaller than it
+		mIds.resize(mWords[3]);
+
+		ShaderReflection reflection;
+		bool hasEntryPoint = false;
+		std::vector<uint32_t> variables;
+
+		size_t offset = spv::HEADER_WORDS;
+		while (offset < mWordCount)
+		{
+			uint32_t wordCount = mWords[offset] >> 16;
+			uint32_t opcode = mWords[offset] & 0xffff;
+			if (wordCount == 0 || offset + wordCount > mWordCount)
+			{
+				throw std::runtime_error("shader reflection: truncated SPIR-V module!");
+			}
+			const uint32_t* operands = mWords + offset + 1;
+			uint32_t operandCount = wordCount - 1;
+
+			//The declarations are all in front of the functions
+			if (opcode == spv::OpFunction)
+				break;
+
+			switch (opcode)
+			{
+			case spv::OpEntryPoint:
+				if (!hasEntryPoint && operandCount >= 3)
+				{
+					const VkShaderStageFlagBits stages[] = {
+						VK_SHADER_STAGE_VERTEX_BIT,
+						VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+						VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+						VK_SHADER_STAGE_GEOMETRY_BIT,
+						VK_SHADER_STAGE_FRAGMENT_BIT,
+						VK_SHADER_STAGE_COMPUTE_BIT
+					};
+					if (operands[0] >= sizeof(stages) / sizeof(stages[0]))
+					{
+						throw std::runtime_error("shader reflection: unsupported execution model!");
+					}
+					reflection.stage = stages[operands[0]];
+					//The name is a nul terminated string packed into words
+					const char* name = reinterpret_cast<const char*>(operands + 2);
+					size_t maxLength = (operandCount - 2) * sizeof(uint32_t);
+					reflection.entryPoint.assign(name, std::find(name, name + maxLength, '\0'));
+					hasEntryPoint = true;
+				}
+				break;
+
+			case spv::OpDecorate:
+				if (operandCount >= 2)
+				{
+					id(operands[0]).decorations[operands[1]] = operandCount >= 3 ? operands[2] : 0;
+				}
+				break;
+
+			case spv::OpMemberDecorate:
+				if (operandCount >= 3)
+				{
+					Id &structId = id(operands[0]);
+					if (structId.memberDecorations.size() <= operands[1])
+					{
+						structId.memberDecorations.resize(operands[1] + 1);
+					}
+					structId.memberDecorations[operands[1]][operands[2]] = operandCount >= 4 ? operands[3] : 0;
+				}
+				break;
+
+			case spv::OpTypeInt:
+			case spv::OpTypeFloat:
+			case spv::OpTypeVector:
+			case spv::OpTypeMatrix:
+			case spv::OpTypeImage:
+			case spv::OpTypeSampler:
+			case spv::OpTypeSampledImage:
+			case spv::OpTypeArray:
+			case spv::OpTypeRuntimeArray:
+			case spv::OpTypeStruct:
+			case spv::OpTypePointer:
+				if (operandCount >= 1)
+				{
+					Id &typeId = id(operands[0]);
+					typeId.opcode = opcode;
+					typeId.operands.assign(operands + 1, operands + operandCount);
+				}
+				break;
+
+			case spv::OpConstant:
+			case spv::OpVariable:
+				//result type, result id, value / storage class
+				if (operandCount >= 3)
+				{
+					Id &result = id(operands[1]);
+					result.opcode = opcode;
+					result.operands.assign(operands, operands + operandCount);
+					result.operands.erase(result.operands.begin() + 1);
+					if (opcode == spv::OpVariable)
+					{
+						variables.push_back(operands[1]);
+					}
+				}
+				break;
+			}
+			offset += wordCount;
+		}
+
+		if (!hasEntryPoint)
+		{
+			throw std::runtime_error("shader reflection: the module has no entry point!");
+		}
+
+		for (uint32_t variableId : variables)
+		{
+			const Id &variable = mIds[variableId];
+			//operands: pointer type, storage class
+			uint32_t storageClass = variable.operands[1];
+			const Id &pointer = type(variable.operands[0]);
+			if (pointer.opcode != spv::OpTypePointer || pointer.operands.size() < 2)
+			{
+				throw std::runtime_error("shader reflection: variable without pointer type!");
+			}
+			uint32_t pointeeId = pointer.operands[1];
+
+			switch (storageClass)
+			{
+			case spv::Input:
+				if (reflection.stage == VK_SHADER_STAGE_VERTEX_BIT)
+				{
+					addInput(reflection, variable, type(pointeeId));
+				}
+				break;
+			case spv::UniformConstant:
+			case spv::Uniform:
+			case spv::StorageBuffer:
+				addBinding(reflection, variable, storageClass, pointeeId);
+				break;
+			case spv::PushConstant:
+				reflection.pushConstantSize = std::max(reflection.pushConstantSize, typeSize(pointeeId));
+				break;
+			}
+		}
+
+		std::sort(reflection.inputs.begin(), reflection.inputs.end(),
+			[](const ShaderReflection::VertexInput &a, const ShaderReflection::VertexInput &b)
+			{
+				return a.location < b.location;
+			});
+		std::sort(reflection.bindings.begin(), reflection.bindings.end(),
+			[](const ShaderReflection::DescriptorBinding &a, const ShaderReflection::DescriptorBinding &b)
+			{
+				return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+			});
+		return reflection;
+	}
+
+	Id& Parser::id(uint32_t index)
+	{
+		if (index >= mIds.size())
+		{
+			throw std::runtime_error("shader reflection: id out of bounds!");
+		}
+		return mIds[index];
+	}
+
+	const Id& Parser::type(uint32_t index) const
+	{
+		if (index >= mIds.size() || mIds[index].opcode == 0)
+		{
+			throw std::runtime_error("shader reflection: reference to an undeclared type!");
+		}
+		return mIds[index];
+	}
+
+	const Id& Parser::elementType(uint32_t typeId, uint32_t &count) const
+	{
+		count = 1;
+		const Id* current = &type(typeId);
+		while (current->opcode == spv::OpTypeArray || current->opcode == spv::OpTypeRuntimeArray)
+		{
+			if (current->opcode == spv::OpTypeRuntimeArray)
+			{
+				//Unbounded descriptor arrays need descriptor indexing, which the device doesn't enable
+				throw std::runtime_error("shader reflection: runtime sized descriptor arrays are not supported!");
+			}
+			count *= constant(current->operands[1]);
+			current = &type(current->operands[0]);
+		}
+		return *current;
+	}
+
+	uint32_t Parser::constant(uint32_t constantId) const
+	{
+		if (constantId >= mIds.size() || mIds[constantId].opcode != spv::OpConstant)
+		{
+			throw std::runtime_error("shader reflection: array length is not a constant!");
+		}
+		//operands: result type, value (the low word is enough for a length)
+		return mIds[constantId].operands[1];
+	}
+
+	uint32_t Parser::typeSize(uint32_t typeId) const
+	{
+		const Id &t = type(typeId);
+		switch (t.opcode)
+		{
+		case spv::OpTypeInt:
+		case spv::OpTypeFloat:
+			return t.operands[0] / 8;
+		case spv::OpTypeVector:
+			return typeSize(t.operands[0]) * t.operands[1];
+		case spv::OpTypeMatrix:
+			//Without a MatrixStride (only known per struct member) the columns are packed
+			return typeSize(t.operands[0]) * t.operands[1];
+		case spv::OpTypeArray:
+		{
+			auto stride = t.decorations.find(spv::ArrayStride);
+			uint32_t elementSize = stride != t.decorations.end() ? stride->second : typeSize(t.operands[0]);
+			return elementSize * constant(t.operands[1]);
+		}
+		case spv::OpTypeStruct:
+		{
+			//The block ends after the member with the highest offset
+			uint32_t size = 0;
+			for (uint32_t member = 0; member < t.operands.size(); ++member)
+			{
+				uint32_t memberOffset = 0;
+				uint32_t memberSize = typeSize(t.operands[member]);
+				if (member < t.memberDecorations.size())
+				{
+					auto &decorations = t.memberDecorations[member];
+					auto offset = decorations.find(spv::Offset);
+					if (offset != decorations.end())
+						memberOffset = offset->second;
+
+					const Id &memberType = type(t.operands[member]);
+					auto matrixStride = decorations.find(spv::MatrixStride);
+					if (matrixStride != decorations.end() && memberType.opcode == spv::OpTypeMatrix)
+						memberSize = matrixStride->second * memberType.operands[1];
+				}
+				size = std::max(size, memberOffset + memberSize);
+			}
+			return size;
+		}
+		default:
+			throw std::runtime_error("shader reflection: type has no size!");
+		}
+	}
+
+	void Parser::addInput(ShaderReflection &reflection, const Id &variable, const Id &pointee)
+	{
+		//gl_VertexIndex, gl_InstanceIndex, ... come from the pipeline, not from a vertex buffer
+		auto location = variable.decorations.find(spv::Location);
+		if (variable.has(spv::BuiltIn) || location == variable.decorations.end())
+			return;
+
+		const Id* component = &pointee;
+		uint32_t componentCount = 1;
+		if (pointee.opcode == spv::OpTypeVector)
+		{
+			component = &type(pointee.operands[0]);
+			componentCount = pointee.operands[1];
+		}
+
+		if ((component->opcode != spv::OpTypeFloat && component->opcode != spv::OpTypeInt)
+			|| component->operands[0] != 32 || componentCount > 4)
+		{
+			throw std::runtime_error("shader reflection: vertex inputs have to be 32 bit scalars or vectors!");
+		}
+
+		const VkFormat floatFormats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+		const VkFormat sintFormats[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+		const VkFormat uintFormats[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+
+		ShaderReflection::VertexInput input;
+		input.location = location->second;
+		input.size = 4 * componentCount;
+		if (component->opcode == spv::OpTypeFloat)
+			input.format = floatFormats[componentCount - 1];
+		//OpTypeInt: width, signedness
+		else if (component->operands[1] != 0)
+			input.format = sintFormats[componentCount - 1];
+		else
+			input.format = uintFormats[componentCount - 1];
+		reflection.inputs.push_back(input);
+	}
+
+	void Parser::addBinding(ShaderReflection &reflection, const Id &variable, uint32_t storageClass, uint32_t typeId)
+	{
+		ShaderReflection::DescriptorBinding binding;
+		auto set = variable.decorations.find(spv::DescriptorSet);
+		auto index = variable.decorations.find(spv::Binding);
+		binding.set = set != variable.decorations.end() ? set->second : 0;
+		binding.binding = index != variable.decorations.end() ? index->second : 0;
+
+		const Id &element = elementType(typeId, binding.count);
+		switch (element.opcode)
+		{
+		case spv::OpTypeStruct:
+			//Before SPIR-V 1.3 storage buffers were Uniform blocks decorated with BufferBlock
+			if (storageClass == spv::StorageBuffer || element.has(spv::BufferBlock))
+				binding.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			else
+				binding.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			break;
+		case spv::OpTypeSampler:
+			binding.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+			break;
+		case spv::OpTypeSampledImage:
+			binding.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			break;
+		case spv::OpTypeImage:
+		{
+			//operands: sampled type, dim, depth, arrayed, ms, sampled (1 = with a sampler, 2 = storage), format
+			uint32_t dim = element.operands[1];
+			bool storage = element.operands[5] == 2;
+			if (dim == spv::DimSubpassData)
+				binding.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			else if (dim == spv::DimBuffer)
+				binding.type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			else
+				binding.type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			break;
+		}
+		default:
+			throw std::runtime_error("shader reflection: unsupported descriptor type!");
+		}
+		reflection.bindings.push_back(binding);
+	}
+}
+
+ShaderReflection ShaderReflection::reflect(const uint32_t* words, size_t size)
+{
+	Parser parser(words, size / sizeof(uint32_t));
+	return parser.parse();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//What a SPIR-V module expects from the pipeline it is used in,
+//	read straight from the module's words.
+//
+//A SPIR-V module is a header of 5 words followed by instructions,
+//	every instruction starts with a word holding (word count << 16) | opcode.
+//Types, variables and decorations are all declared before the first function,
+//	so reflection only has to look at the declarations:
+//	OpVariable		a global with a storage class (Input, Uniform, PushConstant, ...)
+//	OpDecorate		Location, DescriptorSet and Binding numbers of those globals
+//	OpType*			what the variables point to, which decides formats and descriptor types
+//
+//Only the first entry point of a module is reflected.
+struct ShaderReflection
+{
+	//A vertex shader input, i.e. one VkVertexInputAttributeDescription
+	struct VertexInput
+	{
+		uint32_t	location;
+		VkFormat	format;
+		//in bytes
+		uint32_t	size;
+	};
+
+	struct DescriptorBinding
+	{
+		uint32_t			set;
+		uint32_t			binding;
+		VkDescriptorType	type;
+		//>1 for arrays of descriptors
+		uint32_t			count;
+	};
+
+	VkShaderStageFlagBits			stage = VK_SHADER_STAGE_VERTEX_BIT;
+	std::string						entryPoint;
+	//Only filled for vertex shaders, sorted by location
+	std::vector<VertexInput>		inputs;
+	//Sorted by set and binding
+	std::vector<DescriptorBinding>	bindings;
+	//Size of the push constant block in bytes, 0 without one
+	uint32_t						pushConstantSize = 0;
+
+	//size in bytes, throws if the words are not valid SPIR-V
+	//	or use something the pipeline can't be set up for automatically.
+	static ShaderReflection reflect(const uint32_t* words, size_t size);
+};
@@ -0,0 +1,203 @@
+#include "ShaderWatcher.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <system_error>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+//How long the directory has to be quiet before a rebuild starts
+static const int QUIET_MS = 100;
+//How often destroy is noticed, and how often the sources are compared when polling
+static const int POLL_MS = 250;
+
+ShaderWatcher::ShaderWatcher()
+	: mQuit(false)
+	, mNotifyFd(-1)
+	, mRebuilds(0)
+	, mSucceeded(false)
+{
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+	destroy();
+}
+
+void ShaderWatcher::create(const std::string &shaderDir, const std::string &compileCommand)
+{
+	mShaderDir = shaderDir;
+	mCompileCommand = compileCommand;
+	mQuit = false;
+	mRebuilds = 0;
+
+#ifdef __linux__
+	//Only the directory itself, the compiler's outputs in spv/ are not reported.
+	//IN_CLOSE_WRITE: a file opened for writing was closed,
+	//IN_MOVED_TO: a file was renamed into the directory, what editors do for atomic saves.
+	mNotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (mNotifyFd >= 0 && inotify_add_watch(mNotifyFd, mShaderDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		close(mNotifyFd);
+		mNotifyFd = -1;
+	}
+#endif
+	if (mNotifyFd < 0)
+	{
+		mModified = scanSources();
+	}
+
+	std::cout << "shader watcher: watching " << mShaderDir
+		<< (mNotifyFd >= 0 ? " (inotify)" : " (polling)") << std::endl;
+	mThread = std::thread(&ShaderWatcher::watchMain, this);
+}
+
+void ShaderWatcher::destroy()
+{
+	if (!mThread.joinable())
+		return;
+
+	//A running compile command is waited for
+	mQuit = true;
+	mThread.join();
+
+#ifdef __linux__
+	if (mNotifyFd >= 0)
+	{
+		close(mNotifyFd);
+	}
+#endif
+	mNotifyFd = -1;
+}
+
+bool ShaderWatcher::poll(bool &succeeded)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mRebuilds == 0)
+		return false;
+
+	//Several rebuilds between two polls: the last one decides
+	mRebuilds = 0;
+	succeeded = mSucceeded;
+	return true;
+}
+
+void ShaderWatcher::watchMain()
+{
+	while (waitForChange())
+	{
+		std::cout << "shader watcher: sources changed, running " << mCompileCommand << std::endl;
+		auto start = Clock::now();
+		int result = std::system(mCompileCommand.c_str());
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		if (result != 0)
+		{
+			std::cerr << "shader watcher: compiling failed, keeping the current shaders" << std::endl;
+		}
+		else
+		{
+			std::cout << "shader watcher: shaders rebuilt in " << ms << " ms" << std::endl;
+		}
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mRebuilds;
+		mSucceeded = result == 0;
+	}
+}
+
+bool ShaderWatcher::waitForChange()
+{
+	return mNotifyFd >= 0 ? waitForChangeNotify() : waitForChangePolling();
+}
+
+bool ShaderWatcher::waitForChangeNotify()
+{
+#ifdef __linux__
+	bool changed = false;
+	while (!mQuit)
+	{
+		//After the first event, wait only until the directory is quiet
+		pollfd request = { mNotifyFd, POLLIN, 0 };
+		int ready = ::poll(&request, 1, changed ? QUIET_MS : POLL_MS);
+		if (ready == 0)
+		{
+			if (changed)
+				return true;
+			continue;
+		}
+		if (ready < 0)
+			continue;
+
+		//Events are variable sized, the name follows the fixed part
+		alignas(inotify_event) char buffer[4096];
+		ssize_t length;
+		while ((length = read(mNotifyFd, buffer, sizeof(buffer))) > 0)
+		{
+			for (char* event = buffer; event < buffer + length;)
+			{
+				const inotify_event* notify = reinterpret_cast<const inotify_event*>(event);
+				if (notify->len > 0 && isShaderSource(notify->name))
+				{
+					changed = true;
+				}
+				event += sizeof(inotify_event) + notify->len;
+			}
+		}
+	}
+#endif
+	return false;
+}
+
+bool ShaderWatcher::waitForChangePolling()
+{
+	bool changed = false;
+	while (!mQuit)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(changed ? QUIET_MS : POLL_MS));
+
+		auto modified = scanSources();
+		if (modified != mModified)
+		{
+			mModified.swap(modified);
+			changed = true;
+		}
+		else if (changed)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+std::map<std::string, std::filesystem::file_time_type> ShaderWatcher::scanSources() const
+{
+	std::map<std::string, std::filesystem::file_time_type> modified;
+	std::error_code error;
+	for (auto it = std::filesystem::directory_iterator(mShaderDir, error); !error && it != std::filesystem::directory_iterator(); it.increment(error))
+	{
+		std::string name = it->path().filename().string();
+		if (isShaderSource(name))
+		{
+			modified[name] = it->last_write_time(error);
+		}
+	}
+	return modified;
+}
+
+bool ShaderWatcher::isShaderSource(const std::string &name)
+{
+	//Same list as SHADER_EXTENSIONS in CompileShaders.py
+	static const char* extensions[] = { ".vert", ".frag", ".comp", ".geom", ".tesc", ".tese" };
+	for (const char* extension : extensions)
+	{
+		std::string suffix = extension;
+		if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+//Watches the shader sources and rebuilds them when one is saved.
+//
+//A thread waits for changes to the files in the shader directory
+//	(inotify on Linux, comparing modification times elsewhere)
+//	and runs the compile command, normally Shaders/CompileShaders.py.
+//The script only recompiles what changed and rewrites the manifest,
+//	the render thread then picks up the result with poll
+//	and hands the changed modules to PipelineRegistry::reload.
+//
+//Editors often save in several steps (truncate, write, rename),
+//	so the rebuild only starts once the directory was quiet for a moment.
+class ShaderWatcher
+{
+public:
+	ShaderWatcher();
+	//Calls destroy, it owns no Vulkan objects
+	~ShaderWatcher();
+
+	//compileCommand is run through std::system in the watcher thread
+	void create(const std::string &shaderDir, const std::string &compileCommand);
+	void destroy();
+
+	//true once for every finished rebuild,
+	//	succeeded tells if the compile command returned 0.
+	bool poll(bool &succeeded);
+
+	bool isWatching() const { return mThread.joinable(); }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	void watchMain();
+
+	//Blocks until a shader source was written or destroy was called,
+	//	returns false in the latter case.
+	bool waitForChange();
+	bool waitForChangeNotify();
+	bool waitForChangePolling();
+
+	//Modification times of the shader sources, for polling
+	std::map<std::string, std::filesystem::file_time_type> scanSources() const;
+
+	static bool isShaderSource(const std::string &name);
+
+private:
+	std::string			mShaderDir;
+	std::string			mCompileCommand;
+
+	std::thread			mThread;
+	std::atomic<bool>	mQuit;
+	//inotify instance, -1 when polling
+	int					mNotifyFd;
+	std::map<std::string, std::filesystem::file_time_type>	mModified;
+
+	//Rebuilds finished and not polled yet
+	std::mutex			mMutex;
+	uint32_t			mRebuilds;
+	bool				mSucceeded;
+};
@@ -1,3 +0,0 @@
-C:\VulkanSDK\1.1.82.0\Bin\glslangValidator.exe -V VertexShader.vert
-C:\VulkanSDK\1.1.82.0\Bin\glslangValidator.exe -V FragShader.frag
-pause
\ No newline at end of file
@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+# Compiles every shader in this directory to SPIR-V.
+#
+#   python CompileShaders.py [--optimize] [--embed] [--force] [--compiler=PATH] [--optimizer=PATH]
+#
+# Outputs go to spv/<source>.<hash>.spv, the hash covers the source text and the compile options.
+# A shader whose output already exists is unchanged and is skipped,
+#   so an incremental build only runs the compiler for shaders that were edited.
+#
+# spv/manifest.txt maps each source to its output, the application looks modules up there
+#   instead of hard-coding file names.
+# The runtime recomputes the hash of the sources it finds and warns when a binary is stale.
+#
+# glslangValidator is searched in $VULKAN_SDK/Bin, $VULKAN_SDK/bin and then in PATH.
+# --optimize additionally runs spirv-opt -O on the result.
+#
+# --embed also writes spv/EmbeddedShaders.h with every binary as a constexpr uint32_t array.
+# ShaderManifest.cpp compiles the header in when it exists,
+#   the application then creates its modules without opening any file.
+# Without --embed the header is removed again, so an old one can't shadow newer binaries.
+
+import os
+import shutil
+import subprocess
+import sys
+
+SHADER_EXTENSIONS = ('.vert', '.frag', '.comp', '.geom', '.tesc', '.tese')
+OUTPUT_DIR = 'spv'
+MANIFEST = 'manifest.txt'
+MANIFEST_VERSION = 1
+EMBEDDED_HEADER = 'EmbeddedShaders.h'
+
+
+# FNV-1a 64 bit, ShaderManifest.cpp computes the same hash to detect stale binaries
+def fnv1a64(data):
+    h = 0xcbf29ce484222325
+    for byte in data:
+        h ^= byte
+        h = (h * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+
+def shader_hash(options, source):
+    return '%016x' % fnv1a64(options.encode('utf-8') + b'\n' + source)
+
+
+def find_tool(name, override):
+    if override:
+        return override
+    exe = name + ('.exe' if os.name == 'nt' else '')
+    sdk = os.environ.get('VULKAN_SDK')
+    if sdk:
+        for bin_dir in ('Bin', 'bin'):
+            candidate = os.path.join(sdk, bin_dir, exe)
+            if os.path.isfile(candidate):
+                return candidate
+    return shutil.which(name)
+
+
+def write_if_changed(path, text):
+    # Unchanged outputs keep their timestamp, so nothing that depends on them is rebuilt
+    if os.path.isfile(path):
+        with open(path) as f:
+            if f.read() == text:
+                return
+    with open(path + '.tmp', 'w', newline='\n') as f:
+        f.write(text)
+    os.replace(path + '.tmp', path)
+
+
+def embedded_header(output_dir, entries):
+    lines = [
+        '#pragma once',
+        '',
+        '//Generated by Shaders/CompileShaders.py --embed, do not edit.',
+        '',
+        '#include <cstddef>',
+        '#include <cstdint>',
+        '',
+        'namespace EmbeddedShaders',
+        '{',
+    ]
+
+    names = []
+    for source, _, output in entries:
+        with open(os.path.join(output_dir, output), 'rb') as f:
+            code = f.read()
+        if len(code) % 4 != 0:
+            raise SystemExit('%s is not a SPIR-V module' % output)
+
+        # SPIR-V is written in the byte order of the machine that produced it,
+        #   the magic number tells which one that was.
+        byteorder = 'little' if code[:4] == b'\x03\x02\x23\x07' else 'big'
+        words = [int.from_bytes(code[i:i + 4], byteorder) for i in range(0, len(code), 4)]
+
+        name = ''.join(c if c.isalnum() else '_' for c in source)
+        names.append((source, name))
+        lines.append('\talignas(4) constexpr uint32_t %s[] =' % name)
+        lines.append('\t{')
+        for i in range(0, len(words), 8):
+            lines.append('\t\t' + ', '.join('0x%08x' % word for word in words[i:i + 8]) + ',')
+        lines.append('\t};')
+        lines.append('')
+
+    lines += [
+        '\tstruct Module',
+        '\t{',
+        '\t\tconst char*\t\tsource;',
+        '\t\tconst uint32_t*\twords;',
+        '\t\t//in bytes',
+        '\t\tsize_t\t\t\tsize;',
+        '\t};',
+        '',
+        '\tconstexpr Module modules[] =',
+        '\t{',
+    ]
+    for source, name in names:
+        lines.append('\t\t{ "%s", %s, sizeof(%s) },' % (source, name, name))
+    lines += ['\t};', '}']
+    return '\n'.join(lines) + '\n'
+
+
+def run(command):
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stdout)
+        raise SystemExit('failed: ' + ' '.join(command))
+
+
+def main(argv):
+    optimize = '--optimize' in argv
+    embed = '--embed' in argv
+    force = '--force' in argv
+    compiler = None
+    optimizer = None
+    for arg in argv:
+        if arg.startswith('--compiler='):
+            compiler = arg[len('--compiler='):]
+        elif arg.startswith('--optimizer='):
+            optimizer = arg[len('--optimizer='):]
+
+    shader_dir = os.path.dirname(os.path.abspath(__file__))
+    output_dir = os.path.join(shader_dir, OUTPUT_DIR)
+    os.makedirs(output_dir, exist_ok=True)
+
+    # Only what changes the produced binary goes into the options,
+    #   not the tool paths, so the hashes are the same on every machine.
+    options = 'glslangValidator -V'
+    if optimize:
+        options += ' | spirv-opt -O'
+
+    sources = sorted(name for name in os.listdir(shader_dir) if name.endswith(SHADER_EXTENSIONS))
+
+    entries = []
+    compiled = 0
+    for name in sources:
+        with open(os.path.join(shader_dir, name), 'rb') as f:
+            source = f.read()
+        digest = shader_hash(options, source)
+        output = '%s.%s.spv' % (name, digest)
+        output_path = os.path.join(output_dir, output)
+        entries.append((name, digest, output))
+
+        if os.path.isfile(output_path) and not force:
+            continue
+
+        if compiler is None:
+            compiler = find_tool('glslangValidator', None)
+            if compiler is None:
+                raise SystemExit('glslangValidator not found, set VULKAN_SDK or pass --compiler=PATH')
+
+        # Write to a temporary name first, an interrupted build must not leave a file
+        #   that looks like a finished output.
+        temp_path = output_path + '.tmp'
+        run([compiler, '-V', os.path.join(shader_dir, name), '-o', temp_path])
+        if optimize:
+            optimizer = find_tool('spirv-opt', optimizer)
+            if optimizer is None:
+                raise SystemExit('spirv-opt not found, set VULKAN_SDK or pass --optimizer=PATH')
+            run([optimizer, '-O', temp_path, '-o', temp_path])
+        os.replace(temp_path, output_path)
+
+        print('compiled %s -> %s/%s' % (name, OUTPUT_DIR, output))
+        compiled += 1
+
+    # Binaries of older versions of the sources are not referenced anymore
+    current = set(output for _, _, output in entries)
+    for name in os.listdir(output_dir):
+        if name.endswith('.spv') and name not in current:
+            os.remove(os.path.join(output_dir, name))
+
+    lines = ['version\t%d' % MANIFEST_VERSION, 'options\t%s' % options]
+    lines += ['shader\t%s\t%s\t%s' % entry for entry in entries]
+    write_if_changed(os.path.join(output_dir, MANIFEST), '\n'.join(lines) + '\n')
+
+    header_path = os.path.join(output_dir, EMBEDDED_HEADER)
+    if embed:
+        write_if_changed(header_path, embedded_header(output_dir, entries))
+    elif os.path.isfile(header_path):
+        os.remove(header_path)
+
+    print('%d of %d shaders compiled' % (compiled, len(entries)))
+
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -1,22 +1,31 @@
 #version 450
 
-vec2 positions[3] = vec2[](
-	vec2( 0.0,-0.5),
-	vec2( 0.5, 0.5),
-	vec2(-0.5, 0.5)
-);
-
-vec3 colors[3] = vec3[](
-	vec3(1.0,0.0,0.0),
-	vec3(0.0,1.0,0.0),
-	vec3(0.0,0.0,1.0)
-);
+//Per-vertex attributes, fed from the vertex buffer.
+//The vertex input state is reflected from these (PipelineLayoutCache::getVertexInput),
+//	Vertex in Vertex.h lays its members out in the same order.
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
 
+//Where each object is drawn, gl_InstanceIndex selects it:
+//	firstInstance of the draw, written by CullObjects.comp with --gpu-culling.
+//Same layout as SceneObject.
+struct SceneObject
+{
+	vec2	center;
+	float	radius;
+	float	scale;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Objects
+{
+	SceneObject objects[];
+};
+
 void main()
 {
-	//gl_VertexIndex:the index of the current vertex. 
-	gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-	fragColor = colors[gl_VertexIndex];
+	SceneObject object = objects[gl_InstanceIndex];
+	gl_Position = vec4(object.center + inPosition * object.scale, 0.0, 1.0);
+	fragColor = inColor;
 }
\ No newline at end of file
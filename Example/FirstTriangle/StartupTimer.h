@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+//Wall time of the initialization phases, printed as one table once startup is done.
+//
+//Each phase ends where the next one begins,
+//	so the phases always add up to the total time since the timer was created.
+class StartupTimer
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	StartupTimer()
+		: mStart(Clock::now())
+		, mLast(mStart)
+	{
+	}
+
+	//Ends the current phase and starts the next one
+	void phase(const char* name)
+	{
+		Clock::time_point now = Clock::now();
+		mPhases.push_back({ name, std::chrono::duration<double, std::milli>(now - mLast).count() });
+		mLast = now;
+	}
+
+	void print() const
+	{
+		std::cout << "startup:" << std::endl;
+		for (const auto &phase : mPhases)
+		{
+			std::cout << "\t" << phase.name << "\t" << phase.ms << " ms" << std::endl;
+		}
+		std::cout << "\ttotal\t" << std::chrono::duration<double, std::milli>(mLast - mStart).count() << " ms" << std::endl;
+	}
+
+private:
+	struct Phase
+	{
+		const char*	name;
+		double		ms;
+	};
+
+	Clock::time_point	mStart;
+	Clock::time_point	mLast;
+	std::vector<Phase>	mPhases;
+};
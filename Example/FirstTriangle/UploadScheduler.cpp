@@ -0,0 +1,456 @@
+#include "UploadScheduler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+//Keep copy source offsets aligned,
+//	some transfer engines are noticeably faster that way.
+const VkDeviceSize STAGING_ALIGNMENT = 16;
+
+static VkDeviceSize alignStaging(VkDeviceSize offset)
+{
+	return (offset + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+}
+
+UploadScheduler::UploadScheduler()
+	: mDevice(VK_NULL_HANDLE)
+	, mAllocator(nullptr)
+	, mTransferFamily(0)
+	, mGraphicsFamily(0)
+	, mTransferQueue(VK_NULL_HANDLE)
+	, mTransferPool(VK_NULL_HANDLE)
+	, mAcquirePool(VK_NULL_HANDLE)
+	, mBuffer(VK_NULL_HANDLE)
+	, mCapacity(0)
+	, mHead(0)
+	, mTail(0)
+	, mSubmitCount(0)
+{
+}
+
+void UploadScheduler::create(VkDevice device, DeviceAllocator &allocator,
+	uint32_t transferFamily, VkQueue transferQueue,
+	uint32_t graphicsFamily, VkDeviceSize capacity)
+{
+	mDevice = device;
+	mAllocator = &allocator;
+	mTransferFamily = transferFamily;
+	mTransferQueue = transferQueue;
+	mGraphicsFamily = graphicsFamily;
+	mCapacity = capacity;
+	mHead = 0;
+	mTail = 0;
+
+	//TRANSFER_SRC only, the buffer is never bound for drawing
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = capacity;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	//HOST_COHERENT: writes through the mapped pointer are visible to the device
+	//	without vkFlushMappedMemoryRanges.
+	mBuffer = mAllocator->createBuffer(bufferInfo,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, mMemory);
+
+	//One pool per queue family, command buffers of a pool can only go to queues of its family.
+	//RESET_COMMAND_BUFFER: batches are recycled one at a time.
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	poolInfo.queueFamilyIndex = mTransferFamily;
+	if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &mTransferPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create transfer command pool!");
+	}
+
+	poolInfo.queueFamilyIndex = mGraphicsFamily;
+	if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &mAcquirePool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create acquire command pool!");
+	}
+}
+
+void UploadScheduler::destroy()
+{
+	for (auto &batch : mBatches)
+	{
+		recycle(batch);
+	}
+	mBatches.clear();
+	mPending.clear();
+
+	for (auto semaphore : mFreeSemaphores)
+	{
+		vkDestroySemaphore(mDevice, semaphore, nullptr);
+	}
+	mFreeSemaphores.clear();
+	for (auto fence : mFreeFences)
+	{
+		vkDestroyFence(mDevice, fence, nullptr);
+	}
+	mFreeFences.clear();
+
+	//Destroying the pools frees their command buffers
+	vkDestroyCommandPool(mDevice, mAcquirePool, nullptr);
+	vkDestroyCommandPool(mDevice, mTransferPool, nullptr);
+	mAllocator->destroyBuffer(mBuffer, mMemory);
+	mBuffer = VK_NULL_HANDLE;
+}
+
+void UploadScheduler::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size,
+	VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+	const char* source = static_cast<const char*>(data);
+
+	//Data bigger than the ring goes in pieces
+	while (size > 0)
+	{
+		VkDeviceSize chunk = std::min(size, mCapacity);
+		VkDeviceSize offset = reserve(chunk);
+		memcpy(static_cast<char*>(mMemory.mapped) + offset, source, static_cast<size_t>(chunk));
+
+		PendingCopy copy;
+		copy.dst = dst;
+		copy.region.srcOffset = offset;
+		copy.region.dstOffset = dstOffset;
+		copy.region.size = chunk;
+		copy.dstStage = dstStage;
+		copy.dstAccess = dstAccess;
+		mPending.push_back(copy);
+
+		source += chunk;
+		dstOffset += chunk;
+		size -= chunk;
+	}
+}
+
+bool UploadScheduler::tryReserve(VkDeviceSize size, VkDeviceSize &offset)
+{
+	bool outstanding = !mPending.empty();
+	for (const auto &batch : mBatches)
+	{
+		outstanding = outstanding || !batch.transferDone;
+	}
+
+	if (!outstanding)
+	{
+		mHead = 0;
+		mTail = 0;
+	}
+
+	VkDeviceSize start = alignStaging(mHead);
+	if (!outstanding || mHead > mTail)
+	{
+		//Free space is [mHead, end) and [0, mTail)
+		if (start + size <= mCapacity)
+		{
+			offset = start;
+		}
+		else if (size <= mTail)
+		{
+			offset = 0;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	else
+	{
+		//Wrapped around: free space is [mHead, mTail), mHead == mTail means full
+		if (mHead == mTail || start + size > mTail)
+			return false;
+		offset = start;
+	}
+
+	mHead = offset + size;
+	return true;
+}
+
+VkDeviceSize UploadScheduler::reserve(VkDeviceSize size)
+{
+	VkDeviceSize offset = 0;
+	while (!tryReserve(size, offset))
+	{
+		//The ring is full: the copies still queued have to go out,
+		//	then wait for the oldest transfer to free its part of the ring.
+		//This only stalls the uploading thread, never the graphics queue.
+		if (!mPending.empty())
+		{
+			submit();
+		}
+
+		auto oldest = std::find_if(mBatches.begin(), mBatches.end(),
+			[](const Batch &batch) { return !batch.transferDone; });
+		if (oldest == mBatches.end())
+		{
+			throw std::runtime_error("upload does not fit into the staging ring!");
+		}
+		vkWaitForFences(mDevice, 1, &oldest->fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		update(0);
+	}
+	return offset;
+}
+
+void UploadScheduler::submit()
+{
+	if (mPending.empty())
+		return;
+
+	Batch batch;
+	batch.transferCommandBuffer = allocateCommandBuffer(mTransferPool);
+	batch.semaphore = getSemaphore();
+	batch.fence = getFence();
+	batch.ringEnd = mHead;
+
+	recordTransfer(batch);
+	if (hasDedicatedTransferQueue())
+	{
+		recordAcquire(batch);
+	}
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.transferCommandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &batch.semaphore;
+	if (vkQueueSubmit(mTransferQueue, 1, &submitInfo, batch.fence) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to submit upload batch!");
+	}
+	++mSubmitCount;
+
+	mPending.clear();
+	mBatches.push_back(batch);
+}
+
+void UploadScheduler::recordTransfer(Batch &batch)
+{
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(batch.transferCommandBuffer, &beginInfo);
+
+	//Copies to the same buffer are queued next to each other,
+	//	hand them to the driver in one vkCmdCopyBuffer.
+	std::vector<VkBufferCopy> regions;
+	for (size_t i = 0; i < mPending.size(); ++i)
+	{
+		regions.push_back(mPending[i].region);
+		if (i + 1 == mPending.size() || mPending[i + 1].dst != mPending[i].dst)
+		{
+			vkCmdCopyBuffer(batch.transferCommandBuffer, mBuffer, mPending[i].dst,
+				static_cast<uint32_t>(regions.size()), regions.data());
+			regions.clear();
+		}
+	}
+
+	std::vector<VkBufferMemoryBarrier> barriers;
+	for (const auto &copy : mPending)
+	{
+		batch.waitStage |= copy.dstStage;
+
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.buffer = copy.dst;
+		barrier.offset = copy.region.dstOffset;
+		barrier.size = copy.region.size;
+		if (hasDedicatedTransferQueue())
+		{
+			//Release: the access mask on the destination side is ignored,
+			//	the acquire barrier on the graphics queue provides it.
+			barrier.dstAccessMask = 0;
+			barrier.srcQueueFamilyIndex = mTransferFamily;
+			barrier.dstQueueFamilyIndex = mGraphicsFamily;
+		}
+		else
+		{
+			barrier.dstAccessMask = copy.dstAccess;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		}
+		barriers.push_back(barrier);
+	}
+
+	VkPipelineStageFlags dstStage = batch.waitStage;
+	if (hasDedicatedTransferQueue())
+	{
+		dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	}
+	vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage,
+		0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+
+	if (vkEndCommandBuffer(batch.transferCommandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record upload command buffer!");
+	}
+}
+
+void UploadScheduler::recordAcquire(Batch &batch)
+{
+	batch.acquireCommandBuffer = allocateCommandBuffer(mAcquirePool);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(batch.acquireCommandBuffer, &beginInfo);
+
+	//Acquire: the same buffer ranges and queue families as the release
+	std::vector<VkBufferMemoryBarrier> barriers;
+	for (const auto &copy : mPending)
+	{
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = copy.dstAccess;
+		barrier.srcQueueFamilyIndex = mTransferFamily;
+		barrier.dstQueueFamilyIndex = mGraphicsFamily;
+		barrier.buffer = copy.dst;
+		barrier.offset = copy.region.dstOffset;
+		barrier.size = copy.region.size;
+		barriers.push_back(barrier);
+	}
+
+	//The semaphore wait blocks waitStage,
+	//	starting the barrier at the same stage chains the two.
+	vkCmdPipelineBarrier(batch.acquireCommandBuffer, batch.waitStage, batch.waitStage,
+		0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+
+	if (vkEndCommandBuffer(batch.acquireCommandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record acquire command buffer!");
+	}
+}
+
+void UploadScheduler::acquireUploads(uint64_t frameNumber,
+	std::vector<VkSemaphore> &waitSemaphores,
+	std::vector<VkPipelineStageFlags> &waitStages,
+	std::vector<VkCommandBuffer> &commandBuffers)
+{
+	for (auto &batch : mBatches)
+	{
+		if (batch.frame != 0)
+			continue;
+
+		batch.frame = frameNumber;
+		waitSemaphores.push_back(batch.semaphore);
+		waitStages.push_back(batch.waitStage);
+		if (batch.acquireCommandBuffer != VK_NULL_HANDLE)
+		{
+			commandBuffers.push_back(batch.acquireCommandBuffer);
+		}
+	}
+}
+
+void UploadScheduler::update(uint64_t completedFrame)
+{
+	for (auto &batch : mBatches)
+	{
+		if (!batch.transferDone && vkGetFenceStatus(mDevice, batch.fence) == VK_SUCCESS)
+		{
+			batch.transferDone = true;
+		}
+	}
+
+	//The ring is freed in submission order
+	for (const auto &batch : mBatches)
+	{
+		if (!batch.transferDone)
+			break;
+		mTail = batch.ringEnd;
+	}
+
+	while (!mBatches.empty())
+	{
+		Batch &batch = mBatches.front();
+		if (!batch.transferDone || batch.frame == 0 || batch.frame > completedFrame)
+			break;
+
+		recycle(batch);
+		mBatches.pop_front();
+	}
+}
+
+VkCommandBuffer UploadScheduler::allocateCommandBuffer(VkCommandPool pool)
+{
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = pool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(mDevice, &allocInfo, &commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate upload command buffer!");
+	}
+	return commandBuffer;
+}
+
+VkSemaphore UploadScheduler::getSemaphore()
+{
+	if (!mFreeSemaphores.empty())
+	{
+		VkSemaphore semaphore = mFreeSemaphores.back();
+		mFreeSemaphores.pop_back();
+		return semaphore;
+	}
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	VkSemaphore semaphore;
+	if (vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create upload semaphore!");
+	}
+	return semaphore;
+}
+
+VkFence UploadScheduler::getFence()
+{
+	if (!mFreeFences.empty())
+	{
+		VkFence fence = mFreeFences.back();
+		mFreeFences.pop_back();
+		vkResetFences(mDevice, 1, &fence);
+		return fence;
+	}
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkFence fence;
+	if (vkCreateFence(mDevice, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create upload fence!");
+	}
+	return fence;
+}
+
+void UploadScheduler::recycle(Batch &batch)
+{
+	vkFreeCommandBuffers(mDevice, mTransferPool, 1, &batch.transferCommandBuffer);
+	if (batch.acquireCommandBuffer != VK_NULL_HANDLE)
+	{
+		vkFreeCommandBuffers(mDevice, mAcquirePool, 1, &batch.acquireCommandBuffer);
+	}
+
+	//A semaphore that was signaled but never waited on can't be reused for another signal,
+	//	it only goes back to the free list once a frame has waited on it.
+	if (batch.frame != 0)
+	{
+		mFreeSemaphores.push_back(batch.semaphore);
+	}
+	else
+	{
+		vkDestroySemaphore(mDevice, batch.semaphore, nullptr);
+	}
+	mFreeFences.push_back(batch.fence);
+}
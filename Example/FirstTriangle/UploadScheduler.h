@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <vector>
+
+#include "DeviceAllocator.h"
+
+//Streams data into device-local buffers on the transfer queue,
+//	without making the graphics queue or the render loop wait for it.
+//
+//Data is written into a host-visible staging ring first
+//	and copied on the GPU with vkCmdCopyBuffer,
+//	device-local memory is usually not visible to the CPU.
+//
+//uploadBuffer only copies the data into the ring and queues a region,
+//	submit records every queued copy into one command buffer
+//	and submits it to the transfer queue as one batch.
+//Nothing waits for the batch on the CPU:
+//	it signals a semaphore that the next graphics submission waits on (acquireUploads).
+//
+//With a dedicated transfer family the buffers change queue family,
+//	for VK_SHARING_MODE_EXCLUSIVE that needs an ownership transfer:
+//	a release barrier at the end of the transfer batch
+//	and a matching acquire barrier recorded into a small graphics command buffer
+//	that runs right before the frame that first uses the data.
+//
+//Staging space, command buffers and semaphores of a batch
+//	are recycled once update sees the transfer and the consuming frame have finished.
+//Only when the ring is full does uploadBuffer wait for the oldest batch.
+//
+//The instance targets Vulkan 1.0, so binary semaphores are used:
+//	each batch signals its own semaphore that is waited on exactly once.
+class UploadScheduler
+{
+public:
+	UploadScheduler();
+
+	//transferFamily may equal graphicsFamily when the device has no dedicated transfer family,
+	//	the ownership transfer is skipped then.
+	void create(VkDevice device, DeviceAllocator &allocator,
+		uint32_t transferFamily, VkQueue transferQueue,
+		uint32_t graphicsFamily, VkDeviceSize capacity);
+
+	//The device has to be idle
+	void destroy();
+
+	//dst needs VK_BUFFER_USAGE_TRANSFER_DST_BIT and must not be used by the GPU
+	//	until the batch it ends up in has been acquired.
+	//dstStage/dstAccess: how the graphics queue reads the data afterwards,
+	//	e.g. VK_PIPELINE_STAGE_VERTEX_INPUT_BIT / VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT.
+	//data is copied right away and may be freed when this returns.
+	void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+
+	//Submits the queued copies to the transfer queue, does not wait
+	void submit();
+
+	//Called while building the graphics submission of frame frameNumber.
+	//Appends a wait semaphore and the acquire command buffer of every submitted batch
+	//	not handed to the graphics queue yet.
+	//The acquire command buffers have to run before the frame's own command buffers.
+	void acquireUploads(uint64_t frameNumber,
+		std::vector<VkSemaphore> &waitSemaphores,
+		std::vector<VkPipelineStageFlags> &waitStages,
+		std::vector<VkCommandBuffer> &commandBuffers);
+
+	//Recycles batches whose transfer has finished
+	//	and whose consuming frame is <= completedFrame.
+	//Never blocks.
+	void update(uint64_t completedFrame);
+
+	bool hasDedicatedTransferQueue() const { return mTransferFamily != mGraphicsFamily; }
+
+	uint32_t submitCount() const { return mSubmitCount; }
+
+private:
+	struct PendingCopy
+	{
+		VkBuffer				dst;
+		VkBufferCopy			region;
+		VkPipelineStageFlags	dstStage;
+		VkAccessFlags			dstAccess;
+	};
+
+	struct Batch
+	{
+		VkCommandBuffer			transferCommandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer			acquireCommandBuffer = VK_NULL_HANDLE;
+		VkSemaphore				semaphore = VK_NULL_HANDLE;
+		VkFence					fence = VK_NULL_HANDLE;
+		VkPipelineStageFlags	waitStage = 0;
+		//End of the batch's data in the ring, the ring tail moves here once the transfer finished
+		VkDeviceSize			ringEnd = 0;
+		bool					transferDone = false;
+		//0 until acquireUploads handed the batch to a frame
+		uint64_t				frame = 0;
+	};
+
+	//Finds size bytes of free ring space, waits for the oldest batch if there are none
+	VkDeviceSize reserve(VkDeviceSize size);
+	bool tryReserve(VkDeviceSize size, VkDeviceSize &offset);
+
+	void recordTransfer(Batch &batch);
+	void recordAcquire(Batch &batch);
+
+	VkCommandBuffer allocateCommandBuffer(VkCommandPool pool);
+	VkSemaphore getSemaphore();
+	VkFence getFence();
+	void recycle(Batch &batch);
+
+private:
+	VkDevice					mDevice;
+	DeviceAllocator*			mAllocator;
+	uint32_t					mTransferFamily;
+	uint32_t					mGraphicsFamily;
+	VkQueue						mTransferQueue;
+	VkCommandPool				mTransferPool;
+	VkCommandPool				mAcquirePool;
+
+	VkBuffer					mBuffer;
+	DeviceAllocation			mMemory;
+	VkDeviceSize				mCapacity;
+	//Ring: data is written at mHead, space before mTail is still read by the GPU
+	VkDeviceSize				mHead;
+	VkDeviceSize				mTail;
+
+	std::vector<PendingCopy>	mPending;
+	//Submitted batches, oldest first
+	std::deque<Batch>			mBatches;
+
+	std::vector<VkSemaphore>	mFreeSemaphores;
+	std::vector<VkFence>		mFreeFences;
+	uint32_t					mSubmitCount;
+};
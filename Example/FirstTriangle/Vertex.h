@@ -0,0 +1,14 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+//Layout of one vertex in the vertex buffer,
+//	matching the inputs of Shaders/VertexShader.vert.
+//
+//The vertex input state is reflected from the shader (PipelineLayoutCache::getVertexInput),
+//	which packs the inputs in location order: members have to follow the same order without padding.
+struct Vertex
+{
+	glm::vec2 pos;
+	glm::vec3 color;
+};